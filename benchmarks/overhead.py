@@ -0,0 +1,191 @@
+"""Measure Scalene's overhead on a set of workloads.
+
+Runs each workload unprofiled, with --cpu-only, and with full (CPU,
+memory and copy) profiling, interleaving the modes over repeated
+trials. Reports each mode's slowdown over the unprofiled run (the mean
+of the per-trial ratios, with a 95% confidence interval), its peak RSS,
+and how many samples arrived on each channel, and writes all of it
+(including every trial) as JSON, so that overhead regressions can be
+caught by comparing runs.
+
+  python3 benchmarks/overhead.py [--trials N] [--json FILE] [WORKLOAD ...]
+
+Run from a checkout with libscalene built (make).
+"""
+
+import argparse
+import json
+import math
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+from typing import Any, Dict, List
+
+here = os.path.dirname(os.path.abspath(__file__))
+root = os.path.dirname(here)
+
+default_workloads = [
+    os.path.join(here, "julia1_nopil.py"),
+    os.path.join(here, "pystone.py"),
+    os.path.join(root, "test", "testme.py"),
+    os.path.join(root, "test", "threads-test.py"),
+]
+
+modes = ["baseline", "cpu", "full"]
+
+# Two-sided 95% quantiles of Student's t distribution, by degrees of
+# freedom (1.96 beyond the table).
+t_quantiles = [
+    12.71, 4.30, 3.18, 2.78, 2.57, 2.45, 2.36, 2.31, 2.26, 2.23,
+    2.20, 2.18, 2.16, 2.14, 2.13, 2.12, 2.11, 2.10, 2.09, 2.09,
+]  # fmt: skip
+
+
+def command(mode: str, workload: str, timeline: str) -> List[str]:
+    if mode == "baseline":
+        return [sys.executable, workload]
+    args = [
+        sys.executable, "-m", "scalene",
+        "--outfile", os.devnull,
+        "--timeline", timeline,
+    ]  # fmt: skip
+    if mode == "cpu":
+        args.append("--cpu-only")
+    return args + [workload]
+
+
+def run(mode: str, workload: str) -> Dict[str, Any]:
+    """Run the workload once; returns its elapsed time (s), peak RSS (MB), exit status and (when profiled) samples per channel."""
+    with tempfile.TemporaryDirectory() as tmp:
+        timeline = os.path.join(tmp, "timeline.json")
+        env = os.environ.copy()
+        env["PYTHONPATH"] = root + os.pathsep + env.get("PYTHONPATH", "")
+        start = time.perf_counter()
+        proc = subprocess.Popen(
+            command(mode, workload, timeline),
+            cwd=os.path.dirname(workload),
+            env=env,
+            stdout=subprocess.DEVNULL,
+            stderr=subprocess.DEVNULL,
+        )
+        # (The peak RSS covers the process and any children it waited
+        # for, as when Scalene re-executes itself.)
+        _, status, rusage = os.wait4(proc.pid, 0)
+        elapsed = time.perf_counter() - start
+        proc.returncode = (
+            os.WEXITSTATUS(status)
+            if os.WIFEXITED(status)
+            else -os.WTERMSIG(status)
+        )
+        samples: Dict[str, int] = {}
+        try:
+            with open(timeline) as f:
+                samples = json.load(f).get("samples", {})
+        except (OSError, ValueError):
+            pass
+    # ru_maxrss is in KB on Linux, and in bytes on macOS.
+    rss_scale = 1024 * 1024 if sys.platform == "darwin" else 1024
+    return {
+        "seconds": elapsed,
+        "peak_rss_mb": rusage.ru_maxrss / rss_scale,
+        "status": proc.returncode,
+        "samples": samples,
+    }
+
+
+def confidence_interval(values: List[float]) -> Dict[str, float]:
+    mean = statistics.mean(values)
+    if len(values) < 2:
+        return {"mean": mean, "low": mean, "high": mean}
+    df = len(values) - 1
+    t = t_quantiles[df - 1] if df <= len(t_quantiles) else 1.96
+    half = t * statistics.stdev(values) / math.sqrt(len(values))
+    return {"mean": mean, "low": mean - half, "high": mean + half}
+
+
+def measure(workload: str, trials: int) -> Dict[str, Any]:
+    results: Dict[str, List[Dict[str, Any]]] = {m: [] for m in modes}
+    # Interleave the modes, so drift in the machine's speed affects
+    # them all alike.
+    for _ in range(trials):
+        for mode in modes:
+            r = run(mode, workload)
+            if r["status"] != 0:
+                return {"error": f"{mode} run exited with {r['status']}"}
+            results[mode].append(r)
+    summary: Dict[str, Any] = {"trials": results}
+    for mode in modes:
+        runs = results[mode]
+        channels = sorted({c for r in runs for c in r["samples"]})
+        summary[mode] = {
+            "seconds": confidence_interval([r["seconds"] for r in runs]),
+            "slowdown": confidence_interval(
+                [
+                    r["seconds"] / b["seconds"]
+                    for (r, b) in zip(runs, results["baseline"])
+                ]
+            ),
+            "peak_rss_mb": max(r["peak_rss_mb"] for r in runs),
+            "samples": {
+                c: statistics.mean(r["samples"].get(c, 0) for r in runs)
+                for c in channels
+            },
+        }
+    return summary
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(
+        description="Measure Scalene's overhead."
+    )
+    parser.add_argument("--trials", type=int, default=5)
+    parser.add_argument(
+        "--json",
+        default="overhead.json",
+        help="where to write the results (default: overhead.json)",
+    )
+    parser.add_argument(
+        "workloads",
+        nargs="*",
+        default=default_workloads,
+        help="Python scripts to run (default: the benchmarks and some tests)",
+    )
+    args = parser.parse_args()
+
+    report: Dict[str, Any] = {
+        "python": sys.version,
+        "platform": sys.platform,
+        "trials": args.trials,
+        "workloads": {},
+    }
+    print(
+        f"{'workload':<20} {'mode':<9} {'seconds':>8} {'slowdown (95% CI)':>22} {'RSS MB':>8}  samples"
+    )
+    for workload in args.workloads:
+        workload = os.path.abspath(workload)
+        name = os.path.basename(workload)
+        summary = measure(workload, max(1, args.trials))
+        report["workloads"][name] = summary
+        if "error" in summary:
+            print(f"{name:<20} skipped: {summary['error']}")
+            continue
+        for mode in modes:
+            m = summary[mode]
+            s = m["slowdown"]
+            slowdown = f"{s['mean']:.2f}x [{s['low']:.2f}, {s['high']:.2f}]"
+            samples = ", ".join(
+                f"{c} {n:.0f}" for (c, n) in m["samples"].items()
+            )
+            print(
+                f"{name:<20} {mode:<9} {m['seconds']['mean']:>8.2f} {slowdown:>22} {m['peak_rss_mb']:>8.1f}  {samples}"
+            )
+    with open(args.json, "w") as f:
+        json.dump(report, f, indent=2)
+
+
+if __name__ == "__main__":
+    main()
@@ -1,5 +1,6 @@
 # CPPFLAGS = -std=c++14 -g -O0
-CPPFLAGS = -std=c++14 -g -O3 -DNDEBUG -fno-builtin-malloc -fvisibility=hidden
+# (Frame pointers let SampleHeap walk the stack cheaply; see stackwalker.hpp.)
+CPPFLAGS = -std=c++14 -g -O3 -DNDEBUG -fno-builtin-malloc -fvisibility=hidden -fno-omit-frame-pointer
 CXX = clang++
 
 UNAME_S := $(shell uname -s)
@@ -19,7 +20,9 @@ MACOS_SRC := $(SRC) src/source/lib$(LIBNAME).cpp vendor/Heap-Layers/wrappers/mac
 MACOS_COMPILE = $(CXX) -flto -ftls-model=initial-exec -ftemplate-depth=1024 -arch x86_64 $(ARMFLAG) -pipe $(CPPFLAGS) $(INCLUDES) -D_REENTRANT=1 -compatibility_version 1 -current_version 1 -D'CUSTOM_PREFIX(x)=xx\#\#x' $(MACOS_SRC) -dynamiclib -install_name $(DESTDIR)$(PREFIX)/lib$(LIBNAME).dylib -o lib$(LIBNAME).dylib -ldl -lpthread 
 
 LINUX_SRC := $(SRC) src/source/lib$(LIBNAME).cpp vendor/Heap-Layers/wrappers/gnuwrapper.cpp
-LINUX_COMPILE = $(CXX) $(CPPFLAGS) -D'CUSTOM_PREFIX(x)=xx\#\#x' -I/usr/include/nptl -pipe -fPIC $(INCLUDES) -D_REENTRANT=1 -shared $(LINUX_SRC) -Bsymbolic -o lib$(LIBNAME).so -ldl -lpthread
+LINUX_FLAGS = $(CPPFLAGS) -D'CUSTOM_PREFIX(x)=xx\#\#x' -I/usr/include/nptl -pipe -fPIC $(INCLUDES) -D_REENTRANT=1 -shared
+LINUX_LIBS = -ldl -lpthread -lrt
+LINUX_COMPILE = $(CXX) $(LINUX_FLAGS) $(LINUX_SRC) -Bsymbolic -o lib$(LIBNAME).so $(LINUX_LIBS)
 
 
 ifeq ($(UNAME_S),Darwin)
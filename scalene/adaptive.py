@@ -41,3 +41,10 @@ class Adaptive:
 
     def len(self) -> int:
         return self.current_index
+
+
+try:
+    # The same, natively (src/source/accumulators.cpp).
+    from accumulators import Adaptive  # type: ignore # noqa: F811
+except ImportError:
+    pass
@@ -2,9 +2,10 @@ import argparse
 import os
 import sys
 from textwrap import dedent
+from scalene.scalene_control import ScaleneControl
 from scalene.scalene_signals import ScaleneSignals
 
-usage = dedent("""Turn Scalene profiling on or off for a specific process.""")
+usage = dedent("""Turn Scalene profiling on or off for a specific process, or change its settings while it runs.""")
 
 parser = argparse.ArgumentParser(
     prog="scalene.profile",
@@ -15,9 +16,77 @@ parser = argparse.ArgumentParser(
 parser.add_argument(
     "--pid", dest="pid", type=int, default=0, help="process ID"
 )
-group = parser.add_mutually_exclusive_group(required=True)
-group.add_argument("--on", action="store_true", help="turn profiling on")
-group.add_argument("--off", action="store_false", help="turn profiling off")
+group = parser.add_mutually_exclusive_group()
+group.add_argument("--on", action="store_true", default=None, help="turn profiling on")
+group.add_argument("--off", dest="on", action="store_false", help="turn profiling off")
+dimensions = ", ".join(ScaleneControl.FLAG_NAMES.keys())
+parser.add_argument(
+    "--enable",
+    action="append",
+    default=[],
+    choices=ScaleneControl.FLAG_NAMES.keys(),
+    metavar="WHAT",
+    help=f"enable profiling of WHAT (one of {dimensions})",
+)
+parser.add_argument(
+    "--disable",
+    action="append",
+    default=[],
+    choices=ScaleneControl.FLAG_NAMES.keys(),
+    metavar="WHAT",
+    help=f"disable profiling of WHAT (one of {dimensions})",
+)
+parser.add_argument(
+    "--cpu-sampling-rate",
+    dest="cpu_sampling_rate",
+    type=float,
+    help="set the CPU sampling rate (in seconds)",
+)
+parser.add_argument(
+    "--malloc-sampling-rate",
+    dest="malloc_sampling_rate",
+    type=int,
+    help="set the mean number of bytes between allocation samples (0 for the default)",
+)
+parser.add_argument(
+    "--malloc-target-samples",
+    dest="malloc_target_samples",
+    type=int,
+    help="with the default malloc sampling rate, adapt toward this many samples per second per thread (0 for the default)",
+)
+parser.add_argument(
+    "--overhead-budget",
+    dest="overhead_budget",
+    type=float,
+    help="with the default malloc sampling rate, keep the time spent handling samples under this percentage (0 for the default)",
+)
+parser.add_argument(
+    "--large-allocation-threshold",
+    dest="large_allocation_threshold",
+    type=ScaleneControl.parse_large_allocation_threshold,
+    metavar="BYTES",
+    help="track allocations of at least this many bytes exactly, rather than sampling them (0 for the default, 1MB; 'none' to sample everything)",
+)
+parser.add_argument(
+    "--memcpy-sampling-rate",
+    dest="memcpy_sampling_rate",
+    type=int,
+    help="set the mean number of bytes between copy samples (0 for the default)",
+)
+parser.add_argument(
+    "--profile-interval",
+    dest="profile_interval",
+    type=float,
+    help="output profiles every so many seconds (inf for never)",
+)
+parser.add_argument(
+    "--snapshot",
+    action="store_true",
+    help="output a profile now (or, in daemon mode, write a snapshot)",
+)
+parser.add_argument(
+    "--status", action="store_true", help="print the current settings"
+)
 
 args, left = parser.parse_known_args()
 if len(sys.argv) == 1 or args.pid == 0:
@@ -25,12 +94,88 @@ if len(sys.argv) == 1 or args.pid == 0:
     sys.exit(-1)
 
 try:
-    if args.on:
-        os.kill(args.pid, ScaleneSignals.start_profiling_signal)
-        print("Scalene: profiling turned on.")
-    else:
-        os.kill(args.pid, ScaleneSignals.stop_profiling_signal)
-        print("Scalene: profiling turned off.")
+    if args.on is not None:
+        if args.on:
+            os.kill(args.pid, ScaleneSignals.start_profiling_signal)
+            print("Scalene: profiling turned on.")
+        else:
+            os.kill(args.pid, ScaleneSignals.stop_profiling_signal)
+            print("Scalene: profiling turned off.")
 
 except ProcessLookupError:
     print("Process " + str(args.pid) + " not found.")
+    sys.exit(-1)
+
+if not (
+    args.enable
+    or args.disable
+    or args.cpu_sampling_rate is not None
+    or args.malloc_sampling_rate is not None
+    or args.malloc_target_samples is not None
+    or args.overhead_budget is not None
+    or args.large_allocation_threshold is not None
+    or args.memcpy_sampling_rate is not None
+    or args.profile_interval is not None
+    or args.snapshot
+    or args.status
+):
+    sys.exit(0)
+
+try:
+    control = ScaleneControl(args.pid, create=False)
+except (OSError, ValueError):
+    print("Process " + str(args.pid) + " is not being profiled by Scalene.")
+    sys.exit(-1)
+
+if args.enable or args.disable:
+    flags = control.flags
+    for name in args.enable:
+        flags |= ScaleneControl.FLAG_NAMES[name]
+    for name in args.disable:
+        flags &= ~ScaleneControl.FLAG_NAMES[name]
+    control.flags = flags
+if args.cpu_sampling_rate is not None:
+    control.cpu_sampling_interval = args.cpu_sampling_rate
+if args.malloc_sampling_rate is not None:
+    control.malloc_sampling_rate = args.malloc_sampling_rate
+if args.malloc_target_samples is not None:
+    control.target_samples_per_sec = args.malloc_target_samples
+if args.overhead_budget is not None:
+    control.overhead_budget = args.overhead_budget / 100
+if args.large_allocation_threshold is not None:
+    control.large_allocation_threshold = args.large_allocation_threshold
+if args.memcpy_sampling_rate is not None:
+    control.memcpy_sampling_rate = args.memcpy_sampling_rate
+if args.profile_interval is not None:
+    control.output_interval = args.profile_interval
+if args.snapshot:
+    control.request_snapshot()
+if args.status:
+    enabled = [
+        name
+        for (name, flag) in ScaleneControl.FLAG_NAMES.items()
+        if control.enabled(flag)
+    ]
+    print(f"enabled:              {', '.join(enabled) or 'nothing'}")
+    print(f"CPU sampling rate:    {control.cpu_sampling_interval}s")
+    print(
+        f"malloc sampling rate: {control.malloc_sampling_rate or 'adaptive'}"
+    )
+    if not control.malloc_sampling_rate:
+        print(
+            f"  target samples/sec: {control.target_samples_per_sec or 'default'}"
+        )
+        print(
+            f"  overhead budget:    {f'{control.overhead_budget * 100}%' if control.overhead_budget else 'default'}"
+        )
+    threshold = control.large_allocation_threshold
+    print(
+        f"large allocations:    {'none' if threshold == ScaleneControl.NO_LARGE_ALLOCATIONS else f'{threshold} bytes and up' if threshold else 'default'}"
+    )
+    print(
+        f"memcpy sampling rate: {control.memcpy_sampling_rate or 'default'}"
+    )
+    interval = control.output_interval
+    print(
+        f"profile interval:     {f'{interval}s' if interval != float('inf') else 'never'}"
+    )
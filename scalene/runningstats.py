@@ -10,14 +10,34 @@ class RunningStats:
         self.clear()
 
     def __add__(self: "RunningStats", other: "RunningStats") -> "RunningStats":
+        """Combine the samples of both (exactly, after Pébay)"""
         s = RunningStats()
-        if other.n > 0:
-            s.m1 = (self.m1 * self.n + other.m1 * other.n) / (self.n + other.n)
-            # TBD: Fix s.m2 and friends
-            # For now, leave at zero.
-            s.n = self.n + other.n
-        else:
-            s = self
+        if self.n == 0 or other.n == 0:
+            s.__dict__.update((other if self.n == 0 else self).__dict__)
+            return s
+        na = self.n
+        nb = other.n
+        n = na + nb
+        delta = other.m1 - self.m1
+        delta2 = delta * delta
+        delta3 = delta * delta2
+        delta4 = delta2 * delta2
+        s.n = n
+        s.m1 = (na * self.m1 + nb * other.m1) / n
+        s.m2 = self.m2 + other.m2 + delta2 * na * nb / n
+        s.m3 = (
+            self.m3
+            + other.m3
+            + delta3 * na * nb * (na - nb) / (n * n)
+            + 3.0 * delta * (na * other.m2 - nb * self.m2) / n
+        )
+        s.m4 = (
+            self.m4
+            + other.m4
+            + delta4 * na * nb * (na * na - na * nb + nb * nb) / (n * n * n)
+            + 6.0 * delta2 * (na * na * other.m2 + nb * nb * self.m2) / (n * n)
+            + 4.0 * delta * (na * other.m3 - nb * self.m3) / n
+        )
         return s
 
     def clear(self) -> None:
@@ -61,3 +81,20 @@ class RunningStats:
     def sem(self) -> float:
         """Standard error of the mean"""
         return self.std() / math.sqrt(self.n)
+
+    def skewness(self) -> float:
+        """Skewness (0 for fewer than two samples)"""
+        if self.n < 2:
+            return 0.0
+        return math.sqrt(self.n) * self.m3 / self.m2**1.5
+
+    def kurtosis(self) -> float:
+        """Excess kurtosis"""
+        return self.n * self.m4 / (self.m2 * self.m2) - 3.0
+
+
+try:
+    # The same, natively (src/source/accumulators.cpp).
+    from accumulators import RunningStats  # type: ignore # noqa: F811
+except ImportError:
+    pass
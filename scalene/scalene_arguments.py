@@ -7,10 +7,22 @@ class ScaleneArguments(argparse.Namespace):
         self.cpu_percent_threshold = 1
         # mean seconds between interrupts for CPU sampling.
         self.cpu_sampling_rate = 0.01
+        # if set, run as a daemon: write periodic snapshots to this directory instead of a final report
+        self.daemon_dir = ""
         self.html = False
         self.malloc_threshold = 100
+        # allocations of at least this many bytes are tracked exactly rather than sampled (0 for the default, 1MB)
+        self.large_allocation_threshold = 0
         self.outfile = None
         self.pid = 0
+        # if set, also write the profile in pprof format to this file
+        self.pprof = ""
+        # if set, also write sampled allocations' native stacks (folded) to this file
+        self.alloc_stacks = ""
+        # if set, also write memory and CPU use over time (as JSON) to this file
+        self.timeline = ""
+        # if set, record every allocation and free to this file (plus .<pid>), for scalene-replay
+        self.trace_allocations = ""
         # if we profile all code or just target code and code in its child directories
         self.profile_all = False
         # how long between outputting stats during execution
@@ -21,5 +33,8 @@ class ScaleneArguments(argparse.Namespace):
         self.program_path = ""
         # reduced profile?
         self.reduced_profile = False
+        # in daemon mode, seconds between snapshots, and how many to keep
+        self.snapshot_interval = 60.0
+        self.max_snapshots = 10
         # do we use virtual time or wallclock time (capturing system time and blocking)?
         self.use_virtual_time = False
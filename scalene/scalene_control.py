@@ -0,0 +1,236 @@
+import fcntl
+import mmap
+import os
+import stat
+
+from typing import Dict, Optional
+
+# The shared-memory control block (see src/include/controlblock.hpp,
+# whose layout this must match): a page, mapped by libscalene and the
+# profiler, through which a running profiler can be reconfigured.
+#
+# All fields are naturally aligned 32- or 64-bit integers, accessed
+# through memoryview casts, so each one is read or written whole.
+
+
+class ScaleneControl:
+    """A mapped control block, for the process with the given pid."""
+
+    MAGIC = 0x4C435353
+    VERSION = 1
+    SIZE = 4096
+
+    # Which profiler dimensions are enabled.
+    CPU = 1 << 0
+    MEMORY = 1 << 1
+    MEMCPY = 1 << 2
+    GIL_WAIT = 1 << 3
+    LOCK_WAIT = 1 << 4
+    ALL_FLAGS = CPU | MEMORY | MEMCPY | GIL_WAIT | LOCK_WAIT
+
+    FLAG_NAMES: Dict[str, int] = {
+        "cpu": CPU,
+        "memory": MEMORY,
+        "memcpy": MEMCPY,
+        "gil-wait": GIL_WAIT,
+        "lock-wait": LOCK_WAIT,
+    }
+
+    # Indices of each field, as 32-bit and 64-bit words.
+    __MAGIC = 0
+    __VERSION = 1
+    __FLAGS = 2
+    __GENERATION = 3
+    __MALLOC_SAMPLING_RATE = 2
+    __MEMCPY_SAMPLING_RATE = 3
+    __CPU_SAMPLING_INTERVAL_USEC = 4
+    __OUTPUT_INTERVAL_MSEC = 5
+    __SNAPSHOT_REQUESTS = 6
+    __TARGET_SAMPLES_PER_SEC = 14
+    __OVERHEAD_BUDGET_PPM = 15
+    __LARGE_ALLOCATION_THRESHOLD = 8
+
+    # A large allocation threshold meaning "sample everything".
+    NO_LARGE_ALLOCATIONS = (1 << 64) - 1
+
+    @staticmethod
+    def parse_large_allocation_threshold(value: str) -> int:
+        """Parses a large allocation threshold given as a number of bytes or "none"."""
+        if value == "none":
+            return ScaleneControl.NO_LARGE_ALLOCATIONS
+        return int(value)
+
+    @staticmethod
+    def filename(pid: int) -> str:
+        return f"/tmp/scalene-control{pid}"
+
+    def __init__(
+        self,
+        pid: int,
+        create: bool = True,
+        parent: Optional["ScaleneControl"] = None,
+    ) -> None:
+        """Map the control block for pid; unless create is set, it must already exist (raises OSError or ValueError otherwise). A new block starts with the parent's settings, if given (and otherwise the defaults)."""
+        fd = ScaleneControl.__open(ScaleneControl.filename(pid), create)
+        try:
+            # Initialize under the same lock libscalene uses.
+            fcntl.flock(fd, fcntl.LOCK_EX)
+            if os.fstat(fd).st_size < ScaleneControl.SIZE:
+                if not create:
+                    raise ValueError("not a Scalene control block")
+                os.ftruncate(fd, ScaleneControl.SIZE)
+            self.__mmap = mmap.mmap(fd, ScaleneControl.SIZE)
+            self.__u32 = memoryview(self.__mmap).cast("I")
+            self.__u64 = memoryview(self.__mmap).cast("Q")
+            if self.__u32[self.__MAGIC] != ScaleneControl.MAGIC:
+                if not create:
+                    raise ValueError("not a Scalene control block")
+                self.__initialize(parent)
+            elif self.__u32[self.__VERSION] != ScaleneControl.VERSION:
+                raise ValueError("unsupported Scalene control block version")
+        finally:
+            fcntl.flock(fd, fcntl.LOCK_UN)
+            os.close(fd)
+
+    @staticmethod
+    def __open(filename: str, create: bool) -> int:
+        """Opens (or creates) the file, refusing any that another user could have planted."""
+        flags = os.O_RDWR | getattr(os, "O_NOFOLLOW", 0)
+        if create:
+            try:
+                return os.open(filename, flags | os.O_CREAT | os.O_EXCL, 0o600)
+            except FileExistsError:
+                pass
+        fd = os.open(filename, flags)
+        st = os.fstat(fd)
+        if (
+            not stat.S_ISREG(st.st_mode)
+            or st.st_uid != os.geteuid()
+            or st.st_nlink != 1
+            or st.st_mode & (stat.S_IRWXG | stat.S_IRWXO)
+        ):
+            os.close(fd)
+            raise ValueError("not a Scalene control block")
+        return fd
+
+    def __initialize(self, parent: Optional["ScaleneControl"]) -> None:
+        if parent:
+            self.__u64[: len(parent.__u64)] = parent.__u64
+            return
+        self.__u32[self.__VERSION] = ScaleneControl.VERSION
+        self.__u32[self.__FLAGS] = ScaleneControl.ALL_FLAGS
+        self.__u32[self.__GENERATION] = 0
+        for i in range(
+            self.__MALLOC_SAMPLING_RATE, self.__SNAPSHOT_REQUESTS + 1
+        ):
+            self.__u64[i] = 0
+        self.__u32[self.__TARGET_SAMPLES_PER_SEC] = 0
+        self.__u32[self.__OVERHEAD_BUDGET_PPM] = 0
+        self.__u64[self.__LARGE_ALLOCATION_THRESHOLD] = 0
+        self.__u32[self.__MAGIC] = ScaleneControl.MAGIC
+
+    def __changed(self) -> None:
+        self.__u32[self.__GENERATION] = (
+            self.__u32[self.__GENERATION] + 1
+        ) & 0xFFFFFFFF
+
+    @property
+    def generation(self) -> int:
+        """Incremented on every change."""
+        return self.__u32[self.__GENERATION]
+
+    @property
+    def flags(self) -> int:
+        return self.__u32[self.__FLAGS]
+
+    @flags.setter
+    def flags(self, flags: int) -> None:
+        self.__u32[self.__FLAGS] = flags & ScaleneControl.ALL_FLAGS
+        self.__changed()
+
+    def enabled(self, flag: int) -> bool:
+        return bool(self.flags & flag)
+
+    @property
+    def malloc_sampling_rate(self) -> int:
+        """Mean bytes between malloc samples (0 for the default)."""
+        return self.__u64[self.__MALLOC_SAMPLING_RATE]
+
+    @malloc_sampling_rate.setter
+    def malloc_sampling_rate(self, rate: int) -> None:
+        self.__u64[self.__MALLOC_SAMPLING_RATE] = rate
+        self.__changed()
+
+    @property
+    def target_samples_per_sec(self) -> int:
+        """With the default malloc sampling rate, how many samples per second (per thread) to adapt toward (0 for the default)."""
+        return self.__u32[self.__TARGET_SAMPLES_PER_SEC]
+
+    @target_samples_per_sec.setter
+    def target_samples_per_sec(self, target: int) -> None:
+        self.__u32[self.__TARGET_SAMPLES_PER_SEC] = target
+        self.__changed()
+
+    @property
+    def overhead_budget(self) -> float:
+        """With the default malloc sampling rate, the fraction of time that handling samples may take (0 for the default)."""
+        return self.__u32[self.__OVERHEAD_BUDGET_PPM] / 1e6
+
+    @overhead_budget.setter
+    def overhead_budget(self, budget: float) -> None:
+        self.__u32[self.__OVERHEAD_BUDGET_PPM] = max(0, int(budget * 1e6))
+        self.__changed()
+
+    @property
+    def large_allocation_threshold(self) -> int:
+        """Allocations of at least this many bytes are tracked exactly, not sampled (0 for the default; NO_LARGE_ALLOCATIONS for none)."""
+        return self.__u64[self.__LARGE_ALLOCATION_THRESHOLD]
+
+    @large_allocation_threshold.setter
+    def large_allocation_threshold(self, threshold: int) -> None:
+        self.__u64[self.__LARGE_ALLOCATION_THRESHOLD] = threshold
+        self.__changed()
+
+    @property
+    def memcpy_sampling_rate(self) -> int:
+        """Mean bytes between memcpy samples (0 for the default)."""
+        return self.__u64[self.__MEMCPY_SAMPLING_RATE]
+
+    @memcpy_sampling_rate.setter
+    def memcpy_sampling_rate(self, rate: int) -> None:
+        self.__u64[self.__MEMCPY_SAMPLING_RATE] = rate
+        self.__changed()
+
+    @property
+    def cpu_sampling_interval(self) -> float:
+        """Seconds between CPU samples (0 for the default)."""
+        return self.__u64[self.__CPU_SAMPLING_INTERVAL_USEC] / 1e6
+
+    @cpu_sampling_interval.setter
+    def cpu_sampling_interval(self, interval: float) -> None:
+        self.__u64[self.__CPU_SAMPLING_INTERVAL_USEC] = max(
+            0, int(interval * 1e6)
+        )
+        self.__changed()
+
+    @property
+    def output_interval(self) -> float:
+        """Seconds between profile outputs (infinite if never)."""
+        msec = self.__u64[self.__OUTPUT_INTERVAL_MSEC]
+        return msec / 1e3 if msec else float("inf")
+
+    @output_interval.setter
+    def output_interval(self, interval: float) -> None:
+        self.__u64[self.__OUTPUT_INTERVAL_MSEC] = (
+            max(1, int(interval * 1e3)) if interval != float("inf") else 0
+        )
+        self.__changed()
+
+    @property
+    def snapshot_requests(self) -> int:
+        """Incremented for each requested snapshot."""
+        return self.__u64[self.__SNAPSHOT_REQUESTS]
+
+    def request_snapshot(self) -> None:
+        self.__u64[self.__SNAPSHOT_REQUESTS] = self.snapshot_requests + 1
+        self.__changed()
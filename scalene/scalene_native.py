@@ -0,0 +1,380 @@
+import ctypes
+import mmap
+import os
+import stat
+import struct
+import sys
+
+import get_line_atomic
+
+from collections import defaultdict
+from functools import lru_cache
+from typing import Any, Dict, List, Optional, Tuple
+
+# Per-thread CPU samples: (Python count, native count, native count per
+# native stack, leaf PC first)
+ThreadSamples = Tuple[int, int, Dict[Tuple[int, ...], int]]
+
+# Sampled allocations still alive at one site: (objects, bytes, objects
+# per age bucket (< 1s, < 10s, < 100s, < 1000s, older), objects made
+# since the previous report)
+LiveSite = Tuple[int, int, Tuple[int, ...], int]
+
+
+class ScaleneNative:
+    """A wrapper around the native sampling facilities of libscalene (only available when it is preloaded)."""
+
+    MAX_BUFSIZE = 256  # Must match SampleFile::MAX_BUFSIZE
+
+    # The capsule name NumPy expects for a memory handler.
+    NUMPY_HANDLER_NAME = b"mem_handler"
+
+    def __init__(self) -> None:
+        self.__lib: Optional[ctypes.CDLL] = None
+        try:
+            # libscalene is preloaded, so its symbols are globally visible.
+            lib = ctypes.CDLL(None)
+            if hasattr(lib, "scalene_enable_thread_cpu_sampling"):
+                lib.scalene_enable_thread_cpu_sampling.argtypes = [
+                    ctypes.c_ulong
+                ]
+                lib.scalene_symbolize.argtypes = [
+                    ctypes.c_void_p,
+                    ctypes.c_char_p,
+                    ctypes.c_size_t,
+                ]
+                lib.scalene_live_allocation_sites.argtypes = [
+                    ctypes.c_char_p,
+                    ctypes.c_size_t,
+                ]
+                lib.scalene_live_allocation_sites.restype = ctypes.c_size_t
+                lib.scalene_numpy_handler.restype = ctypes.c_void_p
+                self.__lib = lib
+        except BaseException:
+            pass
+        # Open sample files, by name: (signal mmap, lock mmap, buffer, last position).
+        self.__sample_files: Dict[str, Tuple[Any, Any, bytearray, bytearray]] = {}
+        # The mapped stack table (see include/stacktable.hpp), once opened.
+        self.__stacks: Optional[mmap.mmap] = None
+        # Our NumPy memory handler capsule, once installed.
+        self.__numpy_handler: Optional[Any] = None
+        self.__numpy_handler_failed = False
+
+    def available(self) -> bool:
+        return self.__lib is not None
+
+    def install_python_allocator(self) -> bool:
+        """Wrap Python's allocators, so that libscalene can tell exactly which allocations Python made."""
+        if not self.__lib:
+            return False
+        try:
+            # PyMem_SetAllocator must be called with the GIL held, which
+            # PyDLL (unlike CDLL) keeps during the call.
+            return bool(ctypes.PyDLL(None).scalene_install_python_allocator())
+        except AttributeError:
+            return False
+
+    def install_numpy_handler(self) -> bool:
+        """Allocate NumPy's array data through libscalene's handler (see include/numpyallocator.hpp), so that it can tell exactly which bytes are array data.
+
+        Does nothing until numpy has been imported, or if it predates
+        the memory handler API (1.22), in which case it stops trying.
+        This runs from signal handlers, possibly in the middle of
+        importing numpy, so it never imports anything itself. NumPy
+        keeps its handler in a context variable, so this only covers
+        the calling thread: other threads keep NumPy's default handler."""
+        if self.__numpy_handler is not None:
+            return True
+        if not self.__lib or self.__numpy_handler_failed:
+            return False
+        numpy = sys.modules.get("numpy")
+        if numpy is None:
+            return False
+        # (numpy.core is deprecated as of NumPy 2.)
+        multiarray = sys.modules.get(
+            "numpy._core.multiarray"
+        ) or sys.modules.get("numpy.core.multiarray")
+        api_capsule = getattr(multiarray, "_ARRAY_API", None)
+        if api_capsule is None:
+            # Either numpy is still being imported (so try again later),
+            # or it has no C API table we know how to use.
+            spec = getattr(numpy, "__spec__", None)
+            if not getattr(spec, "_initializing", False):
+                self.__numpy_handler_failed = True
+            return False
+        try:
+            pythonapi = ctypes.pythonapi
+            pythonapi.PyCapsule_GetPointer.restype = ctypes.c_void_p
+            pythonapi.PyCapsule_GetPointer.argtypes = [
+                ctypes.py_object,
+                ctypes.c_char_p,
+            ]
+            pythonapi.PyCapsule_New.restype = ctypes.py_object
+            pythonapi.PyCapsule_New.argtypes = [
+                ctypes.c_void_p,
+                ctypes.c_char_p,
+                ctypes.c_void_p,
+            ]
+            api = ctypes.cast(
+                pythonapi.PyCapsule_GetPointer(api_capsule, None),
+                ctypes.POINTER(ctypes.c_void_p),
+            )
+            # The C API table's slots, as in numpy's __multiarray_api.h.
+            feature_version = ctypes.CFUNCTYPE(ctypes.c_uint)(api[211])()
+            if feature_version < 0xF:  # NPY_1_22_API_VERSION
+                self.__numpy_handler_failed = True
+                return False
+            handler = pythonapi.PyCapsule_New(
+                self.__lib.scalene_numpy_handler(),
+                self.NUMPY_HANDLER_NAME,
+                None,
+            )
+            set_handler = ctypes.PYFUNCTYPE(
+                ctypes.py_object, ctypes.py_object
+            )(
+                api[304]  # PyDataMem_SetHandler
+            )
+            set_handler(handler)
+        except Exception:
+            return False
+        # (NumPy holds its own reference, but it must outlive every
+        # array allocated through it in any case.)
+        self.__numpy_handler = handler
+        return True
+
+    def enable_thread_cpu_sampling(self, interval: float) -> bool:
+        """Start per-thread CPU sampling every interval seconds of each thread's CPU time."""
+        if not self.__lib:
+            return False
+        self.__lib.scalene_enable_thread_cpu_sampling(
+            max(1, int(interval * 1e6))
+        )
+        return self.__open_sample_file("cpu")
+
+    def disable_thread_cpu_sampling(self) -> None:
+        if self.__lib:
+            self.__lib.scalene_disable_thread_cpu_sampling()
+
+    def enable_gil_wait_sampling(self) -> bool:
+        """Start sampling the time threads spend waiting for the GIL."""
+        if not self.__lib:
+            return False
+        self.__lib.scalene_enable_gil_wait_sampling()
+        return self.__open_sample_file("gil")
+
+    def disable_gil_wait_sampling(self) -> None:
+        if self.__lib:
+            self.__lib.scalene_disable_gil_wait_sampling()
+
+    def enable_lock_wait_sampling(self) -> bool:
+        """Start sampling the time native code spends blocked on pthread locks."""
+        if not self.__lib:
+            return False
+        self.__lib.scalene_enable_lock_wait_sampling()
+        return self.__open_sample_file("lock")
+
+    def disable_lock_wait_sampling(self) -> None:
+        if self.__lib:
+            self.__lib.scalene_disable_lock_wait_sampling()
+
+    def read_lock_wait_samples(self) -> Dict[int, Dict[int, float]]:
+        """Returns the time (in seconds) each thread spent blocked on locks since the last call, by call site address."""
+        samples: Dict[int, Dict[int, float]] = defaultdict(
+            lambda: defaultdict(float)
+        )
+        curr_pid = os.getpid()
+        for line in self.__read_lines("lock"):
+            (tid, wait_ns, call_site, pid) = line.split(",")
+            if int(pid) == curr_pid:
+                samples[int(tid)][int(call_site, 16)] += int(wait_ns) / 1e9
+        return samples
+
+    def read_gil_wait_samples(self) -> Dict[int, float]:
+        """Returns the time (in seconds) each thread spent waiting for the GIL since the last call."""
+        samples: Dict[int, float] = defaultdict(float)
+        curr_pid = os.getpid()
+        for line in self.__read_lines("gil"):
+            (tid, wait_ns, pid) = line.split(",")
+            if int(pid) == curr_pid:
+                samples[int(tid)] += int(wait_ns) / 1e9
+        return samples
+
+    def describe_sampled_stack(self, stack: Tuple[int, ...]) -> str:
+        """Returns a sampled native stack (leaf PC first) as "outermost;...;innermost" function names."""
+        (pc, *callers) = stack
+        # The leaf is the interrupted PC itself; the rest are return addresses.
+        return ";".join(
+            [self.symbolize(address - 1) for address in reversed(callers)]
+            + [self.symbolize(pc)]
+        )
+
+    def read_cpu_samples(self) -> Dict[int, ThreadSamples]:
+        """Returns the samples for each thread since the last call."""
+        samples: Dict[int, ThreadSamples] = defaultdict(
+            lambda: (0, 0, defaultdict(int))
+        )
+        curr_pid = os.getpid()
+        for line in self.__read_lines("cpu"):
+            (tid_str, in_python_str, count_str, pid, stack) = line.split(",")
+            if int(pid) != curr_pid:
+                continue
+            tid = int(tid_str)
+            count = int(count_str)
+            python_count, c_count, native_stacks = samples[tid]
+            if int(in_python_str):
+                python_count += count
+            else:
+                c_count += count
+                if stack:
+                    native_stacks[
+                        tuple(int(address, 16) for address in stack.split(" "))
+                    ] += count
+            samples[tid] = (python_count, c_count, native_stacks)
+        return samples
+
+    # Bounded, so that long-running (daemon mode) processes use constant memory.
+    @lru_cache(maxsize=4096)
+    def symbolize(self, address: int) -> str:
+        """Returns the name of the native function (and its shared object) containing the address."""
+        buf = ctypes.create_string_buffer(ScaleneNative.MAX_BUFSIZE)
+        if self.__lib and self.__lib.scalene_symbolize(
+            address, buf, ScaleneNative.MAX_BUFSIZE
+        ):
+            return buf.value.decode("utf-8", "replace")
+        return "[unknown]"
+
+    LIVE_SITES_BUFSIZE = 1 << 20
+
+    def read_live_allocation_sites(self) -> Dict[int, LiveSite]:
+        """Returns the sampled allocations still alive, by stack id (see LiveObjects::report)."""
+        sites: Dict[int, LiveSite] = {}
+        if not self.__lib:
+            return sites
+        buf = ctypes.create_string_buffer(ScaleneNative.LIVE_SITES_BUFSIZE)
+        n = self.__lib.scalene_live_allocation_sites(
+            buf, ScaleneNative.LIVE_SITES_BUFSIZE
+        )
+        for line in buf.raw[:n].decode("ascii").splitlines():
+            fields = line.split(",")
+            if fields[0] == "dropped":
+                continue
+            try:
+                (stack_id, objects, nbytes, *ages, new) = map(int, fields)
+            except ValueError:
+                # Truncated.
+                continue
+            sites[stack_id] = (objects, nbytes, tuple(ages), new)
+        return sites
+
+    # Must match StackTable::Header and StackTable::Entry.
+    STACK_TABLE_MAGIC = 0x4B545353
+    STACK_TABLE_HEADER = struct.Struct("IIII")  # magic, capacity, max frames, entry size
+    STACK_ENTRY_HEADER = struct.Struct("QII")  # hash, ready, depth
+
+    def read_stack(self, stack_id: int) -> Tuple[int, ...]:
+        """Returns the return addresses (innermost first) of an interned native stack, or () if unavailable."""
+        if stack_id == 0 or not self.__open_stack_table():
+            return ()
+        assert self.__stacks
+        (_, capacity, max_frames, entry_size) = self.STACK_TABLE_HEADER.unpack_from(
+            self.__stacks, 0
+        )
+        if stack_id > capacity:
+            return ()
+        offset = self.STACK_TABLE_HEADER.size + (stack_id - 1) * entry_size
+        (_, ready, depth) = self.STACK_ENTRY_HEADER.unpack_from(
+            self.__stacks, offset
+        )
+        if not ready:
+            return ()
+        return struct.unpack_from(
+            f"{min(depth, max_frames)}Q",
+            self.__stacks,
+            offset + self.STACK_ENTRY_HEADER.size,
+        )
+
+    # Stacks never change once interned.
+    @lru_cache(maxsize=4096)
+    def describe_stack(self, stack_id: int) -> str:
+        """Returns an interned native stack as "outermost;...;innermost" function names (empty if unavailable)."""
+        # These are return addresses, so look up the call instructions just before them.
+        return ";".join(
+            self.symbolize(address - 1)
+            for address in reversed(self.read_stack(stack_id))
+        )
+
+    def after_fork(self) -> None:
+        """In a forked child, switch to the child's own stack table (libscalene gives it one, with the same ids)."""
+        if self.__stacks:
+            self.__stacks.close()
+            self.__stacks = None
+        self.__open_stack_table()
+
+    def __open_stack_table(self) -> bool:
+        if self.__stacks:
+            return True
+        name = f"/tmp/scalene-stacks{os.getpid()}"
+        try:
+            # (Only libscalene's: ours, and not a link to somewhere else.)
+            fd = os.open(name, os.O_RDONLY | getattr(os, "O_NOFOLLOW", 0))
+            try:
+                st = os.fstat(fd)
+                if not stat.S_ISREG(st.st_mode) or st.st_uid != os.geteuid():
+                    return False
+                stacks = mmap.mmap(fd, 0, mmap.MAP_SHARED, mmap.PROT_READ)
+                os.unlink(name)
+            finally:
+                os.close(fd)
+        except BaseException:
+            return False
+        (magic, *_) = self.STACK_TABLE_HEADER.unpack_from(stacks, 0)
+        if magic != self.STACK_TABLE_MAGIC:
+            return False
+        self.__stacks = stacks
+        return True
+
+    def __read_lines(self, name: str) -> List[str]:
+        """Read all the lines written to a sample file since the last read."""
+        lines: List[str] = []
+        if name not in self.__sample_files:
+            return lines
+        (signal_mmap, lock_mmap, buf, lastpos) = self.__sample_files[name]
+        while get_line_atomic.get_line_atomic(
+            lock_mmap, signal_mmap, buf, lastpos
+        ):
+            line = buf.rstrip(b"\x00").split(b"\n")[0].decode("ascii")
+            if line.strip() == "":
+                break
+            lines.append(line)
+        return lines
+
+    def __open_sample_file(self, name: str) -> bool:
+        """Map the signal and lock files for one of libscalene's sample files (see include/samplefile.hpp)."""
+        if name in self.__sample_files:
+            return True
+        # SampleFile names its files after the pid of the process that first created one.
+        try:
+            signal_fd = open(f"/tmp/scalene-{name}-signal{os.getpid()}", "r")
+            os.unlink(signal_fd.name)
+            lock_fd = open(f"/tmp/scalene-{name}-lock{os.getpid()}", "r+")
+            os.unlink(lock_fd.name)
+            signal_mmap = mmap.mmap(
+                signal_fd.fileno(), 0, mmap.MAP_SHARED, mmap.PROT_READ
+            )
+            lock_mmap = mmap.mmap(
+                lock_fd.fileno(),
+                0,
+                mmap.MAP_SHARED,
+                mmap.PROT_READ | mmap.PROT_WRITE,
+            )
+            signal_fd.close()
+            lock_fd.close()
+        except BaseException:
+            return False
+        self.__sample_files[name] = (
+            signal_mmap,
+            lock_mmap,
+            bytearray(ScaleneNative.MAX_BUFSIZE),
+            bytearray(8),
+        )
+        return True
@@ -1,7 +1,8 @@
+import json
 import shutil
 import sys
 
-from collections import OrderedDict
+from collections import OrderedDict, defaultdict
 from operator import itemgetter
 from rich.console import Console
 from rich.markdown import Markdown
@@ -14,7 +15,7 @@ from scalene import sparkline
 from scalene.syntaxline import SyntaxLine
 from scalene.scalene_statistics import *
 
-from typing import Callable, Union
+from typing import Callable, Dict, Union
 
 
 class ScaleneOutput:
@@ -373,6 +374,26 @@ class ScaleneOutput:
                             f" (max: {current_max:6.2f}MB, growth rate: {growth_rate:3.0f}%)\n"
                         ),
                     )
+            rss_samples = stats.rss_samples
+            if len(rss_samples.get()) > 0:
+                # Output what the OS reports (RSS and page faults), for comparison.
+                _, _, rss_spark_str = sparkline.generate(
+                    rss_samples.get()[0 : rss_samples.len()],
+                    0,
+                    stats.max_rss,
+                )
+                if stats.max_rss > 1024:
+                    max_rss_str = f"{(stats.max_rss / 1024):6.2f}GB"
+                else:
+                    max_rss_str = f"{stats.max_rss:6.2f}MB"
+                mem_usage_line = Text.assemble(
+                    mem_usage_line,
+                    "RSS:          ",
+                    ((rss_spark_str, "blue")),
+                    (
+                        f" (max: {max_rss_str}, page faults: {stats.page_faults[0]} minor, {stats.page_faults[1]} major)\n"
+                    ),
+                )
 
         null = open("/dev/null", "w")
 
@@ -661,6 +682,104 @@ class ScaleneOutput:
                     console.print(output_str)
                     number += 1
 
+            # Report the top native functions (currently 3), with their
+            # callers, for the top lines (currently 5) by native time.
+            native_functions = stats.cpu_samples_native_functions[fname]
+            native_lines = sorted(
+                native_functions.keys(),
+                key=lambda line_no: sum(native_functions[line_no].values()),
+                reverse=True,
+            )
+            if len(native_lines) > 0:
+                console.print("Top native functions, by line:")
+                for line_no in native_lines[:5]:
+                    line_total = sum(native_functions[line_no].values())
+                    if line_total == 0:
+                        break
+                    # Show each native stack as its caller and leaf.
+                    callers_and_leaves: Dict[str, float] = defaultdict(float)
+                    for (stack, samples) in native_functions[line_no].items():
+                        callers_and_leaves[
+                            " -> ".join(stack.split(";")[-2:])
+                        ] += samples
+                    top_functions = sorted(
+                        callers_and_leaves.items(),
+                        key=itemgetter(1),
+                        reverse=True,
+                    )[:3]
+                    for (function, samples) in top_functions:
+                        output_str = (
+                            ("%5.0f" % (line_no))
+                            + ": "
+                            + ("%3.0f%%" % (100 * samples / line_total))
+                            + " "
+                            + function
+                        )
+                        console.print(output_str)
+
+            # Report the top lines (currently 5) by time spent waiting for the GIL.
+            gil_waits = OrderedDict(
+                sorted(
+                    stats.gil_wait_samples[fname].items(),
+                    key=itemgetter(1),
+                    reverse=True,
+                )
+            )
+            if len(gil_waits) > 0:
+                console.print("Top GIL wait time, by line:")
+                number = 1
+                for gil_wait_lineno in gil_waits:
+                    if number > 5:
+                        break
+                    output_str = (
+                        "("
+                        + str(number)
+                        + ") "
+                        + ("%5.0f" % (gil_wait_lineno))
+                        + ": "
+                        + ("%6.2f" % (gil_waits[gil_wait_lineno]))
+                        + "s"
+                    )
+                    if stats.elapsed_time > 0:
+                        output_str += " (%3.0f%% of elapsed time)" % (
+                            100 * gil_waits[gil_wait_lineno] / stats.elapsed_time
+                        )
+                    console.print(output_str)
+                    number += 1
+
+            # Report the top lines (currently 5) by time blocked on native
+            # locks, with the native call sites (currently 3) doing the blocking.
+            lock_waits = stats.lock_wait_samples[fname]
+            lock_wait_lines = sorted(
+                lock_waits.keys(),
+                key=lambda line_no: sum(lock_waits[line_no].values()),
+                reverse=True,
+            )
+            if len(lock_wait_lines) > 0:
+                console.print("Top native lock wait time, by line:")
+                number = 1
+                for line_no in lock_wait_lines[:5]:
+                    output_str = (
+                        "("
+                        + str(number)
+                        + ") "
+                        + ("%5.0f" % (line_no))
+                        + ": "
+                        + ("%6.2f" % (sum(lock_waits[line_no].values())))
+                        + "s"
+                    )
+                    console.print(output_str)
+                    top_call_sites = sorted(
+                        lock_waits[line_no].items(),
+                        key=itemgetter(1),
+                        reverse=True,
+                    )[:3]
+                    for (call_site, wait_time) in top_call_sites:
+                        console.print(
+                            "          %6.2fs in %s" % (wait_time, call_site)
+                        )
+                    number += 1
+
             # Only report potential leaks if the allocation velocity (growth rate) is above some threshold
             # FIXME: fixed at 1% for now.
             # We only report potential leaks where the confidence interval is quite tight and includes 1.
@@ -698,6 +817,9 @@ class ScaleneOutput:
                         )
                         console.print(output_str)
 
+        if profile_memory:
+            self.output_surviving_allocations(console, stats)
+
         if self.html:
             # Write HTML file.
             md = Markdown(
@@ -715,3 +837,72 @@ class ScaleneOutput:
                 # Don't output styles to text file.
                 console.save_text(self.output_file, styles=False, clear=False)
         return True
+
+    def output_surviving_allocations(
+        self, console: Console, stats: ScaleneStatistics
+    ) -> None:
+        """Report the native allocation sites with the most sampled memory still alive (currently the top 10), those that are still growing first."""
+        # A site is "growing" if it holds both objects that have
+        # survived a while (at least 10s) and objects made since the
+        # previous report: it keeps allocating memory that is not freed.
+        def growing(site: str) -> bool:
+            (_, _, ages, new) = stats.surviving_allocations[site]
+            return sum(ages[2:]) > 0 and new > 0
+
+        sites = sorted(
+            stats.surviving_allocations.keys(),
+            key=lambda site: (
+                growing(site),
+                stats.surviving_allocations[site][1],
+            ),
+            reverse=True,
+        )
+        if len(sites) == 0:
+            return
+        age_names = ["<1s", "<10s", "<100s", "<1000s", "older"]
+        console.print(
+            "Sampled memory still alive, by native allocation site (still growing first):"
+        )
+        for number, site in enumerate(sites[:10], 1):
+            (objects, mb, ages, new) = stats.surviving_allocations[site]
+            age_str = ", ".join(
+                f"{count} {name}"
+                for (name, count) in zip(age_names, ages)
+                if count > 0
+            )
+            console.print(
+                f"({number}) {mb:8.2f} MB in {objects} sampled objects ({age_str}; {new} new)"
+                + (" [growing]" if growing(site) else "")
+            )
+            # The innermost few frames are the most telling.
+            frames = site.split(";")
+            console.print("          " + " <- ".join(reversed(frames[-3:])))
+
+    def output_timeline(self, stats: ScaleneStatistics, path: str) -> None:
+        """Write memory and CPU use over time as JSON (see ScaleneStatistics.memory_timeline), with the number of samples on each channel."""
+        timeline = {
+            "clock": "monotonic",
+            "memory_columns": ["time", "footprint_mb", "rss_mb"],
+            "memory": stats.memory_timeline.get(),
+            "cpu_columns": ["time", "python_seconds", "native_seconds"],
+            "cpu": stats.cpu_timeline.get(),
+            "samples": dict(stats.samples_by_channel),
+        }
+        with open(path, "w") as out:
+            json.dump(timeline, out)
+
+    def output_allocation_stacks(
+        self, stats: ScaleneStatistics, path: str
+    ) -> None:
+        """Write sampled allocations in folded-stack format (one "frame;...;frame bytes" line per stack, outermost first), for flame graph tools."""
+        with open(path, "w") as out:
+            for fname in sorted(stats.memory_malloc_stacks.keys()):
+                for lineno in sorted(stats.memory_malloc_stacks[fname].keys()):
+                    function = stats.function_map[fname][lineno] or "<unknown>"
+                    python_frame = f"{function} ({fname}:{lineno})"
+                    for (native_stack, mb) in stats.memory_malloc_stacks[
+                        fname
+                    ][lineno].items():
+                        out.write(
+                            f"{python_frame};{native_stack} {int(mb * 1024 * 1024)}\n"
+                        )
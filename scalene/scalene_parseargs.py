@@ -1,4 +1,5 @@
 from scalene.scalene_arguments import ScaleneArguments
+from scalene.scalene_control import ScaleneControl
 from scalene.scalene_version import scalene_version
 
 from typing import (
@@ -61,6 +62,9 @@ for the process ID that Scalene reports. For example:
  Scalene now profiling process 12345
    to suspend profiling: python3 -m scalene.profile --off --pid 12345
    to resume profiling:  python3 -m scalene.profile --on  --pid 12345
+
+You can also change its settings while it runs (see python3 -m scalene.profile --help):
+   % python3 -m scalene.profile --pid 12345 --disable memcpy --cpu-sampling-rate 0.05
 """
         )
         parser = argparse.ArgumentParser(
@@ -85,6 +89,32 @@ for the process ID that Scalene reports. For example:
             + ("stdout" if not defaults.outfile else defaults.outfile)
             + ")",
         )
+        parser.add_argument(
+            "--pprof",
+            type=str,
+            default=defaults.pprof,
+            help="also write the profile to this file in pprof format (gzip'd protobuf) (default: off)",
+        )
+        parser.add_argument(
+            "--alloc-stacks",
+            dest="alloc_stacks",
+            type=str,
+            default=defaults.alloc_stacks,
+            help="also write the native stacks of sampled allocations to this file, in folded format for flame graphs (default: off)",
+        )
+        parser.add_argument(
+            "--timeline",
+            type=str,
+            default=defaults.timeline,
+            help="also write memory and CPU use over time to this file, as JSON, with times on Python's time.monotonic() clock (default: off)",
+        )
+        parser.add_argument(
+            "--trace-allocations",
+            dest="trace_allocations",
+            type=str,
+            default=defaults.trace_allocations,
+            help="record every allocation and free to this file (one per process, suffixed with its pid), for replay with scalene-replay (default: off)",
+        )
         parser.add_argument(
             "--html",
             dest="html",
@@ -109,6 +139,27 @@ for the process ID that Scalene reports. For example:
             default=defaults.profile_interval,
             help=f"output profiles every so many seconds (default: {defaults.profile_interval})",
         )
+        parser.add_argument(
+            "--daemon-dir",
+            dest="daemon_dir",
+            type=str,
+            default=defaults.daemon_dir,
+            help="run continuously, writing compact binary snapshots to this directory instead of a final report (default: off)",
+        )
+        parser.add_argument(
+            "--snapshot-interval",
+            dest="snapshot_interval",
+            type=float,
+            default=defaults.snapshot_interval,
+            help=f"with --daemon-dir, seconds between snapshots (default: {defaults.snapshot_interval})",
+        )
+        parser.add_argument(
+            "--max-snapshots",
+            dest="max_snapshots",
+            type=int,
+            default=defaults.max_snapshots,
+            help=f"with --daemon-dir, how many snapshots to keep (default: {defaults.max_snapshots})",
+        )
         parser.add_argument(
             "--cpu-only",
             dest="cpu_only",
@@ -175,6 +226,14 @@ for the process ID that Scalene reports. For example:
             default=defaults.malloc_threshold,
             help=f"only report profiles with at least this many allocations (default: {defaults.malloc_threshold})",
         )
+        parser.add_argument(
+            "--large-allocation-threshold",
+            dest="large_allocation_threshold",
+            type=ScaleneControl.parse_large_allocation_threshold,
+            default=defaults.large_allocation_threshold,
+            metavar="BYTES",
+            help="track allocations of at least this many bytes exactly, rather than sampling them; 'none' samples everything (default: 1MB)",
+        )
 
         parser.add_argument(
             "--program-path",
@@ -0,0 +1,132 @@
+import time
+
+from typing import Iterator, List, Tuple
+
+from scalene.scalene_statistics import ScaleneStatistics
+
+# Exports profiles in pprof format (gzip'd protobuf), via the native
+# pprof_export extension (src/source/pprof_export.cpp).
+
+PprofFrame = Tuple[str, str, int]  # function, filename, line
+PprofSample = Tuple[List[PprofFrame], List[int]]
+
+SAMPLE_TYPES = [
+    ("cpu_python", "nanoseconds"),
+    ("cpu_native", "nanoseconds"),
+    ("alloc_space", "bytes"),
+    ("alloc_python_space", "bytes"),
+    ("alloc_array_space", "bytes"),
+    ("free_space", "bytes"),
+    ("footprint", "bytes"),
+    ("copy_space", "bytes"),
+]
+
+NS_PER_SECOND = 1e9
+BYTES_PER_MB = 1024 * 1024
+
+
+def pprof_samples(stats: ScaleneStatistics) -> Iterator[PprofSample]:
+    """Generate one pprof sample per profiled line, plus one per native function called from each line."""
+    files = (
+        set(stats.cpu_samples_python.keys())
+        | set(stats.cpu_samples_c.keys())
+        | set(stats.memory_malloc_samples.keys())
+        | set(stats.memory_free_samples.keys())
+        | set(stats.memcpy_samples.keys())
+    )
+    for fname in sorted(files):
+        lines = (
+            set(stats.cpu_samples_python[fname].keys())
+            | set(stats.cpu_samples_c[fname].keys())
+            | set(stats.memory_malloc_samples[fname].keys())
+            | set(stats.memory_free_samples[fname].keys())
+            | set(stats.memcpy_samples[fname].keys())
+        )
+        for lineno in sorted(lines):
+            function = stats.function_map[fname][lineno] or "<unknown>"
+            frame: PprofFrame = (function, fname, lineno)
+            cpu_native = stats.cpu_samples_c[fname].get(lineno, 0.0)
+            # Split native time among the native stacks sampled on this line.
+            native_functions = stats.cpu_samples_native_functions[fname].get(
+                lineno, {}
+            )
+            native_total = sum(native_functions.values())
+            if native_total > 0:
+                for (native_stack, samples) in native_functions.items():
+                    # Symbolized as "outermost;...;innermost", each
+                    # "function (shared object)"; pprof wants leaf first.
+                    native_frames: List[PprofFrame] = []
+                    for native_function in reversed(native_stack.split(";")):
+                        name, sep, obj = native_function.rpartition(" (")
+                        if not sep:
+                            name, obj = native_function, ""
+                        native_frames.append((name, obj.rstrip(")"), 0))
+                    yield (
+                        native_frames + [frame],
+                        [
+                            0,
+                            int(
+                                cpu_native
+                                * samples
+                                / native_total
+                                * NS_PER_SECOND
+                            ),
+                            0,
+                            0,
+                            0,
+                            0,
+                            0,
+                            0,
+                        ],
+                    )
+                cpu_native = 0.0
+            footprint = stats.per_line_footprint_samples[fname].get(lineno)
+            yield (
+                [frame],
+                [
+                    int(
+                        stats.cpu_samples_python[fname].get(lineno, 0.0)
+                        * NS_PER_SECOND
+                    ),
+                    int(cpu_native * NS_PER_SECOND),
+                    int(
+                        sum(stats.memory_malloc_samples[fname][lineno].values())
+                        * BYTES_PER_MB
+                    ),
+                    int(
+                        sum(stats.memory_python_samples[fname][lineno].values())
+                        * BYTES_PER_MB
+                    ),
+                    int(
+                        sum(stats.memory_array_samples[fname][lineno].values())
+                        * BYTES_PER_MB
+                    ),
+                    int(
+                        sum(stats.memory_free_samples[fname][lineno].values())
+                        * BYTES_PER_MB
+                    ),
+                    int(
+                        max(footprint.get(), default=0) * BYTES_PER_MB
+                        if footprint
+                        else 0
+                    ),
+                    int(stats.memcpy_samples[fname].get(lineno, 0)),
+                ],
+            )
+
+
+def write_pprof(
+    stats: ScaleneStatistics, path: str, cpu_sampling_rate: float
+) -> None:
+    """Write the statistics to path as a gzip'd pprof profile."""
+    import pprof_export
+
+    now = time.time()
+    pprof_export.write(
+        path,
+        SAMPLE_TYPES,
+        ("cpu", "nanoseconds", int(cpu_sampling_rate * NS_PER_SECOND)),
+        int((now - stats.elapsed_time) * NS_PER_SECOND),
+        int(stats.elapsed_time * NS_PER_SECOND),
+        pprof_samples(stats),
+    )
@@ -33,6 +33,12 @@ class ScalenePreload:
         if args.cpu_only:
             return False
 
+        if args.trace_allocations:
+            # Read by libscalene as it loads (see allocationtrace.hpp).
+            os.environ["SCALENE_TRACE"] = os.path.abspath(
+                args.trace_allocations
+            )
+
         try:
             from IPython import get_ipython
 
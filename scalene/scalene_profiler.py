@@ -55,13 +55,23 @@ from typing import (
 from multiprocessing.process import BaseProcess
 
 from scalene.scalene_arguments import ScaleneArguments
+from scalene.scalene_control import ScaleneControl
 from scalene.scalene_statistics import *
 from scalene.scalene_output import ScaleneOutput
 from scalene.scalene_preload import ScalenePreload
 from scalene.scalene_signals import ScaleneSignals
 from scalene.scalene_gpu import ScaleneGPU
+from scalene.scalene_native import ScaleneNative
+from scalene.scalene_snapshot import ScaleneSnapshotWriter
+from scalene.scalene_pprof import write_pprof
 from scalene.scalene_parseargs import ScaleneParseArgs, StopJupyterExecution
 
+try:
+    # Finds the frames to record natively (src/source/frame_filter.cpp).
+    import frame_filter
+except ImportError:
+    frame_filter = None  # type: ignore
+
 assert (
     sys.version_info[0] == 3 and sys.version_info[1] >= 6
 ), "Scalene requires Python version 3.6 or above."
@@ -128,6 +138,13 @@ class Scalene:
     __stats = ScaleneStatistics()
     __output = ScaleneOutput()
     __gpu = ScaleneGPU()
+    __native = ScaleneNative()
+    # Are worker threads being sampled natively (see include/threadcpusampler.hpp)?
+    __native_thread_sampling = False
+    # Are GIL waits being sampled (see include/gilwaitsampler.hpp)?
+    __native_gil_wait_sampling = False
+    # Are native lock waits being sampled (see include/lockwaitsampler.hpp)?
+    __native_lock_wait_sampling = False
 
     __output.gpu = __gpu.has_gpu()
 
@@ -163,6 +180,17 @@ class Scalene:
 
     # when we output the next profile
     __next_output_time: float = float("inf")
+    # in daemon mode, where snapshots go, when the current window
+    # started, and when we write the next snapshot
+    __snapshot_writer: Optional[ScaleneSnapshotWriter] = None
+    __snapshot_window_start: float = 0
+    __next_snapshot_time: float = float("inf")
+
+    # the shared control block (see scalene_control.py), the generation
+    # we last applied, and how many snapshot requests we have handled
+    __control: Optional[ScaleneControl] = None
+    __control_generation: int = -1
+    __snapshot_requests: int = 0
     # when we started
     __start_time: float = 0
     # pid for tracking child processes
@@ -276,6 +304,9 @@ class Scalene:
     def profile(func: Any) -> Any:
         # Record the file and function name
         Scalene.__files_to_profile[func.__code__.co_filename] = True
+        if frame_filter:
+            # (This changes what should_trace decides.)
+            frame_filter.clear()
         Scalene.__functions_to_profile[func.__code__.co_filename][func] = True
 
         @functools.wraps(func)
@@ -350,6 +381,10 @@ class Scalene:
             signal.signal(
                 ScaleneSignals.malloc_signal, Scalene.malloc_signal_handler
             )
+            # Let libscalene tell Python's allocations from native ones
+            # (and array data, if numpy is already loaded).
+            Scalene.__native.install_python_allocator()
+            Scalene.__native.install_numpy_handler()
             signal.signal(
                 ScaleneSignals.free_signal, Scalene.free_signal_handler
             )
@@ -376,6 +411,21 @@ class Scalene:
                 Scalene.__args.cpu_sampling_rate,
                 Scalene.__args.cpu_sampling_rate,
             )
+            # Sample every other thread on its own CPU clock, if we can.
+            if Scalene.control_enabled(ScaleneControl.CPU):
+                Scalene.__native_thread_sampling = (
+                    Scalene.__native.enable_thread_cpu_sampling(
+                        Scalene.__args.cpu_sampling_rate
+                    )
+                )
+            if Scalene.control_enabled(ScaleneControl.GIL_WAIT):
+                Scalene.__native_gil_wait_sampling = (
+                    Scalene.__native.enable_gil_wait_sampling()
+                )
+            if Scalene.control_enabled(ScaleneControl.LOCK_WAIT):
+                Scalene.__native_lock_wait_sampling = (
+                    Scalene.__native.enable_lock_wait_sampling()
+                )
 
     @staticmethod
     def get_process_time() -> float:
@@ -403,6 +453,8 @@ class Scalene:
         import scalene.replacement_mp_lock
 
         Scalene.__args = cast(ScaleneArguments, arguments)
+        if frame_filter:
+            frame_filter.set_should_trace(Scalene.should_trace)
         Scalene.set_timer_signals()
         Scalene.__last_signal_time_virtual = Scalene.get_process_time()
 
@@ -516,15 +568,23 @@ class Scalene:
         # before.  See the logic below.
         now_virtual = Scalene.get_process_time()
         now_wallclock = Scalene.get_wallclock_time()
-        # If it's time to print some profiling info, do so.
-        if now_virtual >= Scalene.__next_output_time:
+        snapshot_requested = Scalene.apply_control(now_wallclock)
+        if snapshot_requested and Scalene.__snapshot_writer:
+            # Cut the current window short.
+            Scalene.__next_snapshot_time = now_wallclock
+        # If it's time to print some profiling info (or we've been
+        # asked to), do so.
+        if now_wallclock >= Scalene.__next_output_time or (
+            snapshot_requested and not Scalene.__snapshot_writer
+        ):
             # Print out the profile. Set the next output time, stop
             # signals, print the profile, and then start signals
             # again.
-            Scalene.__next_output_time += (
-                Scalene.__args.output_profile_interval
+            Scalene.__next_output_time = (
+                now_wallclock + Scalene.__args.profile_interval
             )
             Scalene.stop()
+            Scalene.update_surviving_allocations()
             stats = Scalene.__stats
             output = Scalene.__output
             output.output_profiles(
@@ -537,6 +597,22 @@ class Scalene:
                 reduced_profile=Scalene.__args.reduced_profile,
             )
             Scalene.start()
+        if now_wallclock >= Scalene.__next_snapshot_time:
+            Scalene.__next_snapshot_time = (
+                now_wallclock + Scalene.__args.snapshot_interval
+            )
+            Scalene.write_snapshot(now_wallclock)
+        if not Scalene.control_enabled(ScaleneControl.CPU):
+            # Keep the timer running (so we notice when CPU profiling
+            # is re-enabled), but record nothing.
+            Scalene.__last_signal_time_wallclock = now_wallclock
+            Scalene.__last_signal_time_virtual = now_virtual
+            signal.setitimer(
+                ScaleneSignals.cpu_timer_signal,
+                Scalene.__args.cpu_sampling_rate,
+                Scalene.__args.cpu_sampling_rate,
+            )
+            return
         # Here we take advantage of an ostensible limitation of Python:
         # it only delivers signals after the interpreter has given up
         # control. This seems to mean that sampling is limited to code
@@ -580,8 +656,36 @@ class Scalene:
         Scalene.__stats.total_gpu_samples += gpu_time
         python_time = Scalene.__last_cpu_sampling_rate
         c_time = elapsed_virtual - python_time
+        # If libscalene is sampling the other threads on their own
+        # CPU clocks, collect how many Python and native samples each
+        # one has accumulated since the last signal. Their CPU time is
+        # included in the process time, so remove it from the main
+        # thread's native time.
+        thread_samples = None
+        if Scalene.__native_thread_sampling:
+            thread_samples = Scalene.__native.read_cpu_samples()
+            main_tid = threading.main_thread().ident
+            for (tid, (python_count, c_count, _)) in thread_samples.items():
+                if tid != main_tid:
+                    c_time -= (
+                        python_count + c_count
+                    ) * Scalene.__args.cpu_sampling_rate
         if c_time < 0:
             c_time = 0
+        Scalene.__stats.cpu_timeline.add(
+            (time.monotonic(), python_time, c_time)
+        )
+        Scalene.__stats.samples_by_channel["cpu"] += 1
+        gil_waits = None
+        if Scalene.__native_gil_wait_sampling:
+            gil_waits = Scalene.__native.read_gil_wait_samples()
+            Scalene.__stats.samples_by_channel["gil_wait"] += len(gil_waits)
+        lock_waits = None
+        if Scalene.__native_lock_wait_sampling:
+            lock_waits = Scalene.__native.read_lock_wait_samples()
+            Scalene.__stats.samples_by_channel["lock_wait"] += len(
+                lock_waits
+            )
 
         # Update counters for every running thread.
         new_frames = Scalene.compute_frames_to_record(this_frame)
@@ -595,7 +699,11 @@ class Scalene:
         for (frame, tident, orig_frame) in new_frames:
             if not Scalene.__is_thread_sleeping[tident]:
                 total_frames += 1
-        if total_frames == 0:
+        if thread_samples is not None:
+            # Other threads account for their own time (see below),
+            # so the main thread gets all of this interval.
+            total_frames = 1
+        elif total_frames == 0:
             return
         normalized_time = total_time / total_frames
 
@@ -604,6 +712,17 @@ class Scalene:
             fname = Filename(frame.f_code.co_filename)
             lineno = LineNumber(frame.f_lineno)
             Scalene.enter_function_meta(frame, Scalene.__stats)
+            if gil_waits and tident in gil_waits:
+                # Time this thread spent waiting for the GIL.
+                Scalene.__stats.gil_wait_samples[fname][lineno] += gil_waits[
+                    tident
+                ]
+            if lock_waits and tident in lock_waits:
+                # Time this thread spent blocked on native locks, by call site.
+                for (call_site, wait_time) in lock_waits[tident].items():
+                    Scalene.__stats.lock_wait_samples[fname][lineno][
+                        Scalene.__native.symbolize(call_site)
+                    ] += wait_time
             if frame == new_frames[0][0]:
                 # Main thread.
                 if not Scalene.__is_thread_sleeping[tident]:
@@ -623,6 +742,34 @@ class Scalene:
                     Scalene.__stats.gpu_samples[fname][lineno] += (
                         gpu_time / total_frames
                     )
+                    if thread_samples is not None:
+                        Scalene.add_native_function_samples(
+                            fname, lineno, thread_samples[tident][2]
+                        )
+
+            elif thread_samples is not None:
+                # This thread was sampled natively: each sample is one
+                # interval of its own CPU time, and we know whether it
+                # was running in the interpreter or in native code.
+                python_count, c_count, native_stacks = thread_samples[tident]
+                if python_count + c_count == 0:
+                    continue
+                thread_python_time = (
+                    python_count * Scalene.__args.cpu_sampling_rate
+                )
+                thread_c_time = c_count * Scalene.__args.cpu_sampling_rate
+                Scalene.__stats.cpu_samples_python[fname][
+                    lineno
+                ] += thread_python_time
+                Scalene.__stats.cpu_samples_c[fname][lineno] += thread_c_time
+                Scalene.__stats.cpu_samples[fname] += (
+                    thread_python_time + thread_c_time
+                )
+                Scalene.__stats.cpu_utilization[fname][lineno].push(1.0)
+                Scalene.add_native_function_samples(
+                    fname, lineno, native_stacks
+                )
+                total_time += thread_python_time + thread_c_time
 
             else:
                 # We can't play the same game here of attributing
@@ -680,6 +827,71 @@ class Scalene:
             ScaleneSignals.cpu_timer_signal, next_interval, next_interval
         )
 
+    @staticmethod
+    def control_enabled(flag: int) -> bool:
+        """Is this profiler dimension enabled (in the control block, if any)?"""
+        return not Scalene.__control or Scalene.__control.enabled(flag)
+
+    @staticmethod
+    def apply_control(now_wallclock: float) -> bool:
+        """Apply any changes made to the control block since we last looked; returns True if a snapshot was requested."""
+        control = Scalene.__control
+        if not control or control.generation == Scalene.__control_generation:
+            return False
+        Scalene.__control_generation = control.generation
+        args = Scalene.__args
+        interval = control.cpu_sampling_interval
+        if interval > 0 and interval != args.cpu_sampling_rate:
+            args.cpu_sampling_rate = interval
+            if Scalene.__native_thread_sampling:
+                Scalene.__native.enable_thread_cpu_sampling(interval)
+        if control.output_interval != args.profile_interval:
+            args.profile_interval = control.output_interval
+            Scalene.__next_output_time = now_wallclock + args.profile_interval
+        if control.enabled(ScaleneControl.CPU):
+            if not Scalene.__native_thread_sampling:
+                Scalene.__native_thread_sampling = (
+                    Scalene.__native.enable_thread_cpu_sampling(
+                        args.cpu_sampling_rate
+                    )
+                )
+        elif Scalene.__native_thread_sampling:
+            Scalene.__native.disable_thread_cpu_sampling()
+            Scalene.__native_thread_sampling = False
+        if control.enabled(ScaleneControl.GIL_WAIT):
+            if not Scalene.__native_gil_wait_sampling:
+                Scalene.__native_gil_wait_sampling = (
+                    Scalene.__native.enable_gil_wait_sampling()
+                )
+        elif Scalene.__native_gil_wait_sampling:
+            Scalene.__native.disable_gil_wait_sampling()
+            Scalene.__native_gil_wait_sampling = False
+        if control.enabled(ScaleneControl.LOCK_WAIT):
+            if not Scalene.__native_lock_wait_sampling:
+                Scalene.__native_lock_wait_sampling = (
+                    Scalene.__native.enable_lock_wait_sampling()
+                )
+        elif Scalene.__native_lock_wait_sampling:
+            Scalene.__native.disable_lock_wait_sampling()
+            Scalene.__native_lock_wait_sampling = False
+        snapshot_requests = control.snapshot_requests
+        if snapshot_requests != Scalene.__snapshot_requests:
+            Scalene.__snapshot_requests = snapshot_requests
+            return True
+        return False
+
+    @staticmethod
+    def add_native_function_samples(
+        fname: Filename,
+        lineno: LineNumber,
+        native_stacks: Dict[Tuple[int, ...], int],
+    ) -> None:
+        """Attribute native samples on this line to the native stacks (caller to leaf) they were in."""
+        for (stack, count) in native_stacks.items():
+            Scalene.__stats.cpu_samples_native_functions[fname][lineno][
+                Scalene.__native.describe_sampled_stack(stack)
+            ] += (count * Scalene.__args.cpu_sampling_rate)
+
     # Returns final frame (up to a line in a file we are profiling), the thread identifier, and the original frame.
     @staticmethod
     def compute_frames_to_record(
@@ -691,6 +903,14 @@ class Scalene:
             # in the middle of a critical section of the
             # threading library
             return []
+        if frame_filter:
+            return cast(
+                List[Tuple[FrameType, int, FrameType]],
+                frame_filter.frames_to_record(
+                    cast(int, threading.main_thread().ident),
+                    threading._active,  # type: ignore
+                ),
+            )
         frames: List[Tuple[FrameType, int]] = [
             (
                 cast(
@@ -793,6 +1013,8 @@ class Scalene:
         ],
         this_frame: FrameType,
     ) -> None:
+        # numpy may have been imported since the last sample.
+        Scalene.__native.install_numpy_handler()
         Scalene.allocation_signal_handler_helper(signum, this_frame, "malloc")
 
     @staticmethod
@@ -839,7 +1061,9 @@ class Scalene:
                 return
             curr_pid = os.getpid()
             # Process the input array from where we left off reading last time.
-            arr: List[Tuple[int, str, float, float, str]] = []
+            arr: List[
+                Tuple[int, int, str, float, float, str, int, int, int, int, int]
+            ] = []
             try:
                 while True:
                     if not get_line_atomic.get_line_atomic(
@@ -863,22 +1087,37 @@ class Scalene:
                         python_fraction_str,
                         pid,
                         pointer,
+                        rss_str,
+                        minor_faults_str,
+                        major_faults_str,
+                        interval_str,
+                        stack_id_str,
+                        timestamp_str,
+                        array_fraction_str,
                     ) = count_str.split(",")
-                    # assert action in ["M", "f", "F"]
+                    # assert action in ["M", "f", "F", "L", "l"]
                     if int(curr_pid) == int(pid):
                         arr.append(
                             (
+                                int(timestamp_str),
                                 int(alloc_time_str),
                                 action,
                                 float(count_str),
                                 float(python_fraction_str),
                                 pointer,
+                                int(rss_str),
+                                int(minor_faults_str),
+                                int(major_faults_str),
+                                int(interval_str),
+                                int(stack_id_str),
+                                float(array_fraction_str),
                             )
                         )
 
             except FileNotFoundError:
                 pass
 
+            # Order by time (the logical counters are per thread).
             arr.sort()
             # Iterate through the array to compute the new current footprint.
             # and update the global __memory_footprint_samples.
@@ -886,9 +1125,30 @@ class Scalene:
             prevmax = stats.max_footprint
             freed_last_trigger = 0
             for item in arr:
-                _alloc_time, action, count, python_fraction, pointer = item
+                (
+                    timestamp,
+                    _alloc_time,
+                    action,
+                    count,
+                    python_fraction,
+                    pointer,
+                    rss,
+                    minor_faults,
+                    major_faults,
+                    _interval,
+                    _stack_id,
+                    _array_fraction,
+                ) = item
+                # The count credits exactly the sampling interval that
+                # was in effect (which may vary; see
+                # include/adaptiverate.hpp), so it needs no rescaling.
+                # Large allocations ("L") and their frees ("l") are
+                # not sampled: their counts are their exact sizes.
                 count /= 1024 * 1024
-                is_malloc = action == "M"
+                # Track what the OS reports (RSS and page faults) alongside the sampled footprint.
+                Scalene.record_process_memory(rss, minor_faults, major_faults)
+                is_malloc = action in ("M", "L")
+                stats.samples_by_channel["malloc" if is_malloc else "free"] += 1
                 if is_malloc:
                     stats.current_footprint += count
                     if stats.current_footprint > stats.max_footprint:
@@ -900,6 +1160,13 @@ class Scalene:
                         if stats.last_malloc_triggered[2] == pointer:
                             freed_last_trigger += 1
                 stats.memory_footprint_samples.add(stats.current_footprint)
+                stats.memory_timeline.add(
+                    (
+                        timestamp / 1e9,
+                        stats.current_footprint,
+                        rss / (1024 * 1024),
+                    )
+                )
             after = stats.current_footprint
 
             if freed_last_trigger:
@@ -938,19 +1205,38 @@ class Scalene:
                 stats.bytei_map[fname][lineno].add(bytei)
                 curr = before
                 python_frac = 0.0
+                array_frac = 0.0
                 allocs = 0.0
                 last_malloc = (Filename(""), LineNumber(0), Address("0x0"))
                 malloc_pointer = "0x0"
                 # Go through the array again and add each updated current footprint.
                 for item in arr:
-                    _alloc_time, action, count, python_fraction, pointer = item
+                    (
+                        _timestamp,
+                        _alloc_time,
+                        action,
+                        count,
+                        python_fraction,
+                        pointer,
+                        *_,
+                        stack_id,
+                        array_fraction,
+                    ) = item
                     count /= 1024 * 1024
-                    is_malloc = action == "M"
+                    is_malloc = action in ("M", "L")
                     if is_malloc:
                         allocs += count
                         curr += count
                         python_frac += python_fraction * count
+                        array_frac += array_fraction * count
                         malloc_pointer = pointer
+                        native_stack = Scalene.__native.describe_stack(
+                            stack_id
+                        )
+                        if native_stack:
+                            stats.memory_malloc_stacks[fname][lineno][
+                                native_stack
+                            ] += count
                     else:
                         curr -= count
                     stats.per_line_footprint_samples[fname][lineno].add(curr)
@@ -973,6 +1259,9 @@ class Scalene:
                     stats.memory_python_samples[fname][lineno][bytei] += (
                         python_frac / allocs
                     ) * (after - before)
+                    stats.memory_array_samples[fname][lineno][bytei] += (
+                        array_frac / allocs
+                    ) * (after - before)
                     stats.malloc_samples[fname] += 1
                     stats.memory_malloc_count[fname][lineno][bytei] += 1
                     stats.total_memory_malloc_samples += after - before
@@ -992,6 +1281,22 @@ class Scalene:
                     mallocs, frees = stats.leak_score[fname][lineno]
                     stats.leak_score[fname][lineno] = (mallocs + 1, frees)
 
+    @staticmethod
+    def record_process_memory(
+        rss: int, minor_faults: int, major_faults: int
+    ) -> None:
+        """Record the resident set size (in bytes) and page fault counts reported with a malloc sample."""
+        stats = Scalene.__stats
+        rss_mb = rss / (1024 * 1024)
+        stats.rss_samples.add(rss_mb)
+        stats.max_rss = max(stats.max_rss, rss_mb)
+        if stats.page_faults_at_start is None:
+            stats.page_faults_at_start = (minor_faults, major_faults)
+        stats.page_faults = (
+            minor_faults - stats.page_faults_at_start[0],
+            major_faults - stats.page_faults_at_start[1],
+        )
+
     @staticmethod
     def fork_signal_handler(
         signum: Union[
@@ -1007,6 +1312,20 @@ class Scalene:
         Scalene.clear_metrics()
         if Scalene.__gpu.has_gpu():
             Scalene.__gpu.nvml_reinit()
+        Scalene.__native.after_fork()
+        # Our Python side looks for our own control block, which starts
+        # out with our parent's settings.
+        if Scalene.__control:
+            try:
+                Scalene.__control = ScaleneControl(
+                    os.getpid(), parent=Scalene.__control
+                )
+                Scalene.__control_generation = Scalene.__control.generation
+                Scalene.__snapshot_requests = (
+                    Scalene.__control.snapshot_requests
+                )
+            except (OSError, ValueError):
+                pass
         # Note-- __parent_pid of the topmost process is its own pid
         Scalene.__pid = Scalene.__parent_pid
         # Note: Leaving the previous version here, in case `enable_signals`
@@ -1077,6 +1396,7 @@ class Scalene:
             arr.sort()
 
             stats = Scalene.__stats
+            stats.samples_by_channel["memcpy"] += len(arr)
             for item in arr:
                 _memcpy_time, count = item
                 for (the_frame, _tident, _orig_frame) in new_frames:
@@ -1193,6 +1513,9 @@ class Scalene:
         try:
             with Scalene.__in_signal_handler:
                 signal.setitimer(ScaleneSignals.cpu_timer_signal, 0)
+                Scalene.__native.disable_thread_cpu_sampling()
+                Scalene.__native.disable_gil_wait_sampling()
+                Scalene.__native.disable_lock_wait_sampling()
                 signal.signal(ScaleneSignals.malloc_signal, signal.SIG_IGN)
                 signal.signal(ScaleneSignals.free_signal, signal.SIG_IGN)
                 signal.signal(ScaleneSignals.memcpy_signal, signal.SIG_IGN)
@@ -1213,6 +1536,10 @@ class Scalene:
             os.remove(f"/tmp/scalene-malloc-lock{os.getpid()}")
         except BaseException:
             pass
+        try:
+            os.remove(ScaleneControl.filename(os.getpid()))
+        except BaseException:
+            pass
 
     @staticmethod
     def termination_handler(
@@ -1244,6 +1571,11 @@ class Scalene:
             traceback.print_exc()
 
         self.stop()
+        if Scalene.__snapshot_writer:
+            # In daemon mode, the last window is just one more snapshot.
+            Scalene.write_snapshot(Scalene.get_wallclock_time())
+            return exit_status
+        Scalene.update_surviving_allocations()
         # If we've collected any samples, dump them.
         if Scalene.__output.output_profiles(
             Scalene.__stats,
@@ -1257,17 +1589,100 @@ class Scalene:
             pass
         else:
             print("Scalene: Program did not run for long enough to profile.")
+        if Scalene.__args.pprof and not Scalene.__is_child:
+            # By now, output_profiles has merged in any child processes' stats.
+            try:
+                write_pprof(
+                    Scalene.__stats,
+                    Scalene.__args.pprof,
+                    Scalene.__args.cpu_sampling_rate,
+                )
+            except (ImportError, OSError) as e:
+                print(f"Scalene: could not write pprof profile: {e}")
+        if Scalene.__args.timeline and not Scalene.__is_child:
+            try:
+                Scalene.__output.output_timeline(
+                    Scalene.__stats, Scalene.__args.timeline
+                )
+            except OSError as e:
+                print(f"Scalene: could not write timeline: {e}")
+        if Scalene.__args.alloc_stacks and not Scalene.__is_child:
+            try:
+                Scalene.__output.output_allocation_stacks(
+                    Scalene.__stats, Scalene.__args.alloc_stacks
+                )
+            except OSError as e:
+                print(f"Scalene: could not write allocation stacks: {e}")
         return exit_status
 
+    @staticmethod
+    def update_surviving_allocations() -> None:
+        """Record the sampled allocations still alive, by native allocation site (for the leak report)."""
+        if Scalene.__args.cpu_only:
+            return
+        stats = Scalene.__stats
+        stats.surviving_allocations.clear()
+        for (stack_id, (objects, nbytes, ages, new)) in (
+            Scalene.__native.read_live_allocation_sites().items()
+        ):
+            site = Scalene.__native.describe_stack(stack_id) or "[unknown]"
+            ScaleneStatistics.increment_surviving_allocations(
+                stats.surviving_allocations,
+                {site: (objects, nbytes / (1024 * 1024), ages, new)},
+            )
+
+    @staticmethod
+    def write_snapshot(now_wallclock: float) -> None:
+        """Write out a snapshot of the current window (in daemon mode), and start a new window."""
+        if not Scalene.__snapshot_writer:
+            return
+        try:
+            Scalene.__snapshot_writer.write(
+                Scalene.__stats,
+                Scalene.__snapshot_window_start,
+                now_wallclock,
+            )
+        except OSError:
+            # Never let a full or missing disk take down the profiled program.
+            pass
+        Scalene.__stats.reset_window()
+        Scalene.__snapshot_window_start = now_wallclock
+
     @staticmethod
     def process_args(args: argparse.Namespace) -> None:
         Scalene.__args = cast(ScaleneArguments, args)
         Scalene.__next_output_time = (
             Scalene.get_wallclock_time() + Scalene.__args.profile_interval
         )
+        if args.daemon_dir:
+            Scalene.__snapshot_writer = ScaleneSnapshotWriter(
+                args.daemon_dir, args.max_snapshots
+            )
+            Scalene.__snapshot_window_start = Scalene.get_wallclock_time()
+            Scalene.__next_snapshot_time = (
+                Scalene.__snapshot_window_start + args.snapshot_interval
+            )
         Scalene.__output.html = args.html
         Scalene.__output.output_file = args.outfile
         Scalene.__is_child = args.pid != 0
+        # Publish our configuration in the control block, so it can be
+        # changed while we run (see scalene/profile.py).
+        try:
+            control = ScaleneControl(os.getpid())
+            flags = ScaleneControl.ALL_FLAGS
+            if args.cpu_only:
+                flags &= ~(ScaleneControl.MEMORY | ScaleneControl.MEMCPY)
+            control.flags = flags
+            control.cpu_sampling_interval = args.cpu_sampling_rate
+            control.output_interval = args.profile_interval
+            control.large_allocation_threshold = (
+                args.large_allocation_threshold
+            )
+            Scalene.__control = control
+            Scalene.__control_generation = control.generation
+            Scalene.__snapshot_requests = control.snapshot_requests
+        except (OSError, ValueError):
+            pass
         # the pid of the primary profiler
         Scalene.__parent_pid = args.pid if Scalene.__is_child else os.getpid()
 
@@ -1337,6 +1752,8 @@ class Scalene:
                         )
                     else:
                         Scalene.__program_path = program_path
+                    if frame_filter:
+                        frame_filter.clear()
                     # Grab local and global variables.
                     import __main__
 
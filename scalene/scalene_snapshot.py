@@ -0,0 +1,203 @@
+import os
+import struct
+
+from typing import Any, Dict, List, Set, Tuple
+
+from scalene.scalene_statistics import (
+    Filename,
+    LineNumber,
+    ScaleneStatistics,
+)
+
+# Compact binary snapshots of one window of profiling statistics, as
+# written in daemon mode (--daemon-dir). All values are little-endian.
+#
+#   header (HEADER)
+#   number of files (u32), then for each file:
+#     name length (u16), name (UTF-8)
+#     number of lines (u32), then one LINE record per line
+#
+# Times are in seconds, memory in MB.
+
+MAGIC = b"SCALENE\x00"
+VERSION = 1
+
+# magic, version, pid, window start and end (seconds since the epoch),
+# elapsed time, total CPU samples, current / max footprint, max RSS,
+# minor / major page faults
+HEADER = struct.Struct("<8sHIddd4fQQ")
+
+# line number, CPU time (Python / native), GPU time, malloc (all /
+# Python), free, memcpy, GIL wait, native lock wait
+LINE = struct.Struct("<I9f")
+
+FILE_COUNT = struct.Struct("<I")
+NAME_LENGTH = struct.Struct("<H")
+LINE_COUNT = struct.Struct("<I")
+
+
+def _line_value(per_line: Any, fname: Filename, lineno: LineNumber) -> float:
+    """A line's value in per_line (summed, if it is broken down further), without adding entries to its defaultdicts."""
+    value = per_line.get(fname, {}).get(lineno, 0)
+    return sum(value.values()) if isinstance(value, dict) else value
+
+
+def encode_snapshot(
+    stats: ScaleneStatistics, window_start: float, window_end: float
+) -> bytes:
+    """Encode the statistics for one window."""
+    out: List[bytes] = [
+        HEADER.pack(
+            MAGIC,
+            VERSION,
+            os.getpid(),
+            window_start,
+            window_end,
+            window_end - window_start,
+            stats.total_cpu_samples,
+            stats.current_footprint,
+            stats.max_footprint,
+            stats.max_rss,
+            stats.page_faults[0],
+            stats.page_faults[1],
+        )
+    ]
+    # (In the order of LINE's fields.)
+    per_line_maps = (
+        stats.cpu_samples_python,
+        stats.cpu_samples_c,
+        stats.gpu_samples,
+        stats.memory_malloc_samples,
+        stats.memory_python_samples,
+        stats.memory_free_samples,
+        stats.memcpy_samples,
+        stats.gil_wait_samples,
+        stats.lock_wait_samples,
+    )
+    files: Set[Filename] = set()
+    for per_line in per_line_maps:
+        files |= set(per_line.keys())  # type: ignore
+    out.append(FILE_COUNT.pack(len(files)))
+    for fname in sorted(files):
+        name = fname.encode("utf-8", "surrogateescape")
+        out.append(NAME_LENGTH.pack(len(name)))
+        out.append(name)
+        lines: Set[LineNumber] = set()
+        for per_line in per_line_maps:
+            lines |= set(per_line.get(fname, {}).keys())  # type: ignore
+        out.append(LINE_COUNT.pack(len(lines)))
+        for lineno in sorted(lines):
+            out.append(
+                LINE.pack(
+                    lineno,
+                    *(
+                        _line_value(per_line, fname, lineno)
+                        for per_line in per_line_maps
+                    ),
+                )
+            )
+    return b"".join(out)
+
+
+def decode_snapshot(data: bytes) -> Dict[str, Any]:
+    """Decode a snapshot into a dict: the header fields, plus "lines" mapping (file, line) to the per-line fields."""
+    (
+        magic,
+        version,
+        pid,
+        window_start,
+        window_end,
+        elapsed_time,
+        total_cpu_samples,
+        current_footprint,
+        max_footprint,
+        max_rss,
+        minor_faults,
+        major_faults,
+    ) = HEADER.unpack_from(data, 0)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError("not a Scalene snapshot (or an unsupported version)")
+    offset = HEADER.size
+    lines: Dict[Tuple[Filename, LineNumber], Dict[str, float]] = {}
+    (nfiles,) = FILE_COUNT.unpack_from(data, offset)
+    offset += FILE_COUNT.size
+    for _ in range(nfiles):
+        (name_length,) = NAME_LENGTH.unpack_from(data, offset)
+        offset += NAME_LENGTH.size
+        fname = Filename(
+            data[offset : offset + name_length].decode(
+                "utf-8", "surrogateescape"
+            )
+        )
+        offset += name_length
+        (nlines,) = LINE_COUNT.unpack_from(data, offset)
+        offset += LINE_COUNT.size
+        for _ in range(nlines):
+            (
+                lineno,
+                cpu_python,
+                cpu_c,
+                gpu,
+                malloc_mb,
+                python_mb,
+                free_mb,
+                memcpy,
+                gil_wait,
+                lock_wait,
+            ) = LINE.unpack_from(data, offset)
+            offset += LINE.size
+            lines[(fname, LineNumber(lineno))] = {
+                "cpu_python": cpu_python,
+                "cpu_c": cpu_c,
+                "gpu": gpu,
+                "malloc_mb": malloc_mb,
+                "python_mb": python_mb,
+                "free_mb": free_mb,
+                "memcpy": memcpy,
+                "gil_wait": gil_wait,
+                "lock_wait": lock_wait,
+            }
+    return {
+        "pid": pid,
+        "window_start": window_start,
+        "window_end": window_end,
+        "elapsed_time": elapsed_time,
+        "total_cpu_samples": total_cpu_samples,
+        "current_footprint": current_footprint,
+        "max_footprint": max_footprint,
+        "max_rss": max_rss,
+        "page_faults": (minor_faults, major_faults),
+        "lines": lines,
+    }
+
+
+class ScaleneSnapshotWriter:
+    """Writes snapshots to a directory, keeping only the most recent max_snapshots."""
+
+    def __init__(self, directory: str, max_snapshots: int) -> None:
+        self.__directory = directory
+        self.__max_snapshots = max(1, max_snapshots)
+        self.__sequence = 0
+        os.makedirs(directory, exist_ok=True)
+
+    def __path(self, sequence: int) -> str:
+        return os.path.join(
+            self.__directory, f"scalene-{os.getpid()}-{sequence:08d}.snap"
+        )
+
+    def write(
+        self, stats: ScaleneStatistics, window_start: float, window_end: float
+    ) -> None:
+        path = self.__path(self.__sequence)
+        # Write to a temporary file and rename, so readers never see a partial snapshot.
+        tmp_path = path + ".tmp"
+        with open(tmp_path, "wb") as f:
+            f.write(encode_snapshot(stats, window_start, window_end))
+        os.replace(tmp_path, path)
+        expired = self.__sequence - self.__max_snapshots
+        if expired >= 0:
+            try:
+                os.unlink(self.__path(expired))
+            except OSError:
+                pass
+        self.__sequence += 1
@@ -1,4 +1,5 @@
 import cloudpickle
+import math
 import os
 import pathlib
 import pickle
@@ -10,13 +11,16 @@ from typing import (
     Generic,
     List,
     NewType,
+    Optional,
     Set,
     Tuple,
     TypeVar,
     Union,
 )
+from scalene import scalene_statsfile
 from scalene.runningstats import RunningStats
 from scalene.adaptive import Adaptive
+from scalene.timeline import Timeline
 
 Address = NewType("Address", str)
 Filename = NewType("Filename", str)
@@ -24,6 +28,7 @@ Filename = NewType("Filename", str)
 LineNumber = NewType("LineNumber", int)
 ByteCodeIndex = NewType("ByteCodeIndex", int)
 T = TypeVar("T")
+K = TypeVar("K")
 
 
 class ScaleneStatistics:
@@ -45,6 +50,24 @@ class ScaleneStatistics:
             Filename, Dict[LineNumber, float]
         ] = defaultdict(lambda: defaultdict(float))
 
+        #   native CPU samples for each location in the program,
+        #   broken down by native stack ("outermost;...;innermost",
+        #   each "function (shared object)")
+        self.cpu_samples_native_functions: Dict[
+            Filename, Dict[LineNumber, Dict[str, float]]
+        ] = defaultdict(lambda: defaultdict(lambda: defaultdict(float)))
+
+        #   time spent waiting for the GIL at each location in the program
+        self.gil_wait_samples: Dict[
+            Filename, Dict[LineNumber, float]
+        ] = defaultdict(lambda: defaultdict(float))
+
+        #   time spent blocked on native locks at each location in the
+        #   program, broken down by the native call site taking the lock
+        self.lock_wait_samples: Dict[
+            Filename, Dict[LineNumber, Dict[str, float]]
+        ] = defaultdict(lambda: defaultdict(lambda: defaultdict(float)))
+
         #   GPU samples for each location in the program
         self.gpu_samples: Dict[
             Filename, Dict[LineNumber, float]
@@ -71,6 +94,19 @@ class ScaleneStatistics:
             Filename, Dict[LineNumber, Dict[ByteCodeIndex, int]]
         ] = defaultdict(lambda: defaultdict(lambda: defaultdict(int)))
 
+        # sampled mallocs (in MB) at each location in the program,
+        # broken down by native stack ("outermost;...;innermost")
+        self.memory_malloc_stacks: Dict[
+            Filename, Dict[LineNumber, Dict[str, float]]
+        ] = defaultdict(lambda: defaultdict(lambda: defaultdict(float)))
+
+        # sampled allocations still alive at the last report, by native
+        # allocation site ("outermost;...;innermost"): (objects, MB,
+        # objects per age bucket, objects made since the previous report)
+        self.surviving_allocations: Dict[
+            str, Tuple[int, float, Tuple[int, ...], int]
+        ] = {}
+
         # the last malloc to trigger a sample (used for leak detection)
         self.last_malloc_triggered: Tuple[Filename, LineNumber, Address] = (
             Filename(""),
@@ -83,6 +119,12 @@ class ScaleneStatistics:
             Filename, Dict[LineNumber, Dict[ByteCodeIndex, float]]
         ] = defaultdict(lambda: defaultdict(lambda: defaultdict(float)))
 
+        # mallocs of NumPy array data (part of the native mallocs), for
+        # each location in the program
+        self.memory_array_samples: Dict[
+            Filename, Dict[LineNumber, Dict[ByteCodeIndex, float]]
+        ] = defaultdict(lambda: defaultdict(lambda: defaultdict(float)))
+
         # free samples for each location in the program
         self.memory_free_samples: Dict[
             Filename, Dict[LineNumber, Dict[ByteCodeIndex, float]]
@@ -126,6 +168,30 @@ class ScaleneStatistics:
         # memory footprint samples (time, footprint), using 'Adaptive' sampling.
         self.memory_footprint_samples = Adaptive(27)
 
+        # resident set size samples (in MB), as reported by the OS
+        # with each malloc sample, using 'Adaptive' sampling.
+        self.rss_samples = Adaptive(27)
+
+        # the peak resident set size (in MB)
+        self.max_rss: float = 0.0
+
+        # what memory and CPU use looked like over time, for lining up
+        # with each other and with external events (times are on the
+        # time.monotonic() clock): (time, footprint MB, RSS MB) with
+        # each malloc sample, and (time, Python seconds, native
+        # seconds) with each CPU sample
+        self.memory_timeline = Timeline(4096)
+        self.cpu_timeline = Timeline(4096)
+
+        # how many samples arrived on each channel ("cpu", "malloc",
+        # "free", "memcpy", "gil_wait", "lock_wait"), to relate overhead
+        # to sampling activity
+        self.samples_by_channel: Dict[str, int] = defaultdict(int)
+
+        # minor and major page faults since profiling started
+        self.page_faults: Tuple[int, int] = (0, 0)
+        self.page_faults_at_start: Optional[Tuple[int, int]] = None
+
         # same, but per line
         self.per_line_footprint_samples: Dict[
             Filename, Dict[LineNumber, Adaptive]
@@ -150,16 +216,23 @@ class ScaleneStatistics:
         self.elapsed_time = 0
         self.cpu_samples_python.clear()
         self.cpu_samples_c.clear()
+        self.cpu_samples_native_functions.clear()
+        self.gil_wait_samples.clear()
+        self.lock_wait_samples.clear()
         self.cpu_utilization.clear()
         self.cpu_samples.clear()
         self.gpu_samples.clear()
         self.malloc_samples.clear()
         self.memory_malloc_samples.clear()
         self.memory_malloc_count.clear()
+        self.memory_malloc_stacks.clear()
+        self.surviving_allocations.clear()
         self.memory_python_samples.clear()
+        self.memory_array_samples.clear()
         self.memory_free_samples.clear()
         self.memory_free_count.clear()
         self.memcpy_samples.clear()
+        self.samples_by_channel.clear()
         self.total_cpu_samples = 0.0
         self.total_gpu_samples = 0.0
         self.total_memory_malloc_samples = 0.0
@@ -182,8 +255,23 @@ class ScaleneStatistics:
         self.clear()
         self.current_footprint = 0
         self.max_footprint = 0
+        self.max_rss = 0
+        self.page_faults = (0, 0)
+        self.page_faults_at_start = None
         self.per_line_footprint_samples.clear()
 
+    def reset_window(self) -> None:
+        """Start a new window of counters (for daemon mode); the current footprint carries over."""
+        footprint = self.current_footprint
+        self.clear()
+        self.current_footprint = footprint
+        self.max_footprint = footprint
+        self.max_rss = 0
+        self.memory_footprint_samples = Adaptive(27)
+        self.rss_samples = Adaptive(27)
+        self.memory_timeline = Timeline(4096)
+        self.cpu_timeline = Timeline(4096)
+
     def build_function_stats(self, filename: Filename):  # type: ignore
         fn_stats = ScaleneStatistics()
         fn_stats.elapsed_time = self.elapsed_time
@@ -228,6 +316,9 @@ class ScaleneStatistics:
                 fn_stats.memory_python_samples[fn_name][first_line_no][
                     ByteCodeIndex(0)
                 ] += self.memory_python_samples[filename][line_no][index]
+                fn_stats.memory_array_samples[fn_name][first_line_no][
+                    ByteCodeIndex(0)
+                ] += self.memory_array_samples[filename][line_no][index]
                 fn_stats.memory_free_samples[fn_name][first_line_no][
                     ByteCodeIndex(0)
                 ] += self.memory_free_samples[filename][line_no][index]
@@ -242,32 +333,112 @@ class ScaleneStatistics:
             )
         return fn_stats
 
+    # The per-line counters, which child processes write as the
+    # stats file's tables (see scalene_statsfile), so that the parent
+    # can add them up without unpickling them, by the kind of table.
+    columnar_contents = [
+        (
+            scalene_statsfile.LINE,
+            [
+                "cpu_samples_python",
+                "cpu_samples_c",
+                "gil_wait_samples",
+                "gpu_samples",
+                "memcpy_samples",
+            ],
+        ),
+        (
+            scalene_statsfile.BYTECODE,
+            [
+                "memory_malloc_samples",
+                "memory_python_samples",
+                "memory_array_samples",
+                "memory_free_samples",
+                "memory_malloc_count",
+                "memory_free_count",
+            ],
+        ),
+        (
+            scalene_statsfile.LABEL,
+            [
+                "cpu_samples_native_functions",
+                "lock_wait_samples",
+                "memory_malloc_stacks",
+            ],
+        ),
+    ]
+    # (The counters above that count in integers.)
+    integer_contents = {
+        "memcpy_samples",
+        "memory_malloc_count",
+        "memory_free_count",
+    }
+
+    # Everything else, pickled as the stats file's extras.
     payload_contents = [
         "max_footprint",
         "elapsed_time",
         "total_cpu_samples",
-        "cpu_samples_c",
-        "cpu_samples_python",
         "bytei_map",
         "cpu_samples",
         "cpu_utilization",
-        "memory_malloc_samples",
-        "memory_python_samples",
-        "memory_free_samples",
-        "memcpy_samples",
         "per_line_footprint_samples",
         "total_memory_free_samples",
         "total_memory_malloc_samples",
         "memory_footprint_samples",
+        "rss_samples",
+        "memory_timeline",
+        "cpu_timeline",
+        "samples_by_channel",
+        "max_rss",
+        "page_faults",
         "function_map",
         "firstline_map",
-        "gpu_samples",
         "total_gpu_samples",
-        "memory_malloc_count",
-        "memory_free_count",
+        "surviving_allocations",
     ]
     # To be added: __malloc_samples
 
+    def columnar_tables(self) -> scalene_statsfile.Tables:
+        """The columnar_contents, as tables (one column per counter)."""
+        tables: scalene_statsfile.Tables = []
+        nan = float("nan")
+        for (kind, names) in ScaleneStatistics.columnar_contents:
+            rows: scalene_statsfile.Table = {}
+            for (i, name) in enumerate(names):
+                stat = getattr(self, name)
+                for filename in stat:
+                    for lineno in stat[filename]:
+                        entries = stat[filename][lineno]
+                        if kind == scalene_statsfile.LINE:
+                            entries = {0: entries}
+                        for (subkey, value) in entries.items():
+                            key = (filename, lineno, subkey)
+                            if key not in rows:
+                                rows[key] = [nan] * len(names)
+                            rows[key][i] = value
+            tables.append((kind, len(names), rows))
+        return tables
+
+    def add_columnar_tables(self, tables: scalene_statsfile.Tables) -> None:
+        """Add the counters in the tables (as from columnar_tables)."""
+        for ((kind, names), (_, _, rows)) in zip(
+            ScaleneStatistics.columnar_contents, tables
+        ):
+            stats = [getattr(self, name) for name in names]
+            integer = [
+                name in ScaleneStatistics.integer_contents for name in names
+            ]
+            for ((filename, lineno, subkey), values) in rows.items():
+                for (i, value) in enumerate(values):
+                    if math.isnan(value):
+                        continue
+                    v = int(value) if integer[i] else value
+                    if kind == scalene_statsfile.LINE:
+                        stats[i][filename][lineno] += v
+                    else:
+                        stats[i][filename][lineno][subkey] += v
+
     def output_stats(self, pid: int, dir_name: Filename) -> None:
         payload: List[Any] = []
         for n in ScaleneStatistics.payload_contents:
@@ -278,8 +449,9 @@ class ScaleneStatistics:
             dir_name,
             "scalene" + str(pid) + "-" + str(os.getpid()),
         )
-        with open(out_filename, "wb") as out_file:
-            cloudpickle.dump(payload, out_file)
+        scalene_statsfile.write(
+            out_filename, self.columnar_tables(), cloudpickle.dumps(payload)
+        )
 
     @staticmethod
     def increment_per_line_samples(
@@ -302,8 +474,8 @@ class ScaleneStatistics:
 
     @staticmethod
     def increment_per_bytecode_samples(
-        dest: Dict[Filename, Dict[LineNumber, Dict[ByteCodeIndex, T]]],
-        src: Dict[Filename, Dict[LineNumber, Dict[ByteCodeIndex, T]]],
+        dest: Dict[Filename, Dict[LineNumber, Dict[K, T]]],
+        src: Dict[Filename, Dict[LineNumber, Dict[K, T]]],
     ) -> None:
         for filename in src:
             for lineno in src[filename]:
@@ -312,71 +484,80 @@ class ScaleneStatistics:
                         filename
                     ][lineno][ind]
 
+    @staticmethod
+    def increment_surviving_allocations(
+        dest: Dict[str, Tuple[int, float, Tuple[int, ...], int]],
+        src: Dict[str, Tuple[int, float, Tuple[int, ...], int]],
+    ) -> None:
+        for site, (objects, mb, ages, new) in src.items():
+            if site in dest:
+                (d_objects, d_mb, d_ages, d_new) = dest[site]
+                dest[site] = (
+                    d_objects + objects,
+                    d_mb + mb,
+                    tuple(a + b for (a, b) in zip(d_ages, ages)),
+                    d_new + new,
+                )
+            else:
+                dest[site] = (objects, mb, ages, new)
+
     def merge_stats(self, the_dir_name: Filename) -> None:
         the_dir = pathlib.Path(the_dir_name)
-        for f in list(the_dir.glob("**/scalene*")):
-            # Skip empty files.
-            if os.path.getsize(f) == 0:
-                continue
-            with open(f, "rb") as file:
-                unpickler = pickle.Unpickler(file)
-                value = unpickler.load()
-                x = ScaleneStatistics()
-                for i, n in enumerate(ScaleneStatistics.payload_contents):
-                    setattr(x, n, value[i])
-                self.max_footprint = max(self.max_footprint, x.max_footprint)
-                self.increment_cpu_utilization(
-                    self.cpu_utilization, x.cpu_utilization
-                )
-                self.elapsed_time = max(self.elapsed_time, x.elapsed_time)
-                self.total_cpu_samples += x.total_cpu_samples
-                self.total_gpu_samples += x.total_gpu_samples
-                self.increment_per_line_samples(
-                    self.cpu_samples_c, x.cpu_samples_c
-                )
-                self.increment_per_line_samples(
-                    self.cpu_samples_python, x.cpu_samples_python
-                )
-                self.increment_per_line_samples(
-                    self.gpu_samples, x.gpu_samples
-                )
-                self.increment_per_line_samples(
-                    self.memcpy_samples, x.memcpy_samples
-                )
-                self.increment_per_line_samples(
-                    self.per_line_footprint_samples,
-                    x.per_line_footprint_samples,
-                )
-                self.increment_per_bytecode_samples(
-                    self.memory_malloc_samples, x.memory_malloc_samples
-                )
-                self.increment_per_bytecode_samples(
-                    self.memory_python_samples, x.memory_python_samples
-                )
-                self.increment_per_bytecode_samples(
-                    self.memory_free_samples, x.memory_free_samples
-                )
-                self.increment_per_bytecode_samples(
-                    self.memory_malloc_count, x.memory_malloc_count
-                )
-                self.increment_per_bytecode_samples(
-                    self.memory_free_count, x.memory_free_count
-                )
-                for filename in x.bytei_map:
-                    for lineno in x.bytei_map[filename]:
-                        v = x.bytei_map[filename][lineno]
-                        self.bytei_map[filename][lineno] |= v
-                for filename in x.cpu_samples:
-                    self.cpu_samples[filename] += x.cpu_samples[filename]
-                self.total_memory_free_samples += x.total_memory_free_samples
-                self.total_memory_malloc_samples += (
-                    x.total_memory_malloc_samples
-                )
-                self.memory_footprint_samples += x.memory_footprint_samples
-                for k, val in x.function_map.items():
-                    if k in self.function_map:
-                        self.function_map[k].update(val)
-                    else:
-                        self.function_map[k] = val
-                self.firstline_map.update(x.firstline_map)
+        # Skip empty files.
+        files = [
+            f
+            for f in the_dir.glob("**/scalene*")
+            if os.path.getsize(f) != 0
+        ]
+        if not files:
+            return
+        # Add up the counters of all of the files at once, and then the
+        # rest of each file's statistics.
+        (tables, all_extras) = scalene_statsfile.merge(files)
+        self.add_columnar_tables(tables)
+        for extras in all_extras:
+            value = pickle.loads(extras)
+            x = ScaleneStatistics()
+            for i, n in enumerate(ScaleneStatistics.payload_contents):
+                setattr(x, n, value[i])
+            self.max_footprint = max(self.max_footprint, x.max_footprint)
+            self.max_rss = max(self.max_rss, x.max_rss)
+            self.page_faults = (
+                self.page_faults[0] + x.page_faults[0],
+                self.page_faults[1] + x.page_faults[1],
+            )
+            self.increment_cpu_utilization(
+                self.cpu_utilization, x.cpu_utilization
+            )
+            self.elapsed_time = max(self.elapsed_time, x.elapsed_time)
+            self.total_cpu_samples += x.total_cpu_samples
+            self.total_gpu_samples += x.total_gpu_samples
+            self.increment_per_line_samples(
+                self.per_line_footprint_samples,
+                x.per_line_footprint_samples,
+            )
+            self.increment_surviving_allocations(
+                self.surviving_allocations, x.surviving_allocations
+            )
+            for filename in x.bytei_map:
+                for lineno in x.bytei_map[filename]:
+                    v = x.bytei_map[filename][lineno]
+                    self.bytei_map[filename][lineno] |= v
+            for filename in x.cpu_samples:
+                self.cpu_samples[filename] += x.cpu_samples[filename]
+            self.total_memory_free_samples += x.total_memory_free_samples
+            self.total_memory_malloc_samples += x.total_memory_malloc_samples
+            self.memory_footprint_samples += x.memory_footprint_samples
+            self.rss_samples += x.rss_samples
+            self.memory_timeline += x.memory_timeline
+            self.cpu_timeline += x.cpu_timeline
+            for channel, n in x.samples_by_channel.items():
+                self.samples_by_channel[channel] += n
+            for k, val in x.function_map.items():
+                if k in self.function_map:
+                    self.function_map[k].update(val)
+                else:
+                    self.function_map[k] = val
+            self.firstline_map.update(x.firstline_map)
+        for f in files:
             os.remove(f)
@@ -0,0 +1,222 @@
+import mmap
+import struct
+
+from array import array
+from typing import Any, Dict, Iterator, List, Sequence, Tuple, Union
+
+# The statistics that each child process leaves for the parent to merge
+# (see ScaleneStatistics.output_stats and merge_stats): columnar tables
+# of per-line counters, followed by the rest of the statistics as an
+# opaque blob ("extras"). Everything is in native byte order, since the
+# files never leave the machine.
+#
+#   header (HEADER)
+#   string table: for each string, its length (u32) and UTF-8 bytes
+#   for each table: TABLE, then its columns, each padded to 8 bytes:
+#     file (u32 string index), line (u32), and, except in LINE tables,
+#     the subkey (i64: a bytecode index, or a string index for labels);
+#     then each counter (f64), with NaN where the row has no entry
+#   extras
+#
+# The native merger (src/source/stats_merge.cpp) reads the same format.
+
+MAGIC = b"SCLSTATS"
+VERSION = 1
+
+# magic, version, number of tables, number of strings, size of the
+# string table (padded), size of the extras
+HEADER = struct.Struct("=8sHHIQQ")
+
+# kind, number of counters, (reserved), number of rows
+TABLE = struct.Struct("=HHIQ")
+
+# Table kinds, by what (besides the file and line) keys their rows.
+LINE = 0
+BYTECODE = 1
+LABEL = 2
+
+Subkey = Union[int, str]
+# (filename, line, subkey) -> counters
+Key = Tuple[str, int, Subkey]
+Table = Dict[Key, List[float]]
+Tables = List[Tuple[int, int, Table]]  # (kind, number of counters, rows)
+# (the same, as it is decoded: (key, counters) for each row)
+Rows = List[Tuple[int, int, Iterator[Tuple[Key, Sequence[float]]]]]
+
+
+def _pad(n: int) -> int:
+    return (n + 7) & ~7
+
+
+def encode(tables: Tables, extras: bytes = b"") -> List[bytes]:
+    """Encode the tables and extras, as a list of chunks (to be concatenated)."""
+    strings: Dict[str, int] = {}
+
+    def intern(s: str) -> int:
+        if s not in strings:
+            strings[s] = len(strings)
+        return strings[s]
+
+    body: List[bytes] = []
+    for (kind, ncounters, rows) in tables:
+        files = array("I")
+        lines = array("I")
+        subkeys = array("q")
+        counters = [array("d") for _ in range(ncounters)]
+        for ((fname, lineno, subkey), values) in rows.items():
+            files.append(intern(fname))
+            lines.append(lineno)
+            if kind == LABEL:
+                subkeys.append(intern(str(subkey)))
+            elif kind == BYTECODE:
+                subkeys.append(int(subkey))
+            for (column, value) in zip(counters, values):
+                column.append(value)
+        body.append(TABLE.pack(kind, ncounters, 0, len(files)))
+        columns = [files, lines] + ([subkeys] if kind != LINE else [])
+        for column in columns + counters:
+            data = column.tobytes()
+            body.append(data)
+            body.append(b"\0" * (_pad(len(data)) - len(data)))
+
+    string_table: List[bytes] = []
+    for s in strings:
+        name = s.encode("utf-8", "surrogateescape")
+        string_table.append(struct.pack("=I", len(name)))
+        string_table.append(name)
+    size = sum(len(s) for s in string_table)
+    string_table.append(b"\0" * (_pad(size) - size))
+    return (
+        [
+            HEADER.pack(
+                MAGIC,
+                VERSION,
+                len(tables),
+                len(strings),
+                _pad(size),
+                len(extras),
+            )
+        ]
+        + string_table
+        + body
+        + [extras]
+    )
+
+
+def write(path: str, tables: Tables, extras: bytes) -> None:
+    """Write the tables and extras to path, through a shared mapping."""
+    chunks = encode(tables, extras)
+    size = sum(len(c) for c in chunks)
+    with open(path, "wb+") as f:
+        f.truncate(size)
+        with mmap.mmap(f.fileno(), size) as m:
+            offset = 0
+            for c in chunks:
+                m[offset : offset + len(c)] = c
+                offset += len(c)
+
+
+def _decode(data: Union[bytes, mmap.mmap]) -> Tuple[Rows, bytes]:
+    view = memoryview(data)
+    (
+        magic,
+        version,
+        ntables,
+        nstrings,
+        strings_size,
+        extras_size,
+    ) = HEADER.unpack_from(view, 0)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError(
+            "not a Scalene stats file (or an unsupported version)"
+        )
+    offset = HEADER.size
+    strings: List[str] = []
+    for _ in range(nstrings):
+        (length,) = struct.unpack_from("=I", view, offset)
+        offset += 4
+        strings.append(
+            bytes(view[offset : offset + length]).decode(
+                "utf-8", "surrogateescape"
+            )
+        )
+        offset += length
+    offset = HEADER.size + strings_size
+
+    def column(fmt: str, nrows: int) -> List[Any]:
+        nonlocal offset
+        size = struct.calcsize(fmt) * nrows
+        values = view[offset : offset + size].cast(fmt).tolist()
+        offset += _pad(size)
+        return values
+
+    tables: Rows = []
+    for _ in range(ntables):
+        (kind, ncounters, _reserved, nrows) = TABLE.unpack_from(view, offset)
+        offset += TABLE.size
+        files = [strings[i] for i in column("I", nrows)]
+        lines = column("I", nrows)
+        subkeys: List[Subkey] = (
+            column("q", nrows) if kind != LINE else [0] * nrows
+        )
+        if kind == LABEL:
+            subkeys = [strings[i] for i in subkeys]  # type: ignore
+        counters = [column("d", nrows) for _ in range(ncounters)]
+        tables.append(
+            (kind, ncounters, zip(zip(files, lines, subkeys), zip(*counters)))
+        )
+    extras = bytes(view[offset : offset + extras_size])
+    return (tables, extras)
+
+
+def decode(data: Union[bytes, mmap.mmap]) -> Tuple[Tables, bytes]:
+    """Decode the tables and extras."""
+    (tables, extras) = _decode(data)
+    return (
+        [
+            (kind, n, {key: list(values) for (key, values) in rows})
+            for (kind, n, rows) in tables
+        ],
+        extras,
+    )
+
+
+def read(path: str) -> Tuple[Tables, bytes]:
+    with open(path, "rb") as f:
+        with mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as m:
+            return decode(m)
+
+
+def merge(paths: Sequence[str]) -> Tuple[Tables, List[bytes]]:
+    """Merge the tables of all of the files (adding their counters), and return them with each file's extras."""
+    try:
+        import stats_merge
+    except ImportError:
+        stats_merge = None
+    if stats_merge:
+        (merged, extras) = stats_merge.merge([str(p) for p in paths])
+        return (decode(merged)[0], extras)
+    # (Not built: merge in Python.)
+    tables: Tables = []
+    all_extras: List[bytes] = []
+    for path in paths:
+        with open(path, "rb") as f:
+            with mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as m:
+                (file_tables, extras) = _decode(m)
+        all_extras.append(extras)
+        if not tables:
+            tables = [(kind, n, {}) for (kind, n, _) in file_tables]
+        if [t[:2] for t in tables] != [t[:2] for t in file_tables]:
+            raise ValueError(f"{path}: tables differ from the other files'")
+        for ((_, _, dest), (_, _, rows)) in zip(tables, file_tables):
+            for (key, values) in rows:
+                row = dest.get(key)
+                if row is None:
+                    dest[key] = list(values)
+                    continue
+                for (i, v) in enumerate(values):
+                    # (NaN != NaN: cheaper than math.isnan, in this loop.)
+                    if v == v:
+                        a = row[i]
+                        row[i] = v if a != a else a + v
+    return (tables, all_extras)
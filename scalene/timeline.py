@@ -0,0 +1,43 @@
+from typing import List, Tuple
+
+# A point in time (seconds, on the time.monotonic() clock) with its values.
+TimelinePoint = Tuple[float, ...]
+
+
+class Timeline:
+    """A bounded, time-ordered series of points, evenly thinned out so that it always covers the whole run."""
+
+    def __init__(self, size: int):
+        self.max_points = size
+        self.points: List[TimelinePoint] = []
+        # Keep every stride-th point added (doubling each time we fill up).
+        self.stride = 1
+        self.skipped = 0
+
+    def __iadd__(self: "Timeline", other: "Timeline") -> "Timeline":
+        # Points from other processes interleave with ours.
+        self.points = sorted(self.points + other.points)
+        self.stride = max(self.stride, other.stride)
+        while len(self.points) > self.max_points:
+            self.decimate()
+        return self
+
+    def add(self, point: TimelinePoint) -> None:
+        self.skipped += 1
+        if self.skipped < self.stride:
+            return
+        self.skipped = 0
+        if len(self.points) >= self.max_points:
+            self.decimate()
+        self.points.append(point)
+
+    def decimate(self) -> None:
+        """Halve the resolution."""
+        self.points = self.points[::2]
+        self.stride *= 2
+
+    def get(self) -> List[TimelinePoint]:
+        return self.points
+
+    def len(self) -> int:
+        return len(self.points)
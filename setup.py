@@ -21,6 +21,29 @@ mmap_hl_spinlock = Extension('get_line_atomic',
                 extra_compile_args=['-std=c++14'],
                 language="c++14")
 
+pprof_export = Extension('pprof_export',
+                include_dirs=['src/include'],
+                sources=['src/source/pprof_export.cpp'],
+                libraries=['z'],
+                extra_compile_args=['-std=c++14'],
+                language="c++14")
+
+frame_filter = Extension('frame_filter',
+                sources=['src/source/frame_filter.cpp'],
+                extra_compile_args=['-std=c++14'],
+                language="c++14")
+
+stats_merge = Extension('stats_merge',
+                sources=['src/source/stats_merge.cpp'],
+                extra_compile_args=['-std=c++14'],
+                language="c++14")
+
+accumulators = Extension('accumulators',
+                include_dirs=['src/include'],
+                sources=['src/source/accumulators.cpp'],
+                extra_compile_args=['-std=c++14'],
+                language="c++14")
+
 setup(
     name="scalene",
     version=scalene_version,
@@ -58,7 +81,8 @@ setup(
         "nvidia-ml-py==11.450.51",
         "numpy"
     ],
-    ext_modules=[mmap_hl_spinlock],
+    ext_modules=[mmap_hl_spinlock, pprof_export, frame_filter, stats_merge,
+                 accumulators],
     setup_requires=['setuptools_scm'],
     include_package_data=True,
     entry_points={"console_scripts": ["scalene = scalene.__main__:main"]},
@@ -0,0 +1,97 @@
+#pragma once
+#ifndef ADAPTIVERATE_HPP
+#define ADAPTIVERATE_HPP
+
+#include <stdint.h>
+#include <time.h>
+
+// Steers a sampling interval (in bytes) so that samples arrive at about
+// a target number per second, and so that the time spent handling them
+// stays within an overhead budget (a fraction of elapsed time).
+//
+// It is fed once per sample, with the interval that just ended and how
+// long handling the previous sample took; from those it keeps moving
+// averages of the allocation rate (bytes per ns) and of the handling
+// cost, and picks the interval that, at that allocation rate, would
+// space samples out by the larger of 1/target and cost/budget. Each
+// step changes the interval by at most a factor of MaxStep, and the
+// result is clamped to [MinRate, MaxRate].
+//
+// Since each sample credits exactly the interval in effect when it was
+// taken, changing the interval does not bias the totals.
+
+template <uint64_t MinRate, uint64_t MaxRate>
+class AdaptiveRate {
+ public:
+  static constexpr uint32_t DefaultTargetSamplesPerSec = 100;
+  static constexpr uint32_t DefaultOverheadBudgetPpm = 10000;  // 1%
+
+  AdaptiveRate()
+      : _lastSampleNs(0), _bytesPerNs(0), _costNs(0), _initialized(false) {}
+
+  static uint64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+
+  // Called when a sample is taken at time nowNs; returns the interval
+  // to use next. (A target or budget of 0 means the default.)
+  uint64_t update(uint64_t interval, uint64_t nowNs, uint64_t handlingNs,
+                  uint32_t targetSamplesPerSec, uint32_t overheadBudgetPpm) {
+    if (targetSamplesPerSec == 0) {
+      targetSamplesPerSec = DefaultTargetSamplesPerSec;
+    }
+    if (overheadBudgetPpm == 0) {
+      overheadBudgetPpm = DefaultOverheadBudgetPpm;
+    }
+    auto elapsedNs = nowNs - _lastSampleNs;
+    _lastSampleNs = nowNs;
+    if (!_initialized) {
+      // Nothing to measure against yet.
+      _initialized = true;
+      _costNs = (double)handlingNs;
+      return interval;
+    }
+    if (elapsedNs == 0) {
+      elapsedNs = 1;
+    }
+    auto bytesPerNs = (double)interval / (double)elapsedNs;
+    if (_bytesPerNs == 0) {
+      _bytesPerNs = bytesPerNs;
+    } else {
+      _bytesPerNs += Smoothing * (bytesPerNs - _bytesPerNs);
+    }
+    _costNs += Smoothing * ((double)handlingNs - _costNs);
+    // How far apart samples should be, in ns.
+    auto targetSpacingNs = 1e9 / targetSamplesPerSec;
+    auto budgetSpacingNs = _costNs * 1e6 / overheadBudgetPpm;
+    if (budgetSpacingNs > targetSpacingNs) {
+      targetSpacingNs = budgetSpacingNs;
+    }
+    auto next = _bytesPerNs * targetSpacingNs;
+    if (next > interval * MaxStep) {
+      next = interval * MaxStep;
+    } else if (next < interval / MaxStep) {
+      next = interval / MaxStep;
+    }
+    if (next < MinRate) {
+      return MinRate;
+    }
+    if (next > MaxRate) {
+      return MaxRate;
+    }
+    return (uint64_t)next;
+  }
+
+ private:
+  static constexpr double Smoothing = 0.125;  // weight of each new measurement
+  static constexpr double MaxStep = 2.0;
+
+  uint64_t _lastSampleNs;
+  double _bytesPerNs;
+  double _costNs;
+  bool _initialized;
+};
+
+#endif
@@ -0,0 +1,297 @@
+#pragma once
+#ifndef ALLOCATIONTRACE_HPP
+#define ALLOCATIONTRACE_HPP
+
+#include <fcntl.h>
+#include <heaplayers.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <new>
+
+#include "common.hpp"
+#include "printf.h"
+#include "timestamp.hpp"
+
+// An optional full-fidelity trace of every allocation, for tuning
+// sampling rates and comparing allocators offline (see
+// src/source/scalene-replay.cpp). Tracing is on when the SCALENE_TRACE
+// environment variable names a file when the process starts; each
+// process writes <that name>.<pid>.
+//
+// File layout: a FileHeader (padded to HeaderSize), then chunks of
+// ChunkSize bytes. Each chunk belongs to one thread, starts with a
+// ChunkHeader, and holds a run of variable-length events:
+//
+//   op byte (Op), then as varints:
+//   ns since the previous event (or since the chunk's startNs),
+//   the pointer minus the previous one in the chunk (zigzag-encoded),
+//   and, for Malloc and Memalign, the size (and then the alignment).
+//
+// Deltas restart in every chunk, so chunks decode independently. A
+// thread claims chunks by bumping the header's chunk count, and writes
+// them through their own shared mapping: the kernel writes them back
+// to disk asynchronously, with no system calls on the allocation path.
+// The chunk's used count is updated (with release semantics) after
+// every event, so a trace is readable even if the process dies.
+
+class AllocationTrace {
+ public:
+  enum : uint32_t { Magic = 0x43525453, Version = 1 };
+  enum Op : uint8_t { Malloc = 0, Free = 1, Memalign = 2 };
+
+  static constexpr size_t HeaderSize = 4096;
+  static constexpr size_t ChunkSize = 1024 * 1024;
+  static constexpr size_t MaxEventSize = 1 + 4 * 10;
+
+  struct FileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t chunkSize;
+    uint32_t pid;
+    std::atomic<uint64_t> chunks;  // claimed so far
+  };
+
+  struct ChunkHeader {
+    uint32_t tid;
+    std::atomic<uint32_t> used;  // bytes of events after this header
+    uint64_t startNs;  // on the Timestamp clock
+  };
+
+  static AllocationTrace &getInstance() {
+    alignas(AllocationTrace) static char buf[sizeof(AllocationTrace)];
+    static auto *at = new (buf) AllocationTrace;
+    return *at;
+  }
+
+  inline bool enabled() const { return _header != nullptr; }
+
+  // Changes after a fork (when the child starts its own trace), so
+  // writers know to abandon the chunks they share with the parent.
+  inline uint32_t generation() const {
+    return _generation.load(std::memory_order_relaxed);
+  }
+
+  // Maps a fresh chunk (zeroed) for the calling thread, or returns
+  // nullptr.
+  ChunkHeader *claimChunk() {
+    if (!enabled()) {
+      return nullptr;
+    }
+    auto index = _header->chunks.fetch_add(1, std::memory_order_relaxed);
+    auto offset = HeaderSize + index * ChunkSize;
+    _lock.lock();
+    if (offset + ChunkSize > _fileSize) {
+      if (ftruncate(_fd, offset + ChunkSize) == 0) {
+        _fileSize = offset + ChunkSize;
+      }
+    }
+    auto ok = (offset + ChunkSize <= _fileSize);
+    _lock.unlock();
+    if (!ok) {
+      return nullptr;
+    }
+    auto p = mmap(nullptr, ChunkSize, PROT_READ | PROT_WRITE, MAP_SHARED, _fd,
+                  offset);
+    if (p == MAP_FAILED) {
+      return nullptr;
+    }
+    auto chunk = reinterpret_cast<ChunkHeader *>(p);
+    chunk->tid = currentThreadId();
+    return chunk;
+  }
+
+  static void releaseChunk(ChunkHeader *chunk) {
+    if (chunk != nullptr) {
+      munmap(chunk, ChunkSize);
+    }
+  }
+
+  // Called in the child after a fork.
+  void afterFork() {
+    if (_path[0] == '\0') {
+      return;
+    }
+    // The parent keeps using the old file (and its mappings).
+    if (_fd != -1) {
+      close(_fd);
+    }
+    _header = nullptr;
+    open();
+    _generation.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Varint (LEB128) encoding and decoding, shared with the reader.
+  static inline char *putVarint(char *p, uint64_t v) {
+    while (v >= 0x80) {
+      *p++ = (char)(v | 0x80);
+      v >>= 7;
+    }
+    *p++ = (char)v;
+    return p;
+  }
+
+  static inline const char *getVarint(const char *p, const char *end,
+                                      uint64_t &v) {
+    v = 0;
+    for (int shift = 0; (p < end) && (shift < 64); shift += 7) {
+      auto b = (uint8_t)*p++;
+      v |= (uint64_t)(b & 0x7f) << shift;
+      if (!(b & 0x80)) {
+        return p;
+      }
+    }
+    return nullptr;  // truncated
+  }
+
+  static inline uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+  }
+
+  static inline int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+  }
+
+ private:
+  AllocationTrace()
+      : _fd(-1), _fileSize(0), _header(nullptr), _generation(0) {
+    _path[0] = '\0';
+    auto path = getenv("SCALENE_TRACE");
+    if ((path == nullptr) || (strlen(path) >= sizeof(_path) - 16)) {
+      return;
+    }
+    strcpy(_path, path);
+    open();
+  }
+
+  void open() {
+    // (Room for the path, a dot and any pid.)
+    char filename[sizeof(_path) + 16];
+    snprintf(filename, sizeof(filename), "%s.%d", _path, getpid());
+    _fd = ::open(filename, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                 S_IRUSR | S_IWUSR);
+    if (_fd == -1) {
+      return;
+    }
+    _fileSize = HeaderSize;
+    if (ftruncate(_fd, HeaderSize) != 0) {
+      return;
+    }
+    auto p =
+        mmap(nullptr, HeaderSize, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (p == MAP_FAILED) {
+      return;
+    }
+    auto header = reinterpret_cast<FileHeader *>(p);
+    header->version = Version;
+    header->chunkSize = ChunkSize;
+    header->pid = getpid();
+    header->chunks.store(0, std::memory_order_relaxed);
+    header->magic = Magic;
+    _header = header;
+  }
+
+  static uint32_t currentThreadId() {
+#if defined(__linux__)
+    return (uint32_t)syscall(SYS_gettid);
+#else
+    uint64_t tid;
+    pthread_threadid_np(nullptr, &tid);
+    return (uint32_t)tid;
+#endif
+  }
+
+  HL::SpinLock _lock;
+  int _fd;
+  size_t _fileSize;
+  FileHeader *_header;
+  std::atomic<uint32_t> _generation;
+  char _path[1024];
+};
+
+// Appends one thread's events to its current chunk (claiming a new one
+// as needed). Not thread-safe: use one per thread.
+class TraceWriter {
+ public:
+  TraceWriter()
+      : _trace(AllocationTrace::getInstance()),
+        _chunk(nullptr),
+        _generation(0),
+        _pos(nullptr),
+        _end(nullptr),
+        _lastNs(0),
+        _lastPtr(0),
+        _failed(false) {}
+
+  inline void record(AllocationTrace::Op op, void *ptr, size_t size,
+                     size_t alignment) {
+    auto ns = _timestamp.nowNs();
+    if (unlikely((_pos + AllocationTrace::MaxEventSize > _end) ||
+                 (_generation != _trace.generation()))) {
+      if (!nextChunk(ns)) {
+        return;
+      }
+    }
+    if (unlikely(ns < _lastNs)) {
+      // (Recalibration can step the clock back slightly.)
+      ns = _lastNs;
+    }
+    auto p = _pos;
+    *p++ = (char)op;
+    p = AllocationTrace::putVarint(p, ns - _lastNs);
+    p = AllocationTrace::putVarint(
+        p, AllocationTrace::zigzag((int64_t)((uintptr_t)ptr - _lastPtr)));
+    if (op != AllocationTrace::Free) {
+      p = AllocationTrace::putVarint(p, size);
+      if (op == AllocationTrace::Memalign) {
+        p = AllocationTrace::putVarint(p, alignment);
+      }
+    }
+    _pos = p;
+    _lastNs = ns;
+    _lastPtr = (uintptr_t)ptr;
+    _chunk->used.store(_pos - reinterpret_cast<char *>(_chunk + 1),
+                       std::memory_order_release);
+  }
+
+ private:
+  bool nextChunk(uint64_t ns) {
+    if (_failed) {
+      return false;
+    }
+    // (After a fork, the child unmaps its copy of the parent's chunk.)
+    AllocationTrace::releaseChunk(_chunk);
+    _generation = _trace.generation();
+    _chunk = _trace.claimChunk();
+    if (_chunk == nullptr) {
+      // Out of disk space, most likely: stop tracing this thread.
+      _failed = true;
+      _pos = _end = nullptr;
+      return false;
+    }
+    _chunk->startNs = ns;
+    _pos = reinterpret_cast<char *>(_chunk + 1);
+    _end = reinterpret_cast<char *>(_chunk) + AllocationTrace::ChunkSize;
+    _lastNs = ns;
+    _lastPtr = 0;
+    return true;
+  }
+
+  AllocationTrace &_trace;
+  AllocationTrace::ChunkHeader *_chunk;
+  uint32_t _generation;
+  char *_pos;
+  char *_end;
+  uint64_t _lastNs;
+  uintptr_t _lastPtr;
+  bool _failed;
+  Timestamp _timestamp;
+};
+
+#endif
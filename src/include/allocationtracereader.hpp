@@ -0,0 +1,127 @@
+#pragma once
+#ifndef ALLOCATIONTRACEREADER_HPP
+#define ALLOCATIONTRACEREADER_HPP
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "allocationtrace.hpp"
+
+// Reads back a trace written through AllocationTrace, for the offline
+// tools (scalene-replay, sampler-eval): the events of all threads,
+// merged into one stream in time order.
+
+class AllocationTraceReader {
+ public:
+  // An event as recorded, with its absolute time.
+  struct Event {
+    uint64_t ns;
+    uint64_t ptr;
+    uint64_t size;
+    uint64_t alignment;
+    AllocationTrace::Op op;
+  };
+
+  // @return false (after saying why on stderr) if the file is not a
+  // readable trace. truncatedChunks counts the chunks that ended in the
+  // middle of an event (as when the process was killed).
+  static bool read(const char *filename, std::vector<Event> &events,
+                   uint64_t &truncatedChunks) {
+    auto fd = open(filename, O_RDONLY);
+    struct stat st;
+    if ((fd == -1) || (fstat(fd, &st) != 0) ||
+        ((size_t)st.st_size < AllocationTrace::HeaderSize)) {
+      fprintf(stderr, "scalene: cannot read trace %s\n", filename);
+      if (fd != -1) {
+        close(fd);
+      }
+      return false;
+    }
+    auto base = reinterpret_cast<const char *>(
+        mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+    close(fd);
+    if (base == MAP_FAILED) {
+      fprintf(stderr, "scalene: cannot map trace %s\n", filename);
+      return false;
+    }
+    auto header = reinterpret_cast<const AllocationTrace::FileHeader *>(base);
+    if ((header->magic != AllocationTrace::Magic) ||
+        (header->version != AllocationTrace::Version) ||
+        (header->chunkSize != AllocationTrace::ChunkSize)) {
+      fprintf(stderr, "scalene: %s is not a trace (or not this version)\n",
+              filename);
+      munmap((void *)base, st.st_size);
+      return false;
+    }
+    // A chunk may have been claimed without the file growing to hold it.
+    auto chunks = std::min<uint64_t>(
+        header->chunks.load(std::memory_order_acquire),
+        (st.st_size - AllocationTrace::HeaderSize) /
+            AllocationTrace::ChunkSize);
+
+    truncatedChunks = 0;
+    for (uint64_t i = 0; i < chunks; i++) {
+      auto chunk = reinterpret_cast<const AllocationTrace::ChunkHeader *>(
+          base + AllocationTrace::HeaderSize + i * AllocationTrace::ChunkSize);
+      if (!decodeChunk(chunk, events)) {
+        truncatedChunks++;
+      }
+    }
+    munmap((void *)base, st.st_size);
+
+    // Each thread's events are already in order (and so are its chunks),
+    // so a stable sort keeps them that way when timestamps tie.
+    std::stable_sort(
+        events.begin(), events.end(),
+        [](const Event &a, const Event &b) { return a.ns < b.ns; });
+    return true;
+  }
+
+ private:
+  // Appends the events in one chunk; returns false if it is truncated.
+  static bool decodeChunk(const AllocationTrace::ChunkHeader *chunk,
+                          std::vector<Event> &events) {
+    auto p = reinterpret_cast<const char *>(chunk + 1);
+    auto end =
+        p + std::min<size_t>(chunk->used.load(std::memory_order_acquire),
+                             AllocationTrace::ChunkSize - sizeof(*chunk));
+    auto ns = chunk->startNs;
+    uint64_t ptr = 0;
+    while (p < end) {
+      Event e;
+      uint64_t delta, ptrDelta;
+      e.op = static_cast<AllocationTrace::Op>((uint8_t)*p++);
+      if (e.op > AllocationTrace::Memalign) {
+        return false;
+      }
+      e.size = e.alignment = 0;
+      if (!(p = AllocationTrace::getVarint(p, end, delta)) ||
+          !(p = AllocationTrace::getVarint(p, end, ptrDelta))) {
+        return false;
+      }
+      if ((e.op != AllocationTrace::Free) &&
+          !(p = AllocationTrace::getVarint(p, end, e.size))) {
+        return false;
+      }
+      if ((e.op == AllocationTrace::Memalign) &&
+          !(p = AllocationTrace::getVarint(p, end, e.alignment))) {
+        return false;
+      }
+      ns += delta;
+      ptr += AllocationTrace::unzigzag(ptrDelta);
+      e.ns = ns;
+      e.ptr = ptr;
+      events.push_back(e);
+    }
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,216 @@
+#pragma once
+#ifndef CONTROLBLOCK_HPP
+#define CONTROLBLOCK_HPP
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <new>
+
+#include "printf.h"
+
+// A small shared page (/tmp/scalene-control<pid>) through which a
+// running profiler can be reconfigured without signals: libscalene and
+// the Python profiler both map it, and scalene.profile writes it. Its
+// layout must match scalene/scalene_control.py.
+//
+// Every field is naturally aligned and written whole, so readers need
+// only a relaxed load. Writers bump the generation after each change,
+// so the Python side can notice updates with a single comparison.
+//
+// Whoever maps the page first initializes it (under flock), with every
+// dimension enabled and every rate at its built-in default. Either side
+// may create the file; an existing one is only used if it is a regular
+// file that we own and nobody else can read or write, so that another
+// user cannot plant one (or a link to one) in /tmp.
+//
+// A forked child gets its own page (/tmp/scalene-control<childpid>,
+// where its Python side looks), starting from its parent's settings
+// (see afterFork).
+
+class ControlBlock {
+ public:
+  enum : uint32_t { Magic = 0x4c435353, Version = 1 };
+
+  // Which profiler dimensions are enabled.
+  enum Flag : uint32_t {
+    CPU = 1 << 0,
+    Memory = 1 << 1,
+    Memcpy = 1 << 2,
+    GILWait = 1 << 3,
+    LockWait = 1 << 4,
+    AllFlags = CPU | Memory | Memcpy | GILWait | LockWait
+  };
+
+  // Rates and intervals of 0 mean "use the default".
+  struct Layout {
+    std::atomic<uint32_t> magic;
+    std::atomic<uint32_t> version;
+    std::atomic<uint32_t> flags;
+    std::atomic<uint32_t> generation;
+    std::atomic<uint64_t> mallocSamplingRate;       // bytes
+    std::atomic<uint64_t> memcpySamplingRate;       // bytes
+    std::atomic<uint64_t> cpuSamplingIntervalUsec;  // microseconds
+    std::atomic<uint64_t> outputIntervalMsec;       // milliseconds (0 = never)
+    std::atomic<uint64_t> snapshotRequests;  // incremented per request
+    // When the malloc sampling rate is the default, it adapts toward
+    // this many samples per second per thread, within this overhead
+    // budget (in parts per million of elapsed time).
+    std::atomic<uint32_t> targetSamplesPerSec;
+    std::atomic<uint32_t> overheadBudgetPpm;
+    // Allocations of at least this many bytes are tracked exactly
+    // (UINT64_MAX for none).
+    std::atomic<uint64_t> largeAllocationThreshold;
+  };
+
+  static ControlBlock &getInstance() {
+    alignas(ControlBlock) static char buf[sizeof(ControlBlock)];
+    static auto *cb = new (buf) ControlBlock;
+    return *cb;
+  }
+
+  inline bool enabled(Flag flag) const {
+    return _block->flags.load(std::memory_order_relaxed) & flag;
+  }
+
+  inline uint64_t mallocSamplingRate() const {
+    return _block->mallocSamplingRate.load(std::memory_order_relaxed);
+  }
+
+  inline uint32_t targetSamplesPerSec() const {
+    return _block->targetSamplesPerSec.load(std::memory_order_relaxed);
+  }
+
+  inline uint32_t overheadBudgetPpm() const {
+    return _block->overheadBudgetPpm.load(std::memory_order_relaxed);
+  }
+
+  inline uint64_t largeAllocationThreshold() const {
+    return _block->largeAllocationThreshold.load(std::memory_order_relaxed);
+  }
+
+  inline uint64_t memcpySamplingRate() const {
+    return _block->memcpySamplingRate.load(std::memory_order_relaxed);
+  }
+
+  // Call in the child after a fork.
+  static void afterFork() { getInstance().moveToChild(); }
+
+ private:
+  static constexpr size_t PageSize = 4096;
+
+  ControlBlock() : _block(&_private) { map(nullptr); }
+
+  // Maps our process's page, initializing it (if new) from the given
+  // settings or else the defaults. If it cannot be mapped, the settings
+  // are kept privately instead: not reconfigurable, but everything
+  // still works.
+  void map(const Layout *from) {
+    char filename[64];
+    snprintf(filename, sizeof(filename), "/tmp/scalene-control%d", getpid());
+    auto fd = open(filename,
+                   O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+                   S_IRUSR | S_IWUSR);
+    if ((fd == -1) && (errno == EEXIST)) {
+      fd = open(filename, O_RDWR | O_NOFOLLOW | O_CLOEXEC);
+      if ((fd != -1) && !trusted(fd)) {
+        close(fd);
+        fd = -1;
+      }
+    }
+    auto block = &_private;
+    if (fd != -1) {
+      flock(fd, LOCK_EX);
+      struct stat st;
+      if ((fstat(fd, &st) == 0) && (st.st_size < (off_t)PageSize)) {
+        ftruncate(fd, PageSize);
+      }
+      auto p =
+          mmap(nullptr, PageSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (p != MAP_FAILED) {
+        block = reinterpret_cast<Layout *>(p);
+      }
+    }
+    if ((block == &_private) ||
+        (block->magic.load(std::memory_order_relaxed) != Magic)) {
+      if (from) {
+        copy(*block, *from);
+      } else {
+        initialize(*block);
+      }
+    }
+    _block = block;
+    if (fd != -1) {
+      flock(fd, LOCK_UN);
+      close(fd);
+    }
+  }
+
+  // Is this (existing) file one we can trust to be a control block?
+  static bool trusted(int fd) {
+    struct stat st;
+    return (fstat(fd, &st) == 0) && S_ISREG(st.st_mode) &&
+           (st.st_uid == geteuid()) && (st.st_nlink == 1) &&
+           !(st.st_mode & (S_IRWXG | S_IRWXO));
+  }
+
+  void moveToChild() {
+    auto parent = _block;
+    if (parent == &_private) {
+      // (Copy it out of the way first.)
+      copy(_parentCopy, _private);
+      parent = &_parentCopy;
+    }
+    map(parent);
+    if ((parent != &_parentCopy) && (parent != _block)) {
+      munmap(parent, PageSize);
+    }
+  }
+
+  static void initialize(Layout &block) {
+    block.version.store(Version, std::memory_order_relaxed);
+    block.flags.store(AllFlags, std::memory_order_relaxed);
+    block.generation.store(0, std::memory_order_relaxed);
+    block.mallocSamplingRate.store(0, std::memory_order_relaxed);
+    block.memcpySamplingRate.store(0, std::memory_order_relaxed);
+    block.cpuSamplingIntervalUsec.store(0, std::memory_order_relaxed);
+    block.outputIntervalMsec.store(0, std::memory_order_relaxed);
+    block.snapshotRequests.store(0, std::memory_order_relaxed);
+    block.targetSamplesPerSec.store(0, std::memory_order_relaxed);
+    block.overheadBudgetPpm.store(0, std::memory_order_relaxed);
+    block.largeAllocationThreshold.store(0, std::memory_order_relaxed);
+    block.magic.store(Magic, std::memory_order_release);
+  }
+
+  static void copy(Layout &to, const Layout &from) {
+#define COPY_FIELD(f) to.f.store(from.f.load(std::memory_order_relaxed), \
+                                 std::memory_order_relaxed)
+    COPY_FIELD(version);
+    COPY_FIELD(flags);
+    COPY_FIELD(generation);
+    COPY_FIELD(mallocSamplingRate);
+    COPY_FIELD(memcpySamplingRate);
+    COPY_FIELD(cpuSamplingIntervalUsec);
+    COPY_FIELD(outputIntervalMsec);
+    COPY_FIELD(snapshotRequests);
+    COPY_FIELD(targetSamplesPerSec);
+    COPY_FIELD(overheadBudgetPpm);
+    COPY_FIELD(largeAllocationThreshold);
+#undef COPY_FIELD
+    to.magic.store(Magic, std::memory_order_release);
+  }
+
+  static_assert(sizeof(Layout) <= PageSize, "control block must fit in a page");
+
+  Layout *_block;
+  Layout _private;     // used if the shared page cannot be mapped
+  Layout _parentCopy;  // (see moveToChild)
+};
+
+#endif
@@ -0,0 +1,132 @@
+#pragma once
+#ifndef GILWAITSAMPLER_HPP
+#define GILWAITSAMPLER_HPP
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include "common.hpp"
+#include "interpreterrange.hpp"
+#include "printf.h"
+#include "samplefile.hpp"
+#include "stprintf.h"
+
+// Samples the time threads spend waiting for the GIL.
+//
+// CPython's GIL is a mutex plus a condition variable that waiting
+// threads block on (with a timeout, so they can request a switch).
+// libscalene interposes pthread_mutex_lock and pthread_cond_timedwait;
+// calls whose return address lies in the interpreter are (almost
+// entirely) GIL acquisitions, so we time those that block. Each
+// thread accumulates its wait time and writes a record once it has
+// waited at least WaitSamplingRateNs, so uncontended programs never
+// write anything. The Python side attributes each record to the line
+// the waiting thread is on.
+//
+// The interposed functions run from the moment the library is loaded,
+// so they must check isEnabled() (which needs no initialization)
+// before touching the sampler itself.
+
+template <uint64_t WaitSamplingRateNs>
+class GILWaitSampler {
+ public:
+  GILWaitSampler()
+      : _samplefile((char *)"/tmp/scalene-gil-signal%d",
+                    (char *)"/tmp/scalene-gil-lock%d",
+                    (char *)"/tmp/scalene-gil-init%d") {}
+
+  void enable() {
+    InterpreterRange::initialize();
+    enabled().store(true, std::memory_order_relaxed);
+  }
+
+  void disable() { enabled().store(false, std::memory_order_relaxed); }
+
+  static inline bool isEnabled() {
+    return enabled().load(std::memory_order_relaxed);
+  }
+
+  template <typename LockFn>
+  ATTRIBUTE_ALWAYS_INLINE inline int mutexLock(LockFn realLock,
+                                               pthread_mutex_t *mutex,
+                                               void *caller) {
+    if (!InterpreterRange::contains(caller)) {
+      return realLock(mutex);
+    }
+    // Uncontended acquisitions take the fast path and are not timed.
+    // (As in LockWaitSampler::lock, only EBUSY means contended.)
+    auto tried = pthread_mutex_trylock(mutex);
+    if (tried != EBUSY) {
+      return tried;
+    }
+    auto start = now();
+    auto result = realLock(mutex);
+    recordWait(now() - start);
+    return result;
+  }
+
+  template <typename WaitFn>
+  ATTRIBUTE_ALWAYS_INLINE inline int condTimedWait(
+      WaitFn realWait, pthread_cond_t *cond, pthread_mutex_t *mutex,
+      const struct timespec *abstime, void *caller) {
+    if (!InterpreterRange::contains(caller)) {
+      return realWait(cond, mutex, abstime);
+    }
+    auto start = now();
+    auto result = realWait(cond, mutex, abstime);
+    recordWait(now() - start);
+    return result;
+  }
+
+ private:
+  // Prevent copying and assignment.
+  GILWaitSampler(const GILWaitSampler &) = delete;
+  GILWaitSampler &operator=(const GILWaitSampler &) = delete;
+
+  static std::atomic<bool> &enabled() {
+    static std::atomic<bool> flag{false};
+    return flag;
+  }
+
+  static inline uint64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+
+  void recordWait(uint64_t waitNs) {
+    auto &waited = waitedNs();
+    waited += waitNs;
+    if (waited < WaitSamplingRateNs) {
+      return;
+    }
+    auto saved_errno = errno;
+    char buf[SampleFile::MAX_BUFSIZE];
+    stprintf::format(buf, SampleFile::MAX_BUFSIZE,
+                     STPRINTF_FORMAT("%lu,%lu,%d\n\n"),
+                     (unsigned long)pthread_self(), waited, getpid());
+    _samplefile.writeToFile(buf, 0);
+    waited = 0;
+    errno = saved_errno;
+  }
+
+  // Wait time (in ns) not yet written out, per thread.
+  static uint64_t &waitedNs() {
+    static __thread uint64_t waited
+        __attribute__((tls_model("initial-exec"))) = 0;
+    return waited;
+  }
+
+  SampleFile _samplefile;
+};
+
+#endif  // __linux__
+
+#endif
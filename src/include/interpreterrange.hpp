@@ -0,0 +1,76 @@
+#pragma once
+#ifndef INTERPRETERRANGE_HPP
+#define INTERPRETERRANGE_HPP
+
+#include <dlfcn.h>
+#include <stdint.h>
+
+#if !defined(__APPLE__)
+#include <link.h>
+#endif
+
+// Tracks the address range of the Python interpreter's code (the
+// executable segment of libpython, or of the python executable if it
+// is statically linked). Native samples use this to tell whether a
+// thread was running the interpreter or some other (native) library.
+
+class InterpreterRange {
+ public:
+  // Must be called once the interpreter has been loaded (that is, not
+  // from a library constructor), and before any call to contains().
+  static void initialize() {
+    auto &r = getRange();
+    if (r.initialized) {
+      return;
+    }
+    r.initialized = true;
+#if !defined(__APPLE__)
+    auto sym = dlsym(RTLD_DEFAULT, "Py_Initialize");
+    if (sym == nullptr) {
+      return;
+    }
+    dl_iterate_phdr(findSegment, sym);
+#endif
+  }
+
+  // Safe to call from a signal handler.
+  static inline bool contains(void *pc) {
+    auto &r = getRange();
+    auto p = reinterpret_cast<uintptr_t>(pc);
+    return (p >= r.start) && (p < r.end);
+  }
+
+ private:
+  struct Range {
+    bool initialized;
+    uintptr_t start;
+    uintptr_t end;
+  };
+
+  static Range &getRange() {
+    static Range range{false, 0, 0};
+    return range;
+  }
+
+#if !defined(__APPLE__)
+  static int findSegment(struct dl_phdr_info *info, size_t, void *data) {
+    auto target = reinterpret_cast<uintptr_t>(data);
+    for (auto i = 0; i < info->dlpi_phnum; i++) {
+      const auto &phdr = info->dlpi_phdr[i];
+      if ((phdr.p_type != PT_LOAD) || !(phdr.p_flags & PF_X)) {
+        continue;
+      }
+      auto start = info->dlpi_addr + phdr.p_vaddr;
+      auto end = start + phdr.p_memsz;
+      if ((target >= start) && (target < end)) {
+        getRange().start = start;
+        getRange().end = end;
+        return 1;  // found it; stop iterating.
+      }
+    }
+    return 0;
+  }
+#endif
+};
+
+#endif
@@ -0,0 +1,125 @@
+#pragma once
+#ifndef LARGEOBJECTS_HPP
+#define LARGEOBJECTS_HPP
+
+#include <heaplayers.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <new>
+
+#include "common.hpp"
+#include "open_addr_hashtable.hpp"
+
+// The large allocations (at or above a threshold; see
+// ControlBlock::largeAllocationThreshold) that SampleHeap accounts for
+// exactly rather than by sampling, with their sizes. These dominate
+// peak memory, so each one gets its own record, and so does its
+// release (which the free sampler would only catch by chance).
+//
+// The table is shared by all threads, since objects are often freed by
+// a thread other than the one that allocated them. Frees of anything
+// smaller than the smallest object tracked (rounded down to a power of
+// two) skip it entirely.
+
+class LargeObjects {
+ public:
+  static constexpr uint64_t DefaultThreshold = 1024 * 1024;
+
+  static LargeObjects &getInstance() {
+    alignas(LargeObjects) static char buf[sizeof(LargeObjects)];
+    static auto *lo = new (buf) LargeObjects;
+    return *lo;
+  }
+
+  inline size_t minTrackedSize() const {
+    return _minTrackedSize.load(std::memory_order_relaxed);
+  }
+
+  // @return false iff the object could not be tracked (it should be
+  // sampled instead).
+  bool add(void *ptr, size_t size) {
+    _lock.lock();
+    auto added = (_count < Capacity * 3 / 4) &&
+                 _objects.put(ptr, reinterpret_cast<void *>(size));
+    if (added) {
+      _count++;
+      track(size);
+    }
+    _lock.unlock();
+    return added;
+  }
+
+  // If ptr starts a tracked object, releases (up to) len bytes of it
+  // and returns how many; otherwise, returns 0. A release of only a
+  // prefix (as munmap allows) leaves the rest tracked.
+  size_t remove(void *ptr, size_t len) {
+    _lock.lock();
+    auto size = reinterpret_cast<uintptr_t>(_objects.get(ptr));
+    if (size == 0) {
+      _lock.unlock();
+      return 0;
+    }
+    _objects.remove(ptr);
+    _count--;
+    untrack(size);
+    auto freed = (len < size) ? len : size;
+    if ((freed < size) &&
+        _objects.put(reinterpret_cast<char *>(ptr) + freed,
+                     reinterpret_cast<void *>(size - freed))) {
+      _count++;
+      track(size - freed);
+    }
+    _lock.unlock();
+    return freed;
+  }
+
+ private:
+  static constexpr unsigned long Capacity = 1 << 14;
+  static constexpr int SizeClasses = 64;  // by log2 of the size
+
+  LargeObjects() : _count(0), _minTrackedSize(SIZE_MAX) {
+    for (auto &n : _objectsOfClass) {
+      n = 0;
+    }
+  }
+
+  static int sizeClass(size_t size) {
+    return (SizeClasses - 1) - __builtin_clzll(size);
+  }
+
+  // Call these with the lock held.
+  void track(size_t size) {
+    auto c = sizeClass(size);
+    _objectsOfClass[c]++;
+    auto min = (size_t)1 << c;
+    if (min < _minTrackedSize.load(std::memory_order_relaxed)) {
+      _minTrackedSize.store(min, std::memory_order_relaxed);
+    }
+  }
+
+  void untrack(size_t size) {
+    auto c = sizeClass(size);
+    if ((--_objectsOfClass[c] > 0) ||
+        (((size_t)1 << c) != _minTrackedSize.load(std::memory_order_relaxed))) {
+      return;
+    }
+    // That was the last of the smallest objects: raise the minimum.
+    auto min = SIZE_MAX;
+    for (int i = c + 1; i < SizeClasses; i++) {
+      if (_objectsOfClass[i] > 0) {
+        min = (size_t)1 << i;
+        break;
+      }
+    }
+    _minTrackedSize.store(min, std::memory_order_relaxed);
+  }
+
+  HL::SpinLock _lock;
+  unsigned long _count;
+  std::atomic<size_t> _minTrackedSize;
+  unsigned long _objectsOfClass[SizeClasses];
+  open_addr_hashtable<Capacity> _objects;  // start -> size
+};
+
+#endif
@@ -0,0 +1,297 @@
+#pragma once
+#ifndef LIVEOBJECTS_HPP
+#define LIVEOBJECTS_HPP
+
+#include <heaplayers.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <atomic>
+#include <new>
+
+#include "common.hpp"
+#include "printf.h"
+
+// Tracks the sampled allocations that are still alive, with their
+// allocation site (stack id; see stacktable.hpp), the number of bytes
+// each one stands for (its sampling interval), and when it was made.
+// Aggregated by site and bucketed by age, these make a far stronger
+// leak signal than footprint growth alone: a site whose sampled objects
+// keep surviving, old and new, is very likely leaking.
+//
+// Memory use is bounded: at most Capacity objects are tracked (further
+// samples are counted as dropped). Every free must check whether it
+// releases a tracked object, so the table keeps an array of per-bucket
+// counts that frees consult (one relaxed load) before taking the lock.
+// The counts are exact (they cannot saturate), and there are enough
+// buckets that, even with the table full, few untracked frees share a
+// bucket with a tracked object.
+
+class LiveObjects {
+ public:
+  enum { AgeBuckets = 5 };  // < 1s, < 10s, < 100s, < 1000s, older
+
+  static LiveObjects &getInstance() {
+    alignas(LiveObjects) static char buf[sizeof(LiveObjects)];
+    static auto *lo = new (buf) LiveObjects;
+    return *lo;
+  }
+
+  void add(void *ptr, uint32_t stackId, uint64_t bytes) {
+    if (ptr == nullptr) {
+      return;
+    }
+    auto birth = now();
+    _lock.lock();
+    if (_count >= Capacity * 3 / 4) {
+      // Keep probe sequences short.
+      _dropped++;
+      _lock.unlock();
+      return;
+    }
+    auto index = find(ptr);
+    auto &object = _objects[index];
+    if (object.ptr != ptr) {
+      object.ptr = ptr;
+      _count++;
+      auto &filter = _filter[filterIndex(ptr)];
+      filter.store(filter.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_relaxed);
+    }
+    object.stackId = stackId;
+    object.birth = birth;
+    object.bytes = bytes;
+    _lock.unlock();
+  }
+
+  // Called on every free.
+  ATTRIBUTE_ALWAYS_INLINE inline void remove(void *ptr) {
+    if (likely(_filter[filterIndex(ptr)].load(std::memory_order_relaxed) ==
+               0)) {
+      return;
+    }
+    removeSlowPath(ptr);
+  }
+
+  // Writes one line per allocation site with surviving objects:
+  //   stack id,objects,bytes,age bucket counts...,new objects
+  // (where new objects were made since the last report)
+  // then a final line with the number of dropped samples:
+  //   dropped,count
+  // Returns the number of characters written (at most len - 1).
+  size_t report(char *buf, size_t len) {
+    if (len == 0) {
+      return 0;
+    }
+    _reportLock.lock();
+    // Aggregate a copy, so frees only wait for the copy.
+    auto reportTime = now();
+    _lock.lock();
+    memcpy(_snapshot, _objects, sizeof(_objects));
+    auto dropped = _dropped;
+    _lock.unlock();
+    auto lastReport = _lastReport;
+    _lastReport = reportTime;
+    for (auto &site : _sites) {
+      site.stackId = EmptySite;
+    }
+    for (auto &object : _snapshot) {
+      if (object.ptr == nullptr) {
+        continue;
+      }
+      auto site = findSite(object.stackId);
+      if (site == nullptr) {
+        continue;
+      }
+      site->objects++;
+      site->bytes += object.bytes;
+      site->ages[ageBucket(reportTime - object.birth)]++;
+      if (object.birth >= lastReport) {
+        site->newObjects++;
+      }
+    }
+    size_t pos = 0;
+    for (auto &site : _sites) {
+      if ((site.stackId == EmptySite) || (pos + 1 >= len)) {
+        continue;
+      }
+      auto n = snprintf(buf + pos, len - pos,
+#if defined(__APPLE__)
+                        "%u,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n",
+#else
+                        "%u,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n",
+#endif
+                        site.stackId, site.objects, site.bytes, site.ages[0],
+                        site.ages[1], site.ages[2], site.ages[3],
+                        site.ages[4], site.newObjects);
+      pos = advance(pos, n, len);
+    }
+    if (pos + 1 < len) {
+      auto n = snprintf(buf + pos, len - pos,
+#if defined(__APPLE__)
+                        "dropped,%llu\n",
+#else
+                        "dropped,%lu\n",
+#endif
+                        dropped);
+      pos = advance(pos, n, len);
+    }
+    _reportLock.unlock();
+    return pos;
+  }
+
+ private:
+  static constexpr uint32_t Capacity = 1 << 14;       // power of two
+  static constexpr uint32_t FilterSize = 1 << 18;     // power of two
+  static constexpr uint32_t MaxSites = 1 << 11;       // power of two
+  static constexpr uint32_t EmptySite = 0xffffffff;   // (0 is "no stack")
+
+  struct Object {
+    void *ptr;
+    uint32_t stackId;
+    uint64_t birth;  // ns
+    uint64_t bytes;
+  };
+
+  struct Site {
+    uint32_t stackId;
+    uint64_t objects;
+    uint64_t bytes;
+    uint64_t ages[AgeBuckets];
+    uint64_t newObjects;
+  };
+
+  // (The filter counts can never exceed the number of objects.)
+  static_assert(Capacity <= 0xffff, "filter counts are 16 bits");
+
+  LiveObjects() : _count(0), _dropped(0), _lastReport(0) {
+    for (auto &object : _objects) {
+      object.ptr = nullptr;
+    }
+    for (auto &f : _filter) {
+      f.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  static uint64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+
+  static int ageBucket(uint64_t ageNs) {
+    int bucket = 0;
+    for (uint64_t limit = 1000000000ULL;
+         (bucket < AgeBuckets - 1) && (ageNs >= limit); limit *= 10) {
+      bucket++;
+    }
+    return bucket;
+  }
+
+  static size_t advance(size_t pos, int n, size_t len) {
+    if (n < 0) {
+      return pos;
+    }
+    return ((size_t)n >= len - pos) ? len - 1 : pos + n;
+  }
+
+  static uint64_t hash(void *ptr) {
+    auto h = (uint64_t)ptr;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  static uint32_t filterIndex(void *ptr) {
+    return (uint32_t)(hash(ptr) >> 16) & (FilterSize - 1);
+  }
+
+  static uint32_t home(void *ptr) {
+    return (uint32_t)hash(ptr) & (Capacity - 1);
+  }
+
+  // Returns the slot holding ptr, or else the empty slot that ends its
+  // probe sequence (there always is one, since the table is never
+  // full). Call with the lock held.
+  uint32_t find(void *ptr) {
+    auto index = home(ptr);
+    while ((_objects[index].ptr != ptr) && (_objects[index].ptr != nullptr)) {
+      index = (index + 1) & (Capacity - 1);
+    }
+    return index;
+  }
+
+  void removeSlowPath(void *ptr) {
+    _lock.lock();
+    auto index = find(ptr);
+    if (_objects[index].ptr == ptr) {
+      erase(index);
+      _count--;
+      auto &filter = _filter[filterIndex(ptr)];
+      filter.store(filter.load(std::memory_order_relaxed) - 1,
+                   std::memory_order_relaxed);
+    }
+    _lock.unlock();
+  }
+
+  // Empties the slot, moving later objects of the same run back into
+  // the gap where their probe sequences allow (rather than leaving a
+  // tombstone), so that probe sequences stay as short as the load
+  // allows however many objects come and go.
+  void erase(uint32_t gap) {
+    auto index = gap;
+    while (true) {
+      index = (index + 1) & (Capacity - 1);
+      auto p = _objects[index].ptr;
+      if (p == nullptr) {
+        break;
+      }
+      // Move it unless its home lies (cyclically) in (gap, index].
+      auto h = home(p);
+      auto inRun = (gap <= index) ? ((gap < h) && (h <= index))
+                                  : ((gap < h) || (h <= index));
+      if (!inRun) {
+        _objects[gap] = _objects[index];
+        gap = index;
+      }
+    }
+    _objects[gap].ptr = nullptr;
+  }
+
+  Site *findSite(uint32_t stackId) {
+    auto index = (stackId * 2654435761U) & (MaxSites - 1);
+    for (uint32_t probes = 0; probes < MaxSites; probes++) {
+      auto &site = _sites[index];
+      if (site.stackId == stackId) {
+        return &site;
+      }
+      if (site.stackId == EmptySite) {
+        site.stackId = stackId;
+        site.objects = 0;
+        site.bytes = 0;
+        for (auto &age : site.ages) {
+          age = 0;
+        }
+        site.newObjects = 0;
+        return &site;
+      }
+      index = (index + 1) & (MaxSites - 1);
+    }
+    return nullptr;
+  }
+
+  HL::SpinLock _lock;
+  uint32_t _count;
+  uint64_t _dropped;
+  Object _objects[Capacity];
+  std::atomic<uint16_t> _filter[FilterSize];
+  // (Only report() uses these, under its own lock.)
+  HL::SpinLock _reportLock;
+  uint64_t _lastReport;
+  Object _snapshot[Capacity];
+  Site _sites[MaxSites];
+};
+
+#endif
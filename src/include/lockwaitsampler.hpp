@@ -0,0 +1,109 @@
+#pragma once
+#ifndef LOCKWAITSAMPLER_HPP
+#define LOCKWAITSAMPLER_HPP
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include "common.hpp"
+#include "interpreterrange.hpp"
+#include "printf.h"
+#include "samplefile.hpp"
+#include "sampler.hpp"
+#include "stprintf.h"
+
+// Samples the time native code spends blocked on pthread mutexes and
+// reader-writer locks (the GIL is handled by GILWaitSampler).
+//
+// Every acquisition first tries the lock; only when that fails is the
+// wait timed, so uncontended locks pay for one extra try and nothing
+// else. Wait times feed a per-thread Sampler (counting nanoseconds
+// rather than bytes); each sample records the thread, the time it
+// represents, and the call site (the return address into the code that
+// took the lock). The Python side attributes each sample to the line
+// the thread is on and symbolizes the call site.
+//
+// As with GILWaitSampler, the interposed functions must check
+// isEnabled() before touching the sampler itself.
+
+template <uint64_t WaitSamplingRateNs>
+class LockWaitSampler {
+ public:
+  LockWaitSampler()
+      : _samplefile((char *)"/tmp/scalene-lock-signal%d",
+                    (char *)"/tmp/scalene-lock-lock%d",
+                    (char *)"/tmp/scalene-lock-init%d") {}
+
+  void enable() {
+    InterpreterRange::initialize();
+    enabled().store(true, std::memory_order_relaxed);
+  }
+
+  void disable() { enabled().store(false, std::memory_order_relaxed); }
+
+  static inline bool isEnabled() {
+    return enabled().load(std::memory_order_relaxed);
+  }
+
+  // Acquire lock (with realLock), timing the wait if tryLock fails.
+  template <typename Lock, typename TryLockFn, typename LockFn>
+  ATTRIBUTE_ALWAYS_INLINE inline int lock(TryLockFn tryLock, LockFn realLock,
+                                          Lock *l, void *caller) {
+    // Only EBUSY means "held by someone else": any other result
+    // (success, or an error such as EOWNERDEAD, which also acquires a
+    // robust mutex) is what the lock itself would have returned.
+    auto tried = tryLock(l);
+    if (likely(tried != EBUSY)) {
+      return tried;
+    }
+    auto start = now();
+    auto result = realLock(l);
+    recordWait(now() - start, caller);
+    return result;
+  }
+
+ private:
+  // Prevent copying and assignment.
+  LockWaitSampler(const LockWaitSampler &) = delete;
+  LockWaitSampler &operator=(const LockWaitSampler &) = delete;
+
+  static std::atomic<bool> &enabled() {
+    static std::atomic<bool> flag{false};
+    return flag;
+  }
+
+  static inline uint64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+
+  void recordWait(uint64_t waitNs, void *caller) {
+    static thread_local Sampler<WaitSamplingRateNs> waitSampler;
+    auto sampledNs = waitSampler.sample(waitNs);
+    if (likely(sampledNs == 0)) {
+      return;
+    }
+    auto saved_errno = errno;
+    char buf[SampleFile::MAX_BUFSIZE];
+    stprintf::format(buf, SampleFile::MAX_BUFSIZE,
+                     STPRINTF_FORMAT("%lu,%lu,%p,%d\n\n"),
+                     (unsigned long)pthread_self(), sampledNs, caller,
+                     getpid());
+    _samplefile.writeToFile(buf, 0);
+    errno = saved_errno;
+  }
+
+  SampleFile _samplefile;
+};
+
+#endif  // __linux__
+
+#endif
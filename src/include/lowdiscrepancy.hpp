@@ -15,7 +15,9 @@ class LowDiscrepancy {
   uint64_t _next;
 
  public:
-  LowDiscrepancy(uint64_t seed) {
+  typedef uint64_t result_type;
+
+  LowDiscrepancy(uint64_t seed) : _next(0) {
     std::mt19937_64 rng(seed);
     rng();  // consume one RNG
     // Initialize the sequence with a value that's in the middle two quartiles.
@@ -10,6 +10,7 @@
 #include <sys/types.h>
 #include <unistd.h>  // for getpid()
 
+#include "controlblock.hpp"
 #include "sampler.hpp"
 #include "printf.h"
 
@@ -166,6 +167,7 @@ void *memcpy_musl(void *dest, const void *src, size_t n) {
 #include "rtememcpy.h"
 #endif
 #include "samplefile.hpp"
+#include "stprintf.h"
 
 template <uint64_t MemcpySamplingRateBytes>
 class MemcpySampler {
@@ -266,6 +268,12 @@ class MemcpySampler {
     _memcpyOps += n;
     auto sampleMemop = _memcpySampler.sample(n);
     if (unlikely(sampleMemop)) {
+      auto &control = ControlBlock::getInstance();
+      _memcpySampler.setRate(control.memcpySamplingRate());
+      if (unlikely(!control.enabled(ControlBlock::Memcpy))) {
+        _memcpyOps = 0;
+        return;
+      }
       writeCount();
       _memcpyTriggered++;
       _memcpyOps = 0;
@@ -283,8 +291,8 @@ class MemcpySampler {
 
   void writeCount() {
     char buf[FILENAME_LENGTH];
-    snprintf(buf, FILENAME_LENGTH, "%d,%d,%d\n\n", _memcpyTriggered, _memcpyOps,
-             getpid());
+    stprintf::format(buf, FILENAME_LENGTH, STPRINTF_FORMAT("%llu,%lu,%d\n\n"),
+                     _memcpyTriggered, _memcpyOps, getpid());
     _samplefile.writeToFile(buf, 0);
   }
 };
@@ -0,0 +1,224 @@
+#pragma once
+#ifndef MMAPTRACKER_HPP
+#define MMAPTRACKER_HPP
+
+#include <heaplayers.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "common.hpp"
+
+// Accounts for anonymous memory that code maps directly (numpy, arrow,
+// torch, ...) rather than allocating through malloc, feeding the sizes
+// to an accounting heap's malloc and free samplers.
+//
+// A region table (sorted by address) remembers every tracked mapping,
+// so unmaps are charged exactly what they release, whether they cover
+// part of one region, several regions, or start inside one (as when
+// trimming a mapping to an alignment). When an unmap starts inside a
+// region, the whole region is released and what survives of it is
+// registered again. Mappings that do not fit in the table are reported
+// once and then neither charged nor tracked.
+//
+// The lock is held across the system call itself, so that an address
+// cannot be unmapped, mapped again by another thread and registered,
+// all before its old region is unregistered.
+//
+// Heap must provide register_malloc(size, ptr) and
+// register_free(size, ptr) (see sampleheap.hpp); it is only touched
+// under our lock.
+
+template <class Heap>
+class MmapTracker {
+ public:
+  MmapTracker() : _heap(nullptr), _regionCount(0), _reportedFull(false) {}
+
+  template <typename MmapFn, typename Offset>
+  void *mmap(MmapFn realMmap, void *addr, size_t len, int prot, int flags,
+             int fd, Offset offset) {
+    auto anonymous = (flags & MAP_ANONYMOUS) != 0;
+    if (!(anonymous || (flags & MAP_FIXED)) || inTracker()) {
+      return realMmap(addr, len, prot, flags, fd, offset);
+    }
+    Guard guard(this);
+    auto ptr = realMmap(addr, len, prot, flags, fd, offset);
+    if (ptr == MAP_FAILED) {
+      return ptr;
+    }
+    if (flags & MAP_FIXED) {
+      // This may replace (parts of) tracked regions.
+      unregisterRange(ptr, len);
+    }
+    if (anonymous) {
+      registerRegion(ptr, len);
+    }
+    return ptr;
+  }
+
+  template <typename MunmapFn>
+  int munmap(MunmapFn realMunmap, void *addr, size_t len) {
+    if (inTracker()) {
+      return realMunmap(addr, len);
+    }
+    Guard guard(this);
+    auto result = realMunmap(addr, len);
+    if (result == 0) {
+      unregisterRange(addr, len);
+    }
+    return result;
+  }
+
+  template <typename MremapFn>
+  void *mremap(MremapFn realMremap, void *oldAddr, size_t oldLen,
+               size_t newLen, int flags, void *newAddr) {
+    if (inTracker()) {
+      return realMremap(oldAddr, oldLen, newLen, flags, newAddr);
+    }
+    Guard guard(this);
+    auto ptr = realMremap(oldAddr, oldLen, newLen, flags, newAddr);
+    if (ptr == MAP_FAILED) {
+      return ptr;
+    }
+    // Only follow regions we are already tracking (i.e., anonymous ones).
+    // (An old length of zero duplicates a shared mapping.)
+    auto a = reinterpret_cast<uintptr_t>(oldAddr);
+    auto i = firstEndingAfter(a);
+    if ((i < _regionCount) && (_regions[i].start <= a)) {
+      if (oldLen > 0) {
+        unregisterRange(oldAddr, oldLen);
+      }
+      registerRegion(ptr, newLen);
+    }
+    return ptr;
+  }
+
+ private:
+  // Prevent copying and assignment.
+  MmapTracker(const MmapTracker &) = delete;
+  MmapTracker &operator=(const MmapTracker &) = delete;
+
+  // Holds the lock, and marks this thread as inside the tracker so
+  // that any mappings made while accounting (e.g., by the accounting
+  // heap's sample file) are not themselves tracked.
+  class Guard {
+   public:
+    explicit Guard(MmapTracker *t) : _t(t) {
+      inTracker() = true;
+      _t->_lock.lock();
+      if (unlikely(_t->_heap == nullptr)) {
+        _t->_heap = new (_t->_heapBuf) Heap;
+      }
+    }
+    ~Guard() {
+      _t->_lock.unlock();
+      inTracker() = false;
+    }
+
+   private:
+    MmapTracker *_t;
+  };
+
+  static bool &inTracker() {
+    static __thread bool inside __attribute__((tls_model("initial-exec"))) =
+        false;
+    return inside;
+  }
+
+  enum { MAX_REGIONS = 32768 };
+
+  struct Region {
+    uintptr_t start;
+    size_t length;
+  };
+
+  // The rest are called with the lock held.
+
+  // @return the index of the first region that ends after addr.
+  unsigned long firstEndingAfter(uintptr_t addr) const {
+    // Find the first region starting after addr; the one before it
+    // may still contain addr.
+    unsigned long lo = 0;
+    unsigned long hi = _regionCount;
+    while (lo < hi) {
+      auto mid = lo + (hi - lo) / 2;
+      if (_regions[mid].start <= addr) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    if ((lo > 0) && (_regions[lo - 1].start + _regions[lo - 1].length > addr)) {
+      lo--;
+    }
+    return lo;
+  }
+
+  void registerRegion(void *ptr, size_t len) {
+    if (len == 0) {
+      return;
+    }
+    if (unlikely(_regionCount == MAX_REGIONS)) {
+      if (!_reportedFull) {
+        _reportedFull = true;
+        tprintf::tprintf(
+            "Scalene: too many memory mappings; some will not be "
+            "profiled.\n");
+      }
+      return;
+    }
+    auto start = reinterpret_cast<uintptr_t>(ptr);
+    auto i = firstEndingAfter(start);
+    memmove(&_regions[i + 1], &_regions[i],
+            (_regionCount - i) * sizeof(Region));
+    _regions[i] = {start, len};
+    _regionCount++;
+    _heap->register_malloc(len, ptr);
+  }
+
+  void eraseRegion(unsigned long i) {
+    _regionCount--;
+    memmove(&_regions[i], &_regions[i + 1],
+            (_regionCount - i) * sizeof(Region));
+  }
+
+  void unregisterRange(void *addr, size_t len) {
+    auto a = reinterpret_cast<uintptr_t>(addr);
+    auto b = a + len;
+    auto i = firstEndingAfter(a);
+    while ((i < _regionCount) && (_regions[i].start < b)) {
+      auto r = _regions[i];
+      auto end = r.start + r.length;
+      if (a <= r.start) {
+        // A prefix of the region (or all of it) goes.
+        auto freed = ((b < end) ? b : end) - r.start;
+        if (freed < r.length) {
+          _regions[i] = {r.start + freed, r.length - freed};
+          i++;
+        } else {
+          eraseRegion(i);
+        }
+        _heap->register_free(freed, reinterpret_cast<void *>(r.start));
+      } else {
+        // It starts inside the region: release all of it, and register
+        // the parts on either side again.
+        eraseRegion(i);
+        _heap->register_free(r.length, reinterpret_cast<void *>(r.start));
+        registerRegion(reinterpret_cast<void *>(r.start), a - r.start);
+        if (b < end) {
+          registerRegion(reinterpret_cast<void *>(b), end - b);
+        }
+        i = firstEndingAfter(a);
+      }
+    }
+  }
+
+  HL::SpinLock _lock;
+  Heap *_heap;
+  alignas(Heap) char _heapBuf[sizeof(Heap)];
+  unsigned long _regionCount;
+  bool _reportedFull;
+  Region _regions[MAX_REGIONS];
+};
+
+#endif
@@ -0,0 +1,99 @@
+#pragma once
+#ifndef NATIVESTACK_HPP
+#define NATIVESTACK_HPP
+
+#include <pthread.h>
+#include <stdint.h>
+
+#if defined(__linux__)
+#include <ucontext.h>
+#endif
+
+#include "common.hpp"
+
+// Bounded frame-pointer stack walks.
+//
+// Every frame address is checked against the current thread's stack
+// bounds before it is dereferenced, so walking through code compiled
+// without frame pointers just ends the walk early instead of faulting.
+// This makes walks safe inside signal handlers and allocation paths.
+
+class NativeStack {
+ public:
+  enum { MAX_FRAMES = 8 };
+
+  // Record the current thread's stack bounds; until this is called,
+  // walks on this thread only report the leaf PC.
+  static void registerCurrentThread() {
+#if defined(__linux__)
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+      return;
+    }
+    void *addr;
+    size_t size;
+    if (pthread_attr_getstack(&attr, &addr, &size) == 0) {
+      stackTop() = reinterpret_cast<uintptr_t>(addr) + size;
+    }
+    pthread_attr_destroy(&attr);
+#endif
+  }
+
+  // Walk the stack interrupted by a signal (given the handler's
+  // ucontext). Returns the number of frames written, the leaf PC first.
+  static int walk(void *context, void **frames, int maxFrames) {
+#if defined(__linux__)
+    auto uc = reinterpret_cast<ucontext_t *>(context);
+#if defined(__x86_64__)
+    auto pc = (void *)uc->uc_mcontext.gregs[REG_RIP];
+    auto fp = (uintptr_t)uc->uc_mcontext.gregs[REG_RBP];
+    auto sp = (uintptr_t)uc->uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+    auto pc = (void *)uc->uc_mcontext.pc;
+    auto fp = (uintptr_t)uc->uc_mcontext.regs[29];
+    auto sp = (uintptr_t)uc->uc_mcontext.sp;
+#else
+    return 0;
+#endif
+    return walk(pc, fp, sp, frames, maxFrames);
+#else
+    return 0;
+#endif
+  }
+
+ private:
+  static int walk(void *pc, uintptr_t fp, uintptr_t sp, void **frames,
+                  int maxFrames) {
+    if (maxFrames <= 0) {
+      return 0;
+    }
+    int n = 0;
+    frames[n++] = pc;
+    const auto top = stackTop();
+    // Each frame record is [previous frame pointer, return address].
+    while ((n < maxFrames) && (fp >= sp) && (fp % sizeof(void *) == 0) &&
+           (fp + 2 * sizeof(void *) <= top)) {
+      auto record = reinterpret_cast<uintptr_t *>(fp);
+      auto next = record[0];
+      auto ret = reinterpret_cast<void *>(record[1]);
+      if (ret == nullptr) {
+        break;
+      }
+      frames[n++] = ret;
+      // Stacks grow down, so callers' frames must be at higher addresses.
+      if (next <= fp) {
+        break;
+      }
+      fp = next;
+    }
+    return n;
+  }
+
+  static uintptr_t &stackTop() {
+    static __thread uintptr_t top
+        __attribute__((tls_model("initial-exec"))) = 0;
+    return top;
+  }
+};
+
+#endif
@@ -0,0 +1,77 @@
+#pragma once
+#ifndef NUMPYALLOCATOR_HPP
+#define NUMPYALLOCATOR_HPP
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// A NumPy memory handler (NumPy >= 1.22) for the data buffers of
+// arrays, which allocates with our own malloc (so through SampleHeap)
+// while marking the current thread, so that SampleHeap can tell which
+// bytes are array data (see inArray()).
+//
+// Python installs it (see ScaleneNative.install_numpy_handler) by
+// wrapping handler() in a "mem_handler" capsule and passing that to
+// PyDataMem_SetHandler. Its layout is PyDataMem_Handler's, as declared
+// in numpy/ndarraytypes.h (version 1).
+
+class NumpyAllocator {
+ public:
+  // PyDataMemAllocator
+  struct Allocator {
+    void *ctx;
+    void *(*malloc)(void *ctx, size_t size);
+    void *(*calloc)(void *ctx, size_t nelem, size_t elsize);
+    void *(*realloc)(void *ctx, void *ptr, size_t new_size);
+    void (*free)(void *ctx, void *ptr, size_t size);
+  };
+
+  // PyDataMem_Handler
+  struct Handler {
+    char name[127];
+    uint8_t version;
+    Allocator allocator;
+  };
+
+  static Handler *handler() {
+    static Handler h = {"scalene", 1,
+                        {nullptr, hookMalloc, hookCalloc, hookRealloc,
+                         hookFree}};
+    return &h;
+  }
+
+  // True while the current thread is allocating an array's data.
+  static inline bool inArray() { return inside(); }
+
+ private:
+  static bool &inside() {
+    static __thread bool inside __attribute__((tls_model("initial-exec"))) =
+        false;
+    return inside;
+  }
+
+  class Scope {
+   public:
+    Scope() { inside() = true; }
+    ~Scope() { inside() = false; }
+  };
+
+  static void *hookMalloc(void *, size_t size) {
+    Scope scope;
+    return ::malloc(size);
+  }
+
+  static void *hookCalloc(void *, size_t nelem, size_t elsize) {
+    Scope scope;
+    return ::calloc(nelem, elsize);
+  }
+
+  static void *hookRealloc(void *, void *ptr, size_t size) {
+    Scope scope;
+    return ::realloc(ptr, size);
+  }
+
+  static void hookFree(void *, void *ptr, size_t) { ::free(ptr); }
+};
+
+#endif
@@ -24,82 +24,76 @@ class open_addr_hashtable {
     }
   }
 
-  void put(void *k, void *v) {
-    auto h = hash1(k) & (Size - 1UL);
-    if (payload[h].key == nullptr) {
-      payload[h].key = k;
-    }
-    if (payload[h].key == k) {
-      payload[h].value = v;
-      return;
+  // @return false iff the element was dropped (because the table is full).
+  bool put(void *k, void *v) {
+    auto ind = find(k);
+    if (ind != -1) {
+      payload[ind].value = v;
+      return true;
     }
-    while (true) {
-      h = (h + hash2((void *)h)) & (Size - 1UL);
+    // Not present: take the first empty slot.
+    auto h = hash1(k) & (Size - 1UL);
+    for (unsigned long probes = 0; probes < Size; probes++) {
       if (payload[h].key == nullptr) {
         payload[h].key = k;
-      }
-      if (payload[h].key == k) {
         payload[h].value = v;
-        return;
+        return true;
       }
+      h = (h + 1) & (Size - 1UL);
     }
+    return false;
   }
 
   // @return true iff the element was deleted.
   bool remove(void *k) {
-    auto h = hash1(k) & (Size - 1UL);
-    if (payload[h].key == nullptr) {
+    auto ind = find(k);
+    if (ind == -1) {
       // Not in the hash table.
       return false;
     }
-    if (payload[h].key == k) {
-      payload[h].key = nullptr;
-      payload[h].value = nullptr;
-      ;
-      return true;
-    }
-    while (true) {
-      h = (h + hash2((void *)h)) & (Size - 1UL);
+    // Move later entries of the probe run back into the gap (where
+    // their probes would reach them sooner), so lookups never need to
+    // step over deleted slots and removals leave no debris behind.
+    unsigned long gap = ind;
+    unsigned long h = gap;
+    for (unsigned long probes = 1; probes < Size; probes++) {
+      h = (h + 1) & (Size - 1UL);
       if (payload[h].key == nullptr) {
-        return false;
+        break;
       }
-      if (payload[h].key == k) {
-        payload[h].key = nullptr;
-        payload[h].value = nullptr;
-        return true;
+      auto home = hash1(payload[h].key) & (Size - 1UL);
+      if (((h - home) & (Size - 1UL)) >= ((h - gap) & (Size - 1UL))) {
+        payload[gap] = payload[h];
+        gap = h;
       }
     }
+    payload[gap].key = nullptr;
+    payload[gap].value = nullptr;
+    return true;
   }
 
  private:
   // Returns -1 if not found.
-  int find(void *k) {
+  long find(void *k) {
     unsigned long h = hash1(k) & (Size - 1UL);
-    if (payload[h].key == k) {
-      return h;
-    }
-    if (payload[h].key == nullptr) {
-      return -1;
-    }
-    while (true) {
-      h = (h + hash2((void *)h) + 1) & (Size - 1UL);
+    for (unsigned long probes = 0; probes < Size; probes++) {
       if (payload[h].key == k) {
         return h;
       }
       if (payload[h].key == nullptr) {
         return -1;
       }
+      h = (h + 1) & (Size - 1UL);
     }
+    return -1;
   }
   // Ideally, we'd use actual random numbers here,
   // but these should still do the trick.
   unsigned long hash1(void *addr) {
     auto u = (uintptr_t)addr;
-    return (u ^ 0xAFB758AC3E937519);
-  }
-  unsigned long hash2(void *addr) {
-    auto u = (uintptr_t)addr;
-    return (u ^ 0x9493AFE261E39855);
+    // Mix the high bits in, since addresses are usually aligned.
+    u ^= 0xAFB758AC3E937519;
+    return u ^ (u >> 17) ^ (u >> 31);
   }
   struct payload_t {
     payload_t() : key(nullptr), value(nullptr) {}
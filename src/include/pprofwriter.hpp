@@ -0,0 +1,221 @@
+#pragma once
+#ifndef PPROFWRITER_HPP
+#define PPROFWRITER_HPP
+
+#include <stdint.h>
+#include <zlib.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Streams a gzip'd pprof Profile message (see
+// https://github.com/google/pprof/blob/main/proto/profile.proto).
+//
+// Nothing is buffered beyond the current message: strings, functions
+// and locations are interned as samples arrive, and each new one is
+// written out immediately. (Protobuf lets the elements of a repeated
+// field be interleaved with other fields, so the string table can be
+// written incrementally, in index order.) Memory use is thus
+// proportional to the number of distinct locations, not samples.
+
+class PprofWriter {
+ public:
+  // A frame: a function, in a file, at a line (0 if unknown).
+  struct Frame {
+    std::string function;
+    std::string filename;
+    int64_t line;
+  };
+
+  PprofWriter() : _file(nullptr) {}
+
+  ~PprofWriter() { close(); }
+
+  bool open(const char *path) {
+    _file = gzopen(path, "wb");
+    if (_file == nullptr) {
+      return false;
+    }
+    // By definition, string 0 is the empty string.
+    intern("");
+    return true;
+  }
+
+  // Returns false if writing failed.
+  bool close() {
+    if (_file == nullptr) {
+      return true;
+    }
+    auto ok = (gzclose(_file) == Z_OK);
+    _file = nullptr;
+    return ok;
+  }
+
+  // Each sample type is a (type, unit) pair, e.g. ("cpu", "nanoseconds").
+  void addSampleType(const std::string &type, const std::string &unit) {
+    writeValueType(SAMPLE_TYPE, type, unit);
+  }
+
+  void setPeriod(const std::string &type, const std::string &unit,
+                 int64_t period) {
+    writeValueType(PERIOD_TYPE, type, unit);
+    writeVarintField(PERIOD, period);
+  }
+
+  void setTime(int64_t timeNanos, int64_t durationNanos) {
+    writeVarintField(TIME_NANOS, timeNanos);
+    writeVarintField(DURATION_NANOS, durationNanos);
+  }
+
+  // Frames are leaf first; there must be one value per sample type.
+  void addSample(const std::vector<Frame> &frames,
+                 const std::vector<int64_t> &values) {
+    std::vector<uint64_t> locations;
+    locations.reserve(frames.size());
+    for (const auto &frame : frames) {
+      locations.push_back(location(frame));
+    }
+    Message sample;
+    sample.packed(1, locations.data(), locations.size());
+    sample.packed(2, reinterpret_cast<const uint64_t *>(values.data()),
+                  values.size());
+    writeMessage(SAMPLE, sample);
+  }
+
+ private:
+  // Profile field numbers.
+  enum {
+    SAMPLE_TYPE = 1,
+    SAMPLE = 2,
+    LOCATION = 4,
+    FUNCTION = 5,
+    STRING_TABLE = 6,
+    TIME_NANOS = 9,
+    DURATION_NANOS = 10,
+    PERIOD_TYPE = 11,
+    PERIOD = 12
+  };
+
+  // A protobuf message under construction.
+  class Message {
+   public:
+    void varint(uint64_t v) {
+      while (v >= 0x80) {
+        _bytes.push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+      }
+      _bytes.push_back((uint8_t)v);
+    }
+    void tag(int field, int wireType) { varint((field << 3) | wireType); }
+    void varintField(int field, uint64_t v) {
+      tag(field, 0);
+      varint(v);
+    }
+    void bytesField(int field, const void *data, size_t len) {
+      tag(field, 2);
+      varint(len);
+      auto p = reinterpret_cast<const uint8_t *>(data);
+      _bytes.insert(_bytes.end(), p, p + len);
+    }
+    void packed(int field, const uint64_t *values, size_t n) {
+      Message m;
+      for (size_t i = 0; i < n; i++) {
+        m.varint(values[i]);
+      }
+      bytesField(field, m.data(), m.size());
+    }
+    const uint8_t *data() const { return _bytes.data(); }
+    size_t size() const { return _bytes.size(); }
+
+   private:
+    std::vector<uint8_t> _bytes;
+  };
+
+  int64_t intern(const std::string &s) {
+    auto it = _strings.find(s);
+    if (it != _strings.end()) {
+      return it->second;
+    }
+    auto index = (int64_t)_strings.size();
+    _strings.emplace(s, index);
+    Message m;
+    m.bytesField(STRING_TABLE, s.data(), s.size());
+    write(m);
+    return index;
+  }
+
+  uint64_t function(const std::string &name, const std::string &filename) {
+    auto key = name + '\0' + filename;
+    auto it = _functions.find(key);
+    if (it != _functions.end()) {
+      return it->second;
+    }
+    auto id = (uint64_t)_functions.size() + 1;
+    _functions.emplace(key, id);
+    auto nameIndex = intern(name);
+    auto filenameIndex = intern(filename);
+    Message f;
+    f.varintField(1, id);
+    f.varintField(2, nameIndex);
+    f.varintField(3, nameIndex);
+    f.varintField(4, filenameIndex);
+    writeMessage(FUNCTION, f);
+    return id;
+  }
+
+  uint64_t location(const Frame &frame) {
+    auto key = frame.function + '\0' + frame.filename + '\0' +
+               std::to_string(frame.line);
+    auto it = _locations.find(key);
+    if (it != _locations.end()) {
+      return it->second;
+    }
+    auto id = (uint64_t)_locations.size() + 1;
+    _locations.emplace(key, id);
+    auto functionId = function(frame.function, frame.filename);
+    Message line;
+    line.varintField(1, functionId);
+    line.varintField(2, frame.line);
+    Message loc;
+    loc.varintField(1, id);
+    loc.bytesField(4, line.data(), line.size());
+    writeMessage(LOCATION, loc);
+    return id;
+  }
+
+  void writeValueType(int field, const std::string &type,
+                      const std::string &unit) {
+    auto typeIndex = intern(type);
+    auto unitIndex = intern(unit);
+    Message vt;
+    vt.varintField(1, typeIndex);
+    vt.varintField(2, unitIndex);
+    writeMessage(field, vt);
+  }
+
+  void writeVarintField(int field, int64_t v) {
+    Message m;
+    m.varintField(field, v);
+    write(m);
+  }
+
+  void writeMessage(int field, const Message &contents) {
+    Message m;
+    m.bytesField(field, contents.data(), contents.size());
+    write(m);
+  }
+
+  void write(const Message &m) {
+    if (_file != nullptr) {
+      gzwrite(_file, m.data(), m.size());
+    }
+  }
+
+  gzFile _file;
+  std::unordered_map<std::string, int64_t> _strings;
+  std::unordered_map<std::string, uint64_t> _functions;
+  std::unordered_map<std::string, uint64_t> _locations;
+};
+
+#endif
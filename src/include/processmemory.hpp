@@ -0,0 +1,128 @@
+#pragma once
+#ifndef PROCESSMEMORY_HPP
+#define PROCESSMEMORY_HPP
+
+#include <fcntl.h>
+#include <heaplayers.h>
+#include <stdint.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+// What the OS thinks the process is using: its resident set size and
+// its minor and major page fault counts. Malloc samples carry these
+// alongside the sampled footprint, so the two can be reconciled.
+//
+// The values are refreshed at most every RefreshIntervalNs. RSS is read
+// with pread from a held-open /proc/self/statm (reopened after a fork,
+// since the open file still describes the parent); on platforms without
+// /proc, it falls back to getrusage's (peak) RSS.
+
+class ProcessMemory {
+ public:
+  struct Snapshot {
+    uint64_t rssBytes;
+    uint64_t minorFaults;
+    uint64_t majorFaults;
+  };
+
+  static ProcessMemory &getInstance() {
+    alignas(ProcessMemory) static char buf[sizeof(ProcessMemory)];
+    static auto *pm = new (buf) ProcessMemory;
+    return *pm;
+  }
+
+  Snapshot get() {
+    _lock.lock();
+    auto t = now();
+    if (!_refreshed || (t - _lastRefresh >= RefreshIntervalNs)) {
+      refresh();
+      _lastRefresh = t;
+      _refreshed = true;
+    }
+    auto snapshot = _snapshot;
+    _lock.unlock();
+    return snapshot;
+  }
+
+ private:
+  static constexpr uint64_t RefreshIntervalNs = 10000000ULL;  // 10ms
+
+  ProcessMemory()
+      : _statmFd(-1),
+        _statmPid(0),
+        _pageSize(sysconf(_SC_PAGESIZE)),
+        _lastRefresh(0),
+        _refreshed(false),
+        _snapshot{0, 0, 0} {}
+
+  static uint64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+
+  void refresh() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+      _snapshot.minorFaults = usage.ru_minflt;
+      _snapshot.majorFaults = usage.ru_majflt;
+#if defined(__APPLE__)
+      _snapshot.rssBytes = usage.ru_maxrss;  // bytes
+#else
+      _snapshot.rssBytes = usage.ru_maxrss * 1024ULL;  // KB
+#endif
+    }
+    uint64_t residentPages;
+    if (readStatm(residentPages)) {
+      _snapshot.rssBytes = residentPages * _pageSize;
+    }
+  }
+
+  // statm is "size resident shared text lib data dt", in pages.
+  bool readStatm(uint64_t &residentPages) {
+    auto pid = getpid();
+    if (pid != _statmPid) {
+      if (_statmFd != -1) {
+        close(_statmFd);
+      }
+      _statmFd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+      _statmPid = pid;
+    }
+    if (_statmFd == -1) {
+      return false;
+    }
+    char buf[128];
+    auto n = pread(_statmFd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) {
+      return false;
+    }
+    buf[n] = '\0';
+    auto p = buf;
+    // Skip the first field (total program size).
+    while ((*p != '\0') && (*p != ' ')) {
+      p++;
+    }
+    if (*p != ' ') {
+      return false;
+    }
+    p++;
+    residentPages = 0;
+    while ((*p >= '0') && (*p <= '9')) {
+      residentPages = residentPages * 10 + (*p - '0');
+      p++;
+    }
+    return true;
+  }
+
+  HL::SpinLock _lock;
+  int _statmFd;
+  pid_t _statmPid;
+  uint64_t _pageSize;
+  uint64_t _lastRefresh;
+  bool _refreshed;
+  Snapshot _snapshot;
+};
+
+#endif
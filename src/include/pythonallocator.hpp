@@ -0,0 +1,117 @@
+#pragma once
+#ifndef PYTHONALLOCATOR_HPP
+#define PYTHONALLOCATOR_HPP
+
+#include <dlfcn.h>
+#include <stddef.h>
+
+// Tells whether the current allocation was made through one of
+// Python's allocator domains (PyMem_RawMalloc, PyMem_Malloc,
+// PyObject_Malloc and friends), by wrapping each domain's allocator
+// with PyMem_SetAllocator, as tracemalloc does. Scalene runs Python
+// with PYTHONMALLOC=malloc, so these all end up in our malloc, where
+// SampleHeap checks inPython() to split the bytes it sees between
+// Python and native code.
+//
+// libscalene does not link against libpython, so the API is looked up
+// at install time; its types are declared here as in
+// cpython/pymem.h (unchanged since Python 3.5).
+
+class PythonAllocator {
+ public:
+  // Wraps the allocators of all three domains (once). Must be called
+  // with the GIL held, once the interpreter is up.
+  // @return false if this is not a Python process.
+  static bool install() {
+    auto &s = state();
+    if (s.installed) {
+      return true;
+    }
+    auto getAllocator = reinterpret_cast<GetAllocatorFn>(
+        dlsym(RTLD_DEFAULT, "PyMem_GetAllocator"));
+    auto setAllocator = reinterpret_cast<SetAllocatorFn>(
+        dlsym(RTLD_DEFAULT, "PyMem_SetAllocator"));
+    if ((getAllocator == nullptr) || (setAllocator == nullptr)) {
+      return false;
+    }
+    for (int domain = 0; domain < NumDomains; domain++) {
+      getAllocator(domain, &s.original[domain]);
+      MemAllocatorEx hooks = {&s.original[domain], hookMalloc, hookCalloc,
+                              hookRealloc, hookFree};
+      setAllocator(domain, &hooks);
+    }
+    s.installed = true;
+    return true;
+  }
+
+  // True while the current thread is inside one of Python's allocators.
+  static inline bool inPython() { return inside(); }
+
+ private:
+  // PyMemAllocatorDomain: PYMEM_DOMAIN_RAW, _MEM and _OBJ.
+  enum { NumDomains = 3 };
+
+  // PyMemAllocatorEx
+  struct MemAllocatorEx {
+    void *ctx;
+    void *(*malloc)(void *ctx, size_t size);
+    void *(*calloc)(void *ctx, size_t nelem, size_t elsize);
+    void *(*realloc)(void *ctx, void *ptr, size_t new_size);
+    void (*free)(void *ctx, void *ptr);
+  };
+
+  using GetAllocatorFn = void (*)(int domain, MemAllocatorEx *allocator);
+  using SetAllocatorFn = void (*)(int domain, MemAllocatorEx *allocator);
+
+  struct State {
+    bool installed;
+    MemAllocatorEx original[NumDomains];
+  };
+
+  static State &state() {
+    static State s{};
+    return s;
+  }
+
+  static bool &inside() {
+    static __thread bool inside __attribute__((tls_model("initial-exec"))) =
+        false;
+    return inside;
+  }
+
+  // Marks the current thread as inside Python's allocator (restoring
+  // the previous state, since the domains may call each other).
+  class Scope {
+   public:
+    Scope() : _was(inside()) { inside() = true; }
+    ~Scope() { inside() = _was; }
+
+   private:
+    bool _was;
+  };
+
+  static void *hookMalloc(void *ctx, size_t size) {
+    auto orig = reinterpret_cast<MemAllocatorEx *>(ctx);
+    Scope scope;
+    return orig->malloc(orig->ctx, size);
+  }
+
+  static void *hookCalloc(void *ctx, size_t nelem, size_t elsize) {
+    auto orig = reinterpret_cast<MemAllocatorEx *>(ctx);
+    Scope scope;
+    return orig->calloc(orig->ctx, nelem, elsize);
+  }
+
+  static void *hookRealloc(void *ctx, void *ptr, size_t size) {
+    auto orig = reinterpret_cast<MemAllocatorEx *>(ctx);
+    Scope scope;
+    return orig->realloc(orig->ctx, ptr, size);
+  }
+
+  static void hookFree(void *ctx, void *ptr) {
+    auto orig = reinterpret_cast<MemAllocatorEx *>(ctx);
+    orig->free(orig->ctx, ptr);
+  }
+};
+
+#endif
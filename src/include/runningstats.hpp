@@ -0,0 +1,153 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Accumulators behind scalene/runningstats.py and scalene/adaptive.py
+// (exposed to Python by src/source/accumulators.cpp).
+
+// Mean, variance, skewness and kurtosis of a stream of samples, in O(1)
+// per sample (Welford's update, extended to the higher moments), after
+// https://www.johndcook.com/blog/skewness_kurtosis/. Two accumulators
+// merge exactly (Pébay's formulas), as if one had seen both streams, so
+// each thread or process can keep its own.
+class RunningStats {
+ public:
+  RunningStats() { clear(); }
+
+  RunningStats(uint64_t n, double m1, double m2, double m3, double m4)
+      : _n(n), _m1(m1), _m2(m2), _m3(m3), _m4(m4) {}
+
+  void clear() {
+    _n = 0;
+    _m1 = _m2 = _m3 = _m4 = 0.0;
+  }
+
+  inline void push(double x) {
+    auto n1 = (double)_n;
+    _n++;
+    auto n = (double)_n;
+    auto delta = x - _m1;
+    auto deltaN = delta / n;
+    auto deltaN2 = deltaN * deltaN;
+    auto term1 = delta * deltaN * n1;
+    _m1 += deltaN;
+    _m4 += term1 * deltaN2 * (n * n - 3 * n + 3) + 6 * deltaN2 * _m2 -
+           4 * deltaN * _m3;
+    _m3 += term1 * deltaN * (n - 2) - 3 * deltaN * _m2;
+    _m2 += term1;
+  }
+
+  // Folds in other's samples.
+  RunningStats& operator+=(const RunningStats& other) {
+    if (other._n == 0) {
+      return *this;
+    }
+    if (_n == 0) {
+      *this = other;
+      return *this;
+    }
+    auto na = (double)_n;
+    auto nb = (double)other._n;
+    auto n = na + nb;
+    auto delta = other._m1 - _m1;
+    auto delta2 = delta * delta;
+    auto delta3 = delta * delta2;
+    auto delta4 = delta2 * delta2;
+    auto m1 = (na * _m1 + nb * other._m1) / n;
+    auto m2 = _m2 + other._m2 + delta2 * na * nb / n;
+    auto m3 = _m3 + other._m3 + delta3 * na * nb * (na - nb) / (n * n) +
+              3.0 * delta * (na * other._m2 - nb * _m2) / n;
+    auto m4 = _m4 + other._m4 +
+              delta4 * na * nb * (na * na - na * nb + nb * nb) / (n * n * n) +
+              6.0 * delta2 * (na * na * other._m2 + nb * nb * _m2) / (n * n) +
+              4.0 * delta * (na * other._m3 - nb * _m3) / n;
+    _n += other._n;
+    _m1 = m1;
+    _m2 = m2;
+    _m3 = m3;
+    _m4 = m4;
+    return *this;
+  }
+
+  uint64_t size() const { return _n; }
+  double mean() const { return _m1; }
+  double var() const { return _m2 / (_n - 1.0); }
+  double std() const { return std::sqrt(var()); }
+  double sem() const { return std() / std::sqrt((double)_n); }
+  // (0 for fewer than two samples.)
+  double skewness() const {
+    if (_n < 2) {
+      return 0.0;
+    }
+    return std::sqrt((double)_n) * _m3 / std::pow(_m2, 1.5);
+  }
+  double kurtosis() const { return (double)_n * _m4 / (_m2 * _m2) - 3.0; }
+
+  // The raw moments (for pickling).
+  double m1() const { return _m1; }
+  double m2() const { return _m2; }
+  double m3() const { return _m3; }
+  double m4() const { return _m4; }
+
+ private:
+  uint64_t _n;
+  double _m1, _m2, _m3, _m4;
+};
+
+// A fixed number of samples, standing for a uniform sample of however
+// many were added: when full, it keeps the median of each run of three
+// (leaving a third full), so older samples get coarser.
+class Adaptive {
+ public:
+  explicit Adaptive(size_t size) : _samples(size, 0.0), _index(0) {}
+
+  inline void add(double value) {
+    if (_index >= _samples.size()) {
+      decimate();
+    }
+    _samples[_index++] = value;
+  }
+
+  // Adds other's samples, slot by slot (as the Python version does).
+  Adaptive& operator+=(const Adaptive& other) {
+    auto n = std::min(_samples.size(), other._samples.size());
+    for (size_t i = 0; i < n; i++) {
+      _samples[i] += other._samples[i];
+    }
+    _index = std::max(_index, other._index);
+    return *this;
+  }
+
+  size_t maxSamples() const { return _samples.size(); }
+  size_t len() const { return _index; }
+  const std::vector<double>& samples() const { return _samples; }
+
+  // (for unpickling)
+  void set(const std::vector<double>& samples, size_t index) {
+    _samples = samples;
+    _index = std::min(index, _samples.size());
+  }
+
+ private:
+  // Replaces each run of three with its median, then zeroes the rest.
+  void decimate() {
+    auto n = _samples.size() / 3;
+    auto s = _samples.data();
+    // (Branch-free min/max rather than a sort of each run.)
+    for (size_t i = 0; i < n; i++) {
+      auto a = s[3 * i];
+      auto b = s[3 * i + 1];
+      auto c = s[3 * i + 2];
+      s[i] = std::max(std::min(a, b), std::min(std::max(a, b), c));
+    }
+    std::fill(_samples.begin() + n, _samples.end(), 0.0);
+    _index = n;
+  }
+
+  std::vector<double> _samples;
+  size_t _index;
+};
@@ -14,11 +14,21 @@
 #include <atomic>
 #include <random>
 
+#include "adaptiverate.hpp"
 #include "common.hpp"
-#include "open_addr_hashtable.hpp"
+#include "controlblock.hpp"
+#include "largeobjects.hpp"
+#include "liveobjects.hpp"
+#include "numpyallocator.hpp"
 #include "printf.h"
+#include "processmemory.hpp"
+#include "pythonallocator.hpp"
 #include "samplefile.hpp"
 #include "sampler.hpp"
+#include "stacktable.hpp"
+#include "stackwalker.hpp"
+#include "stprintf.h"
+#include "timestamp.hpp"
 
 #define USE_ATOMICS 0
 
@@ -35,9 +45,9 @@ class SampleHeap : public SuperHeap {
  public:
   enum { Alignment = SuperHeap::Alignment };
   enum AllocSignal { MallocSignal = SIGXCPU, FreeSignal = SIGXFSZ };
-  enum {
-    CallStackSamplingRate = MallocSamplingRateBytes * 10
-  };  // 10 here just to reduce overhead
+  // Bounds on the (adaptive) sampling interval.
+  static constexpr uint64_t MinSamplingRateBytes = MallocSamplingRateBytes / 16;
+  static constexpr uint64_t MaxSamplingRateBytes = MallocSamplingRateBytes * 64;
 
   SampleHeap()
       : _samplefile((char *)"/tmp/scalene-malloc-signal%d",
@@ -47,7 +57,9 @@ class SampleHeap : public SuperHeap {
         _freeTriggered(0),
         _pythonCount(0),
         _cCount(0),
+        _arrayCount(0),
         _pid(getpid()),
+        _largeThreshold(LargeObjects::DefaultThreshold),
         _lastMallocTrigger(nullptr),
         _freedLastMallocTrigger(false) {
     get_signal_init_lock().lock();
@@ -70,14 +82,7 @@ class SampleHeap : public SuperHeap {
     }
     auto realSize = SuperHeap::getSize(ptr);
     assert(realSize >= sz);
-    auto sampleMalloc = _mallocSampler.sample(realSize);
-    auto sampleCallStack = _callStackSampler.sample(realSize);
-    if (unlikely(sampleCallStack)) {
-      recordCallStack(realSize);
-    }
-    if (unlikely(sampleMalloc)) {
-      handleMalloc(sampleMalloc, ptr);
-    }
+    register_malloc(realSize, ptr);
     return ptr;
   }
 
@@ -86,7 +91,47 @@ class SampleHeap : public SuperHeap {
       return;
     }
     auto realSize = SuperHeap::getSize(ptr);
+    // (Before the memory can be reused, and its address handed out and
+    // registered again by another thread.)
+    register_free(realSize, ptr);
     SuperHeap::free(ptr);
+  }
+
+  // Account for an allocation of realSize bytes at ptr (whether or not
+  // it came from this heap). Large allocations are accounted exactly;
+  // the rest are sampled.
+  ATTRIBUTE_ALWAYS_INLINE inline void register_malloc(size_t realSize,
+                                                      void *ptr) {
+    if (unlikely(realSize >= _largeThreshold) &&
+        handleLargeMalloc(realSize, ptr)) {
+      return;
+    }
+    auto sampleMalloc = _mallocSampler.sample(realSize);
+    // Credit the bytes to Python if they came through one of its
+    // allocators (see pythonallocator.hpp), and to native code if not,
+    // noting NumPy array data (see numpyallocator.hpp) as well.
+    if (PythonAllocator::inPython()) {
+      _pythonCount += realSize;
+    } else {
+      _cCount += realSize;
+      if (NumpyAllocator::inArray()) {
+        _arrayCount += realSize;
+      }
+    }
+    if (unlikely(sampleMalloc)) {
+      handleMalloc(sampleMalloc, ptr);
+    }
+  }
+
+  // Account for the release of realSize bytes at ptr (which must still
+  // be allocated).
+  ATTRIBUTE_ALWAYS_INLINE inline void register_free(size_t realSize,
+                                                    void *ptr) {
+    LiveObjects::getInstance().remove(ptr);
+    if (unlikely(realSize >= LargeObjects::getInstance().minTrackedSize()) &&
+        handleLargeFree(realSize, ptr)) {
+      return;
+    }
     auto sampleFree = _freeSampler.sample(realSize);
     if (unlikely(ptr == _lastMallocTrigger)) {
       _freedLastMallocTrigger = true;
@@ -104,14 +149,7 @@ class SampleHeap : public SuperHeap {
     auto realSize = SuperHeap::getSize(ptr);
     assert(realSize >= sz);
     assert((sz < 16) || (realSize <= 2 * sz));
-    auto sampleMalloc = _mallocSampler.sample(realSize);
-    auto sampleCallStack = _callStackSampler.sample(realSize);
-    if (unlikely(sampleCallStack)) {
-      recordCallStack(realSize);
-    }
-    if (unlikely(sampleMalloc)) {
-      handleMalloc(sampleMalloc, ptr);
-    }
+    register_malloc(realSize, ptr);
     return ptr;
   }
 
@@ -121,7 +159,20 @@ class SampleHeap : public SuperHeap {
   SampleHeap &operator=(const SampleHeap &) = delete;
 
   void handleMalloc(size_t sampleMalloc, void *triggeringMallocPtr) {
-    writeCount(MallocSignal, sampleMalloc, triggeringMallocPtr);
+    auto &control = ControlBlock::getInstance();
+    auto start = AdaptiveRateType::now();
+    if (unlikely(!control.enabled(ControlBlock::Memory))) {
+      _pythonCount = 0;
+      _cCount = 0;
+      _arrayCount = 0;
+      updateRate(control, start, 0);
+      return;
+    }
+    auto stackId = captureStack();
+    writeCount(MallocSignal, sampleMalloc, triggeringMallocPtr, stackId,
+               false);
+    // The triggering object stands for all the bytes this sample credits.
+    LiveObjects::getInstance().add(triggeringMallocPtr, stackId, sampleMalloc);
 
 #if !SCALENE_DISABLE_SIGNALS
     raise(MallocSignal);
@@ -130,11 +181,70 @@ class SampleHeap : public SuperHeap {
     _freedLastMallocTrigger = false;
     _pythonCount = 0;
     _cCount = 0;
+    _arrayCount = 0;
     _mallocTriggered++;
+    updateRate(control, start, AdaptiveRateType::now() - start);
+  }
+
+  // Returns true iff the allocation is now tracked exactly (and so must
+  // not be sampled).
+  bool handleLargeMalloc(size_t realSize, void *ptr) {
+    auto &control = ControlBlock::getInstance();
+    updateLargeThreshold(control);
+    if ((realSize < _largeThreshold) ||
+        unlikely(!control.enabled(ControlBlock::Memory)) ||
+        !LargeObjects::getInstance().add(ptr, realSize)) {
+      return false;
+    }
+    auto stackId = captureStack();
+    writeCount(MallocSignal, realSize, ptr, stackId, true);
+    LiveObjects::getInstance().add(ptr, stackId, realSize);
+#if !SCALENE_DISABLE_SIGNALS
+    raise(MallocSignal);
+#endif
+    _mallocTriggered++;
+    return true;
+  }
+
+  // Returns true iff the release was of an exactly tracked allocation.
+  // (This runs before the memory is released, since large blocks are
+  // often handed right back out at the same address.)
+  bool handleLargeFree(size_t realSize, void *ptr) {
+    auto freed = LargeObjects::getInstance().remove(ptr, realSize);
+    if (freed == 0) {
+      return false;
+    }
+    // Always report it, even if memory profiling was since turned off,
+    // so the footprint stays balanced.
+    writeCount(FreeSignal, freed, ptr, 0, true);
+    _freeTriggered++;
+    return true;
+  }
+
+  void updateLargeThreshold(ControlBlock &control) {
+    auto threshold = control.largeAllocationThreshold();
+    _largeThreshold = threshold ? threshold : LargeObjects::DefaultThreshold;
+  }
+
+  // Pick the sampling interval for this thread's next samples: the one
+  // set in the control block, if any, and otherwise an adaptive one.
+  void updateRate(ControlBlock &control, uint64_t nowNs, uint64_t handlingNs) {
+    updateLargeThreshold(control);
+    auto rate = control.mallocSamplingRate();
+    if (rate == 0) {
+      rate = _adaptiveRate.update(
+          _mallocSampler.lastInterval(), nowNs, handlingNs,
+          control.targetSamplesPerSec(), control.overheadBudgetPpm());
+    }
+    _mallocSampler.setRate(rate);
+    _freeSampler.setRate(rate);
   }
 
   void handleFree(size_t sampleFree) {
-    writeCount(FreeSignal, sampleFree, nullptr);
+    if (unlikely(!ControlBlock::getInstance().enabled(ControlBlock::Memory))) {
+      return;
+    }
+    writeCount(FreeSignal, sampleFree, nullptr, 0, false);
 #if 0  // !SCALENE_DISABLE_SIGNALS
     // Disabled for now.
     raise(FreeSignal);
@@ -142,111 +252,28 @@ class SampleHeap : public SuperHeap {
     _freeTriggered++;
   }
 
+  using AdaptiveRateType =
+      AdaptiveRate<MinSamplingRateBytes, MaxSamplingRateBytes>;
+
   Sampler<MallocSamplingRateBytes> _mallocSampler;
   Sampler<MallocSamplingRateBytes> _freeSampler;
-  Sampler<CallStackSamplingRate> _callStackSampler;
+  AdaptiveRateType _adaptiveRate;
   counterType _mallocTriggered;
   counterType _freeTriggered;
   counterType _pythonCount;
   counterType _cCount;
+  counterType _arrayCount;  // (part of _cCount)
 
-  open_addr_hashtable<65536>
-      _table;  // Maps call stack entries to function names.
   SampleFile _samplefile;
   pid_t _pid;
-  void recordCallStack(size_t sz) {
-    // Walk the stack to see if this memory was allocated by Python
-    // through its object allocation APIs.
-    const auto MAX_FRAMES_TO_CHECK =
-        4;  // enough to skip past the replacement_malloc
-    void *callstack[MAX_FRAMES_TO_CHECK];
-    auto frames = backtrace(callstack, MAX_FRAMES_TO_CHECK);
-    char *fn_name;
-    for (auto i = 0; i < frames; i++) {
-      fn_name = nullptr;
-
-#define USE_HASHTABLE 1
-#if !USE_HASHTABLE
-      auto v = nullptr;
-#else
-      auto v = _table.get(callstack[i]);
-#endif
-      if (v == nullptr) {
-        // Not found. Add to table.
-        Dl_info info;
-        int r = dladdr(callstack[i], &info);
-        if (r) {
-#if !USE_HASHTABLE
-#else
-          _table.put(callstack[i], (void *)info.dli_sname);
-#endif
-          fn_name = (char *)info.dli_sname;
-        } else {
-          continue;
-        }
-      } else {
-        // Found it.
-        fn_name = (char *)v;
-      }
-      if (!fn_name) {
-        continue;
-      }
-      if (strlen(fn_name) < 9) {  // length of PySet_New
-        continue;
-      }
-      // Starts with Py, assume it's Python calling.
-      if (strstr(fn_name, "Py") == &fn_name[0]) {
-        if (strstr(fn_name, "PyArray_")) {
-          // Make sure we're not in NumPy, which irritatingly exports some
-          // functions starting with "Py"...
-          goto C_CODE;
-        }
-#if 0
-	if (strstr(fn_name, "PyEval") || strstr(fn_name, "PyCompile") || strstr(fn_name, "PyImport")) {
-	  // Ignore allocations due to interpreter internal operations, for now.
-	  goto C_CODE;
-	}
-#endif
-        _pythonCount += sz;
-        return;
-      }
-      if (strstr(fn_name, "_Py") == 0) {
-        continue;
-      }
-      if (strstr(fn_name, "_PyCFunction")) {
-        goto C_CODE;
-      }
-#if 1
-      _pythonCount += sz;
-      return;
-#else
-      // TBD: realloc requires special handling.
-      // * _PyObject_Realloc
-      // * _PyMem_Realloc
-      if (strstr(fn_name, "New")) {
-        _pythonCount += sz;
-        return;
-      }
-      if (strstr(fn_name, "_PyObject_")) {
-        if ((strstr(fn_name, "GC_Alloc")) || (strstr(fn_name, "GC_New")) ||
-            (strstr(fn_name, "GC_NewVar")) || (strstr(fn_name, "GC_Resize")) ||
-            (strstr(fn_name, "Malloc")) || (strstr(fn_name, "Calloc"))) {
-          _pythonCount += sz;
-          return;
-        }
-      }
-      if (strstr(fn_name, "_PyMem_")) {
-        if ((strstr(fn_name, "Malloc")) || (strstr(fn_name, "Calloc")) ||
-            (strstr(fn_name, "RawMalloc")) || (strstr(fn_name, "RawCalloc"))) {
-          _pythonCount += sz;
-          return;
-        }
-      }
-#endif
-    }
-
-  C_CODE:
-    _cCount += sz;
+  uint64_t _largeThreshold;  // refreshed from the control block
+  Timestamp _timestamp;
+  // Interns the native stack of the sampled allocation (without our own
+  // frames), returning its id in the stack table.
+  uint32_t captureStack() {
+    void *frames[StackTable::MaxFrames];
+    auto n = StackWalker::walk(frames, StackTable::MaxFrames);
+    return StackTable::getInstance().intern(frames, n);
   }
 
   void *_lastMallocTrigger;
@@ -255,24 +282,42 @@ class SampleHeap : public SuperHeap {
   static constexpr auto flags = O_RDWR | O_CREAT;
   static constexpr auto perms = S_IRUSR | S_IWUSR;
 
-  void writeCount(AllocSignal sig, uint64_t count, void *ptr) {
+  // Exact records (of large objects) are marked 'L' and 'l'.
+  void writeCount(AllocSignal sig, uint64_t count, void *ptr,
+                  uint32_t stackId, bool exact) {
     char buf[SampleFile::MAX_BUFSIZE];
-    if (_pythonCount == 0) {
-      _pythonCount = 1;  // prevent 0/0
+    // The shares of Python and of NumPy array data in the bytes this
+    // record stands for: of those allocated since the last sample, or
+    // (for an exact record) of this very allocation.
+    float pythonFraction, arrayFraction;
+    if (exact) {
+      pythonFraction = PythonAllocator::inPython();
+      arrayFraction = NumpyAllocator::inArray();
+    } else {
+      if (_pythonCount == 0) {
+        _pythonCount = 1;  // prevent 0/0
+      }
+      pythonFraction = (float)_pythonCount / (_pythonCount + _cCount);
+      arrayFraction = (float)_arrayCount / (_pythonCount + _cCount);
     }
-    snprintf(
+    auto memory = ProcessMemory::getInstance().get();
+    stprintf::format(
         buf, SampleFile::MAX_BUFSIZE,
-#if defined(__APPLE__)
-        "%c,%llu,%llu,%f,%d,%p\n\n",
-#else
-        "%c,%lu,%lu,%f,%d,%p\n\n",
-#endif
-        ((sig == MallocSignal) ? 'M' : ((_freedLastMallocTrigger) ? 'f' : 'F')),
-        _mallocTriggered + _freeTriggered, count,
-        (float)_pythonCount / (_pythonCount + _cCount), getpid(),
-        _freedLastMallocTrigger ? _lastMallocTrigger : ptr);
-    // Ensure we don't report last-malloc-freed multiple times.
-    _freedLastMallocTrigger = false;
+        STPRINTF_FORMAT("%c,%lu,%lu,%f,%d,%p,%lu,%lu,%lu,%lu,%u,%lu,%f\n\n"),
+        (sig == MallocSignal)
+            ? (exact ? 'L' : 'M')
+            : (exact ? 'l' : ((_freedLastMallocTrigger) ? 'f' : 'F')),
+        _mallocTriggered + _freeTriggered, count, pythonFraction, getpid(),
+        (_freedLastMallocTrigger && !exact) ? _lastMallocTrigger : ptr,
+        memory.rssBytes, memory.minorFaults, memory.majorFaults,
+        exact ? count
+              : ((sig == MallocSignal) ? _mallocSampler.lastInterval()
+                                       : _freeSampler.lastInterval()),
+        stackId, _timestamp.nowNs(), arrayFraction);
+    if (!exact) {
+      // Ensure we don't report last-malloc-freed multiple times.
+      _freedLastMallocTrigger = false;
+    }
     _samplefile.writeToFile(buf, 1);
   }
 
@@ -13,46 +13,82 @@
 #define SAMPLER_DETERMINISTIC 1
 #define SAMPLER_LOWDISCREPANCY 0
 
+#include <assert.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <time.h>
 #include <unistd.h>
 
-#if SAMPLER_LOWDISCREPANCY
 #include "lowdiscrepancy.hpp"
-#endif
 
-template <uint64_t SAMPLE_RATE>
-class Sampler {
- private:
-  static constexpr double SAMPLE_PROBABILITY =
-      (double)1.0 / (double)SAMPLE_RATE;
+// Policies for choosing the interval until the next sample, given the
+// mean interval (the rate): Sampler's second template argument. See
+// src/source/sampler-eval.cpp for a comparison of their accuracy and
+// cost.
 
-  uint64_t _lastSampleSize;
-  uint64_t _next;
-#if !SAMPLER_DETERMINISTIC
-#if !SAMPLER_LOWDISCREPANCY
-  std::mt19937_64 rng{1234567890UL + (uint64_t)getpid() + (uint64_t)this +
-                      (uint64_t)pthread_self()};
-#else
-  LowDiscrepancy rng{1234567890UL + (uint64_t)getpid() + (uint64_t)this +
-                     (uint64_t)pthread_self()};
-#endif
-  std::geometric_distribution<uint64_t> geom{SAMPLE_PROBABILITY};
-#endif
+// Always exactly the rate.
+class DeterministicIntervals {
+ public:
+  explicit DeterministicIntervals(uint64_t) {}
+  inline void setRate(uint64_t) {}
+  inline uint64_t next(uint64_t rate) { return rate; }
+};
 
+// Geometrically distributed (never 0), drawing from Generator.
+template <class Generator>
+class GeometricIntervals {
  public:
-  Sampler() {
-#if !SAMPLER_DETERMINISTIC
+  explicit GeometricIntervals(uint64_t seed) : _rng(seed) {}
+
+  inline void setRate(uint64_t rate) {
+    _geom = std::geometric_distribution<uint64_t>((double)1.0 / (double)rate);
+  }
+
+  inline uint64_t next(uint64_t) {
     while (true) {
-      _next = geom(rng);
-      if (_next != 0) {
-        break;
+      auto n = _geom(_rng);
+      if (n != 0) {
+        return n;
       }
     }
+  }
+
+ private:
+  Generator _rng;
+  std::geometric_distribution<uint64_t> _geom;
+};
+
+#if SAMPLER_DETERMINISTIC
+typedef DeterministicIntervals DefaultSamplerIntervals;
+#elif SAMPLER_LOWDISCREPANCY
+typedef GeometricIntervals<LowDiscrepancy> DefaultSamplerIntervals;
 #else
-    _next = SAMPLE_RATE;
+typedef GeometricIntervals<std::mt19937_64> DefaultSamplerIntervals;
 #endif
+
+template <uint64_t SAMPLE_RATE, class Intervals = DefaultSamplerIntervals>
+class Sampler {
+ private:
+  uint64_t _lastSampleSize;
+  uint64_t _next;
+  uint64_t _rate;          // the mean sampling interval (normally SAMPLE_RATE)
+  uint64_t _intervalRate;  // the rate in effect for the current interval
+  uint64_t _lastInterval;  // the rate in effect for the last completed one
+  Intervals _intervals;
+
+ public:
+  Sampler()
+      : Sampler(1234567890UL + (uint64_t)getpid() + (uint64_t)this +
+                (uint64_t)pthread_self()) {}
+
+  // (For randomized policies, seed determines the intervals.)
+  explicit Sampler(uint64_t seed)
+      : _rate(SAMPLE_RATE),
+        _intervalRate(SAMPLE_RATE),
+        _lastInterval(SAMPLE_RATE),
+        _intervals(seed) {
+    _intervals.setRate(SAMPLE_RATE);
+    _next = _intervals.next(SAMPLE_RATE);
     _lastSampleSize = _next;
   }
 
@@ -65,20 +101,29 @@ class Sampler {
     return 0;
   }
 
-  uint64_t updateSample(uint64_t sz) {
-#if SAMPLER_DETERMINISTIC
-    _next = SAMPLE_RATE;
-#else
-    while (true) {
-      _next = geom(rng);
-      if (_next != 0) {
-        break;
-      }
+  // Change the sampling rate (0 restores SAMPLE_RATE). The change takes
+  // effect from the next sampling interval.
+  void setRate(uint64_t rate) {
+    if (rate == 0) {
+      rate = SAMPLE_RATE;
     }
-#endif
+    if (likely(rate == _rate)) {
+      return;
+    }
+    _rate = rate;
+    _intervals.setRate(rate);
+  }
+
+  // The sampling interval that ended with the last sample.
+  uint64_t lastInterval() const { return _lastInterval; }
+
+  uint64_t updateSample(uint64_t sz) {
+    _lastInterval = _intervalRate;
+    _intervalRate = _rate;
+    _next = _intervals.next(_rate);
     auto prevSampleSize = _lastSampleSize;
     _lastSampleSize = _next;
-    return sz + SAMPLE_RATE;
+    return sz + _lastInterval;
     // previously:
     // return sz + prevSampleSize;
   }
@@ -0,0 +1,236 @@
+#pragma once
+#ifndef STACKTABLE_HPP
+#define STACKTABLE_HPP
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <new>
+
+#include "common.hpp"
+#include "printf.h"
+
+// An append-only table of native stack traces, interned by content and
+// shared with the Python side through a file mapping
+// (/tmp/scalene-stacks<pid>; see ScaleneNative.read_stack, which must
+// match this layout). Samples carry a 32-bit stack id (0 for none)
+// instead of the frames themselves.
+//
+// Insertion takes no locks: a writer claims an empty slot by CAS on its
+// hash, fills in the frames, and then publishes the slot by setting
+// its ready flag (with release semantics). A writer that finds a
+// matching slot claimed but not yet ready waits (briefly) for it to be
+// filled, and otherwise moves on, since its writer may never finish
+// (if it was interrupted by a signal handler on the same thread, or
+// died, or did not survive a fork). Entries are never moved or
+// removed, so once a reader sees an entry ready, it stays valid. When
+// a probe sequence runs too long (the table is nearly full), the stack
+// is simply not recorded.
+//
+// A forked child gets a table (and file) of its own, starting with a
+// copy of its parent's entries, so that ids stay valid (see
+// afterFork). The file is removed on exit, if the Python side (which
+// removes it once mapped) never got to it.
+
+class StackTable {
+ public:
+  enum { MaxFrames = 16 };
+  enum : uint32_t { Magic = 0x4b545353 };
+
+  struct Header {
+    uint32_t magic;
+    uint32_t capacity;
+    uint32_t maxFrames;
+    uint32_t entrySize;
+  };
+
+  struct Entry {
+    std::atomic<uint64_t> hash;  // 0 if the slot is empty
+    std::atomic<uint32_t> ready;
+    uint32_t depth;
+    uint64_t frames[MaxFrames];  // leaf first
+  };
+
+  static StackTable &getInstance() {
+    alignas(StackTable) static char buf[sizeof(StackTable)];
+    static auto *st = new (buf) StackTable;
+    return *st;
+  }
+
+  // Call in the child after a fork.
+  static void afterFork() {
+    if (file().pid != 0) {
+      getInstance().moveToChild();
+    }
+  }
+
+  // Call on exit.
+  static void removeFile() {
+    auto &f = file();
+    if (f.pid == getpid()) {
+      unlink(f.name);
+      f.pid = 0;
+    }
+  }
+
+  // Returns the id of this stack (interning it if needed), or 0 if it
+  // could not be recorded.
+  uint32_t intern(void **frames, int depth) {
+    if ((_entries == nullptr) || (depth <= 0)) {
+      return 0;
+    }
+    if (depth > MaxFrames) {
+      depth = MaxFrames;
+    }
+    auto h = hash(frames, depth);
+    auto index = h & (Capacity - 1);
+    for (int probes = 0; probes < MaxProbes; probes++) {
+      auto &entry = _entries[index];
+      auto current = entry.hash.load(std::memory_order_acquire);
+      if (current == 0) {
+        if (entry.hash.compare_exchange_strong(current, h,
+                                               std::memory_order_acq_rel)) {
+          entry.depth = depth;
+          for (int i = 0; i < depth; i++) {
+            entry.frames[i] = (uint64_t)frames[i];
+          }
+          entry.ready.store(1, std::memory_order_release);
+          return index + 1;
+        }
+        // Lost the race; current now holds the winner's hash.
+      }
+      if ((current == h) && matches(entry, frames, depth)) {
+        return index + 1;
+      }
+      index = (index + 1) & (Capacity - 1);
+    }
+    return 0;
+  }
+
+ private:
+  static constexpr uint32_t Capacity = 1 << 16;  // must be a power of two
+  static constexpr int MaxProbes = 64;
+
+  static constexpr int MaxReadySpins = 1 << 12;
+
+  struct File {
+    pid_t pid;  // that created it (0 if none)
+    char name[64];
+  };
+
+  static File &file() {
+    static File f;
+    return f;
+  }
+
+  static constexpr size_t mappingSize() {
+    return sizeof(Header) + Capacity * sizeof(Entry);
+  }
+
+  StackTable() : _entries(create()) {}
+
+  // Creates this process's table file and maps it.
+  // @return the entries, or nullptr on failure.
+  static Entry *create() {
+    auto &f = file();
+    f.pid = getpid();
+    snprintf(f.name, sizeof(f.name), "/tmp/scalene-stacks%d", f.pid);
+    // Never reuse an existing file (which could have been planted by
+    // another user), though a stale one of ours is replaced.
+    const auto flags = O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC;
+    auto fd = open(f.name, flags, S_IRUSR | S_IWUSR);
+    if ((fd == -1) && (errno == EEXIST) && (unlink(f.name) == 0)) {
+      fd = open(f.name, flags, S_IRUSR | S_IWUSR);
+    }
+    if (fd == -1) {
+      f.pid = 0;
+      return nullptr;
+    }
+    Entry *entries = nullptr;
+    // The file stays sparse: untouched entries cost nothing.
+    if (ftruncate(fd, mappingSize()) == 0) {
+      auto p = mmap(nullptr, mappingSize(), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+      if (p != MAP_FAILED) {
+        auto header = reinterpret_cast<Header *>(p);
+        header->capacity = Capacity;
+        header->maxFrames = MaxFrames;
+        header->entrySize = sizeof(Entry);
+        std::atomic_thread_fence(std::memory_order_release);
+        header->magic = Magic;
+        entries = reinterpret_cast<Entry *>(header + 1);
+      }
+    }
+    close(fd);
+    return entries;
+  }
+
+  // Stops sharing the parent's table (whose file the child's Python
+  // would not find), copying its published entries into a new one.
+  void moveToChild() {
+    auto parent = _entries;
+    _entries = create();
+    if (parent == nullptr) {
+      return;
+    }
+    if (_entries != nullptr) {
+      for (uint32_t i = 0; i < Capacity; i++) {
+        auto &from = parent[i];
+        if (!from.ready.load(std::memory_order_acquire)) {
+          continue;
+        }
+        auto &to = _entries[i];
+        to.depth = from.depth;
+        memcpy(to.frames, from.frames, sizeof(to.frames));
+        to.hash.store(from.hash.load(std::memory_order_relaxed),
+                      std::memory_order_relaxed);
+        to.ready.store(1, std::memory_order_release);
+      }
+    }
+    munmap(reinterpret_cast<Header *>(parent) - 1, mappingSize());
+  }
+
+  // Waits (a little) for a just-claimed entry to be published before
+  // comparing; if it is not, treats it as a mismatch.
+  static bool matches(Entry &entry, void **frames, int depth) {
+    int spins = 0;
+    while (!entry.ready.load(std::memory_order_acquire)) {
+      if (++spins == MaxReadySpins) {
+        return false;
+      }
+    }
+    if (entry.depth != (uint32_t)depth) {
+      return false;
+    }
+    for (int i = 0; i < depth; i++) {
+      if (entry.frames[i] != (uint64_t)frames[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Never 0 (which marks empty slots).
+  static uint64_t hash(void **frames, int depth) {
+    uint64_t h = 14695981039346656037ULL;
+    for (int i = 0; i < depth; i++) {
+      h ^= (uint64_t)frames[i];
+      h *= 1099511628211ULL;
+      h ^= h >> 29;
+    }
+    return h | 1;
+  }
+
+  static_assert(sizeof(Header) % alignof(Entry) == 0,
+                "entries must be aligned");
+
+  Entry *_entries;
+};
+
+#endif
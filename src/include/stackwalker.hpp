@@ -0,0 +1,164 @@
+#pragma once
+#ifndef STACKWALKER_HPP
+#define STACKWALKER_HPP
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__APPLE__)
+#include <mach-o/loader.h>
+#else
+#include <link.h>
+#endif
+
+#include "common.hpp"
+
+#if !defined(__APPLE__)
+extern "C" void *__libc_stack_end;  // (glibc's: the main thread's stack)
+#endif
+
+// Collects the return addresses on the current thread's stack by
+// following its chain of frame pointers: a couple of loads per frame,
+// with no locks and no unwind tables, unlike backtrace(), which is far
+// too slow for the allocation path. (Symbolizing them is left to the
+// reader; see ScaleneNative.describe_stack.)
+//
+// Frames of code built without frame pointers are missed, and the walk
+// stops at the first link that does not look like one (misaligned, not
+// moving up the stack, or outside the thread's stack), so it never
+// reads outside the stack. libscalene itself is built with
+// -fno-omit-frame-pointer, and its own frames are left out.
+
+class StackWalker {
+ public:
+  // Stores up to max return addresses (innermost first) in frames.
+  // @return how many.
+  ATTRIBUTE_NEVER_INLINE static int walk(void **frames, int max) {
+    auto top = stackTop();
+    auto fp = reinterpret_cast<void **>(__builtin_frame_address(0));
+    auto low = reinterpret_cast<uintptr_t>(fp);
+    auto &own = ownCode();
+    auto skipping = true;
+    int n = 0;
+    while (n < max) {
+      auto p = reinterpret_cast<uintptr_t>(fp);
+      if ((p & (alignof(void *) - 1)) || (p < low) ||
+          (p + 2 * sizeof(void *) > top)) {
+        break;
+      }
+      auto ret = reinterpret_cast<uintptr_t>(fp[1]);
+      if (ret == 0) {
+        break;
+      }
+      // Leave out our own frames (all innermost).
+      skipping = skipping && (own.start <= ret) && (ret < own.end);
+      if (!skipping) {
+        frames[n++] = fp[1];
+      }
+      low = p + 2 * sizeof(void *);
+      fp = reinterpret_cast<void **>(fp[0]);
+    }
+    return n;
+  }
+
+ private:
+  struct Range {
+    uintptr_t start;
+    uintptr_t end;
+  };
+
+  // The top of the current thread's stack, or 0 (so nothing is walked)
+  // if unknown.
+  static uintptr_t stackTop() {
+    static __thread uintptr_t top __attribute__((tls_model("initial-exec"))) =
+        0;
+    static __thread bool busy __attribute__((tls_model("initial-exec"))) =
+        false;
+    // (Finding it may allocate, so walks from within give up.)
+    if (unlikely(top == 0) && !busy) {
+      busy = true;
+      top = findStackTop();
+      busy = false;
+    }
+    return top;
+  }
+
+  static uintptr_t findStackTop() {
+#if defined(__APPLE__)
+    return reinterpret_cast<uintptr_t>(
+        pthread_get_stackaddr_np(pthread_self()));
+#else
+    if (getpid() == (pid_t)syscall(SYS_gettid)) {
+      // (pthread_getattr_np would read /proc/self/maps.)
+      return reinterpret_cast<uintptr_t>(__libc_stack_end);
+    }
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+      return 0;
+    }
+    void *stack = nullptr;
+    size_t size = 0;
+    pthread_attr_getstack(&attr, &stack, &size);
+    pthread_attr_destroy(&attr);
+    return reinterpret_cast<uintptr_t>(stack) + size;
+#endif
+  }
+
+  // The addresses of libscalene's code (found once).
+  static const Range &ownCode() {
+    static Range range = findOwnCode();
+    return range;
+  }
+
+  static Range findOwnCode() {
+    Range range = {0, 0};
+    Dl_info info;
+    if (!dladdr(reinterpret_cast<void *>(&findOwnCode), &info)) {
+      return range;
+    }
+    auto base = reinterpret_cast<uintptr_t>(info.dli_fbase);
+#if defined(__APPLE__)
+    // The image's __TEXT segment starts with its header.
+    auto header = reinterpret_cast<const mach_header_64 *>(base);
+    auto command = reinterpret_cast<const load_command *>(header + 1);
+    for (uint32_t i = 0; i < header->ncmds; i++) {
+      if (command->cmd == LC_SEGMENT_64) {
+        auto segment = reinterpret_cast<const segment_command_64 *>(command);
+        if (strcmp(segment->segname, "__TEXT") == 0) {
+          range = {base, base + segment->vmsize};
+          break;
+        }
+      }
+      command = reinterpret_cast<const load_command *>(
+          reinterpret_cast<const char *>(command) + command->cmdsize);
+    }
+#else
+    range.start = base;
+    dl_iterate_phdr(
+        [](struct dl_phdr_info *object, size_t, void *data) {
+          auto r = reinterpret_cast<Range *>(data);
+          if (object->dlpi_addr != r->start) {
+            return 0;
+          }
+          for (int i = 0; i < object->dlpi_phnum; i++) {
+            auto &segment = object->dlpi_phdr[i];
+            if ((segment.p_type == PT_LOAD) && (segment.p_flags & PF_X)) {
+              auto end = object->dlpi_addr + segment.p_vaddr + segment.p_memsz;
+              if (end > r->end) {
+                r->end = end;
+              }
+            }
+          }
+          return 1;
+        },
+        &range);
+#endif
+    return range;
+  }
+};
+
+#endif
@@ -5,10 +5,12 @@
 
 // Written by Emery Berger
 
+#include <stddef.h>
 #include <string.h>
 
 #include <cmath>
 #include <cstdint>
+#include <type_traits>
 
 using namespace std;
 
@@ -98,11 +100,11 @@ inline int writeval(char *buf, float n, size_t sz) {
 
 inline int writeval(char *buf, const char *str, size_t sz) {
   //    cout << "len = " << len << ", str = " << str << endl;
-  int i = 0;
+  size_t i = 0;
   for (; i < sz && str[i] != '\0'; i++) {
     buf[i] = str[i];
   }
-  return i;
+  return (int)i;
 }
 
 inline int writeval(char *buf, const char c, size_t sz) {
@@ -169,6 +171,350 @@ inline void stprintf(char *buf, const char *format, size_t sz, T value,
   }
 }
 
+
+// Compile-time formats: stprintf::format works like snprintf, but its
+// format is parsed by the compiler into a fixed sequence of literal
+// copies and conversions, checked against the arguments' number and
+// types. It neither allocates, locks, nor touches errno or the locale,
+// so it is safe to use in signal handlers and inside malloc.
+//
+//   stprintf::format(buf, sizeof(buf), STPRINTF_FORMAT("%lu,%p\n"), n, p);
+//
+// Conversions: %d %i %u (decimal), %x (hex), %p (a pointer, as mpaland's
+// printf prints it: 2 * sizeof(void *) uppercase hex digits), %c, %s,
+// %f and %.Nf (fixed point, N <= 9, default 6), and %%. Length
+// modifiers (h, l, ll, z, j, t) are accepted and ignored: the width
+// comes from the argument's type. Returns the number of characters
+// written (truncating at sz - 1), not counting the terminating NUL.
+
+#define STPRINTF_FORMAT(str)                                  \
+  [] {                                                        \
+    struct Format {                                           \
+      static constexpr const char *get() { return (str); }    \
+    };                                                        \
+    return Format();                                          \
+  }()
+
+namespace format_detail {
+
+enum Kind { End, Percent, Value, Invalid };
+
+struct Spec {
+  Kind kind;
+  char conversion;
+  int precision;
+  size_t next;  // the position after the spec
+};
+
+constexpr size_t literalEnd(const char *f, size_t i) {
+  while (f[i] && (f[i] != '%')) {
+    i++;
+  }
+  return i;
+}
+
+constexpr bool isConversion(char c) {
+  return (c == 'd') || (c == 'i') || (c == 'u') || (c == 'x') || (c == 'p') ||
+         (c == 'c') || (c == 's') || (c == 'f');
+}
+
+// Parses the spec at i (the end of a literal run).
+constexpr Spec parseSpec(const char *f, size_t i) {
+  if (!f[i]) {
+    return {End, 0, 0, i};
+  }
+  i++;  // the %
+  if (f[i] == '%') {
+    return {Percent, '%', 0, i + 1};
+  }
+  int precision = -1;
+  if (f[i] == '.') {
+    precision = 0;
+    for (i++; (f[i] >= '0') && (f[i] <= '9'); i++) {
+      precision = precision * 10 + (f[i] - '0');
+    }
+  }
+  while ((f[i] == 'h') || (f[i] == 'l') || (f[i] == 'z') || (f[i] == 'j') ||
+         (f[i] == 't')) {
+    i++;
+  }
+  if (!isConversion(f[i]) || ((precision >= 0) && (f[i] != 'f')) ||
+      (precision > 9)) {
+    return {Invalid, f[i], 0, i};
+  }
+  return {Value, f[i], (precision < 0) ? 6 : precision, i + 1};
+}
+
+// All of the writers below stop at end (leaving room for the NUL).
+
+inline char *put(char *p, char *end, char c) {
+  if (p < end) {
+    *p++ = c;
+  }
+  return p;
+}
+
+// (Literal runs have constant lengths, so this is inlined: no call to
+// the memcpy that libscalene interposes on.)
+inline char *copy(char *p, char *end, const char *s, size_t n) {
+  if ((size_t)(end - p) >= n) {
+    __builtin_memcpy(p, s, n);
+    return p + n;
+  }
+  while ((p < end) && n--) {
+    *p++ = *s++;
+  }
+  return p;
+}
+
+// Digits are written in place, back to front (falling back to a copy
+// when they would be truncated).
+
+inline int decimalDigits(uint64_t n) {
+  int digits = 1;
+  for (uint64_t limit = 10; n >= limit; limit *= 10) {
+    if (++digits == 20) {
+      break;
+    }
+  }
+  return digits;
+}
+
+inline char *writeDecimal(char *p, char *end, uint64_t n) {
+  static constexpr char digitPairs[] =
+      "00010203040506070809101112131415161718192021222324252627282930313233"
+      "34353637383940414243444546474849505152535455565758596061626364656667"
+      "6869707172737475767778798081828384858687888990919293949596979899";
+  auto digits = decimalDigits(n);
+  char spill[20];
+  auto out = (end - p >= digits) ? p : spill;
+  auto q = out + digits;
+  while (n >= 100) {
+    auto pair = &digitPairs[(n % 100) * 2];
+    n /= 100;
+    *--q = pair[1];
+    *--q = pair[0];
+  }
+  if (n >= 10) {
+    *--q = digitPairs[n * 2 + 1];
+    *--q = digitPairs[n * 2];
+  } else {
+    *--q = '0' + n;
+  }
+  return (out == p) ? p + digits : copy(p, end, spill, digits);
+}
+
+inline char *writeHex(char *p, char *end, uint64_t n, int minDigits,
+                      const char *hexDigits) {
+  int digits = (64 - __builtin_clzll(n | 1) + 3) / 4;
+  digits = (digits < minDigits) ? minDigits : digits;
+  char spill[16];
+  auto out = (end - p >= digits) ? p : spill;
+  for (auto q = out + digits; q > out; n >>= 4) {
+    *--q = hexDigits[n & 0xf];
+  }
+  return (out == p) ? p + digits : copy(p, end, spill, digits);
+}
+
+inline char *writeFixed(char *p, char *end, double v, int precision) {
+  static constexpr uint64_t powersOf10[] = {
+      1,      10,      100,      1000,      10000,
+      100000, 1000000, 10000000, 100000000, 1000000000};
+  if (v != v) {
+    return copy(p, end, "nan", 3);
+  }
+  if (__builtin_signbit(v)) {
+    p = put(p, end, '-');
+    v = -v;
+  }
+  if (v > 1.8e19) {
+    // Beyond a uint64_t: print the leading digits and pad with zeros.
+    if (__builtin_isinf(v)) {
+      return copy(p, end, "inf", 3);
+    }
+    int zeros = 0;
+    for (; v > 1.8e19; zeros++) {
+      v /= 10;
+    }
+    p = writeDecimal(p, end, (uint64_t)v);
+    while (zeros--) {
+      p = put(p, end, '0');
+    }
+    if (precision) {
+      p = put(p, end, '.');
+    }
+    while (precision--) {
+      p = put(p, end, '0');
+    }
+    return p;
+  }
+  auto integer = (uint64_t)v;
+  auto scale = powersOf10[precision];
+  auto unscaled = v - (double)integer;
+  auto scaled = unscaled * scale;
+  auto fraction = (uint64_t)scaled;
+  // Round to nearest, ties to even (as printf does). An apparent tie may
+  // be the product's rounding error, which fma recovers exactly.
+  auto rest = scaled - (double)fraction;
+  if (rest == 0.5) {
+    auto error = __builtin_fma(unscaled, (double)scale, -scaled);
+    rest += (error > 0) ? 0.25 : ((error < 0) ? -0.25 : 0);
+  }
+  if ((rest > 0.5) ||
+      ((rest == 0.5) && ((precision ? fraction : integer) & 1))) {
+    fraction++;
+  }
+  if (fraction >= scale) {
+    // Rounded up into the next integer.
+    integer++;
+    fraction -= scale;
+  }
+  p = writeDecimal(p, end, integer);
+  if (precision) {
+    p = put(p, end, '.');
+    // The fraction, with its leading zeros.
+    for (auto d = scale / 10; (d > 1) && (fraction < d); d /= 10) {
+      p = put(p, end, '0');
+    }
+    p = writeDecimal(p, end, fraction);
+  }
+  return p;
+}
+
+// The value in the unsigned type of its own width (so that, as with
+// printf, %x of a negative int prints 32 bits, not 64).
+template <class T>
+inline uint64_t asUnsigned(T value) {
+  return (uint64_t)(typename std::make_unsigned<T>::type)value;
+}
+
+inline uint64_t asUnsigned(bool value) { return value; }
+
+// The conversions, chosen by the conversion character.
+template <char Conversion, int Precision>
+struct Convert {
+  template <class T>
+  static char *write(char *p, char *end, T value) {
+    static_assert(std::is_integral<T>::value || std::is_enum<T>::value,
+                  "%d, %i, %u, and %x need an integer");
+    if (Conversion == 'x') {
+      return writeHex(p, end, asUnsigned(value), 1, "0123456789abcdef");
+    }
+    if (std::is_signed<T>::value && ((int64_t)value < 0)) {
+      p = put(p, end, '-');
+      return writeDecimal(p, end, -(uint64_t)(int64_t)value);
+    }
+    return writeDecimal(p, end, (uint64_t)value);
+  }
+};
+
+template <int Precision>
+struct Convert<'p', Precision> {
+  template <class T>
+  static char *write(char *p, char *end, T value) {
+    static_assert(std::is_pointer<T>::value ||
+                      std::is_same<T, std::nullptr_t>::value,
+                  "%p needs a pointer");
+    return writeHex(p, end, (uintptr_t)value, 2 * sizeof(void *),
+                    "0123456789ABCDEF");
+  }
+};
+
+template <int Precision>
+struct Convert<'c', Precision> {
+  template <class T>
+  static char *write(char *p, char *end, T value) {
+    static_assert(std::is_integral<T>::value, "%c needs a character");
+    return put(p, end, (char)value);
+  }
+};
+
+template <int Precision>
+struct Convert<'s', Precision> {
+  static char *write(char *p, char *end, const char *value) {
+    if (value == nullptr) {
+      value = "(null)";
+    }
+    while ((p < end) && *value) {
+      *p++ = *value++;
+    }
+    return p;
+  }
+};
+
+template <int Precision>
+struct Convert<'f', Precision> {
+  template <class T>
+  static char *write(char *p, char *end, T value) {
+    static_assert(std::is_arithmetic<T>::value, "%f needs a number");
+    return writeFixed(p, end, (double)value, Precision);
+  }
+};
+
+// Writes the format from Pos on: its literal run, then its next spec.
+template <class Format, size_t Pos>
+struct Step {
+  static constexpr size_t LiteralEnd = literalEnd(Format::get(), Pos);
+  static constexpr Kind SpecKind = parseSpec(Format::get(), LiteralEnd).kind;
+  static constexpr char Conversion =
+      parseSpec(Format::get(), LiteralEnd).conversion;
+  static constexpr int Precision =
+      parseSpec(Format::get(), LiteralEnd).precision;
+  static constexpr size_t Next = parseSpec(Format::get(), LiteralEnd).next;
+  static_assert(SpecKind != Invalid, "unsupported conversion in format");
+
+  using Tag = std::integral_constant<Kind, SpecKind>;
+
+  template <class... Args>
+  static char *write(char *p, char *end, Args... args) {
+    p = copy(p, end, Format::get() + Pos, LiteralEnd - Pos);
+    return spec(p, end, Tag(), args...);
+  }
+
+ private:
+  template <class... Args>
+  static char *spec(char *p, char *, std::integral_constant<Kind, End>,
+                    Args...) {
+    static_assert(sizeof...(Args) == 0, "more arguments than conversions");
+    return p;
+  }
+
+  template <class... Args>
+  static char *spec(char *p, char *end,
+                    std::integral_constant<Kind, Percent>, Args... args) {
+    p = put(p, end, '%');
+    return Step<Format, Next>::write(p, end, args...);
+  }
+
+  template <class... Args>
+  static char *spec(char *p, char *end, std::integral_constant<Kind, Value>,
+                    Args... args) {
+    static_assert(sizeof...(Args) > 0, "fewer arguments than conversions");
+    return value(p, end, args...);
+  }
+
+  template <class T, class... Args>
+  static char *value(char *p, char *end, T v, Args... args) {
+    p = Convert<Conversion, Precision>::write(p, end, v);
+    return Step<Format, Next>::write(p, end, args...);
+  }
+
+  static char *value(char *p, char *) { return p; }
+};
+
+}  // namespace format_detail
+
+template <class Format, typename... Targs>
+inline int format(char *buf, size_t sz, Format, Targs... Fargs) {
+  if (sz == 0) {
+    return 0;
+  }
+  auto end = format_detail::Step<Format, 0>::write(buf, buf + sz - 1,
+                                                     Fargs...);
+  *end = '\0';
+  return (int)(end - buf);
+}
+
 }  // namespace stprintf
 
 #endif
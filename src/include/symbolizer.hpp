@@ -0,0 +1,113 @@
+#pragma once
+#ifndef SYMBOLIZER_HPP
+#define SYMBOLIZER_HPP
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <heaplayers.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "printf.h"
+
+// Maps code addresses to (function, shared object) names, caching the
+// results of dladdr. Shared by every thread (and by every user of
+// symbols in libscalene), so an address is usually only looked up once.
+// The cache is direct-mapped: a new address replaces whatever shared its
+// slot, so it never fills up. dladdr itself runs outside of the lock.
+// Not async-signal-safe: call it outside of signal handlers.
+
+class Symbolizer {
+ public:
+  struct Symbol {
+    const char *function;  // may be nullptr
+    const char *object;    // may be nullptr
+    void *start;           // address of the function
+  };
+
+  static Symbolizer &getInstance() {
+    alignas(Symbolizer) static char buf[sizeof(Symbolizer)];
+    static auto *symbolizer = new (buf) Symbolizer;
+    return *symbolizer;
+  }
+
+  // Stores the symbol for addr in sym.
+  // Returns false if the address could not be resolved.
+  bool lookup(void *addr, Symbol &sym) {
+    auto &entry = _entries[slot(addr)];
+    _lock.lock();
+    auto found = (entry.addr == addr);
+    if (found) {
+      sym = entry.symbol;
+    }
+    _lock.unlock();
+    if (found) {
+      return true;
+    }
+    Dl_info info;
+    if (!dladdr(addr, &info)) {
+      return false;
+    }
+    sym.function = info.dli_sname;
+    sym.object = info.dli_fname;
+    sym.start = info.dli_saddr;
+    _lock.lock();
+    entry.addr = addr;
+    entry.symbol = sym;
+    _lock.unlock();
+    return true;
+  }
+
+  // Writes "function (object)" into buf, demangling C++ names.
+  // Returns false if the address could not be resolved.
+  bool describe(void *addr, char *buf, size_t len) {
+    Symbol sym;
+    if ((len == 0) || !lookup(addr, sym)) {
+      return false;
+    }
+    const char *object = "?";
+    if (sym.object) {
+      // Just the basename of the shared object.
+      object = strrchr(sym.object, '/');
+      object = object ? object + 1 : sym.object;
+    }
+    int status = -1;
+    char *demangled = nullptr;
+    if (sym.function && (strncmp(sym.function, "_Z", 2) == 0)) {
+      demangled = abi::__cxa_demangle(sym.function, nullptr, nullptr, &status);
+    }
+    if (demangled && (status == 0)) {
+      snprintf(buf, len, "%s (%s)", demangled, object);
+    } else if (sym.function) {
+      snprintf(buf, len, "%s (%s)", sym.function, object);
+    } else {
+      // Unexported function: attribute it to its shared object.
+      snprintf(buf, len, "[unknown] (%s)", object);
+    }
+    ::free(demangled);
+    return true;
+  }
+
+ private:
+  enum { MAX_SYMBOLS = 32768 };  // (a power of two)
+
+  struct Entry {
+    void *addr;  // nullptr if empty
+    Symbol symbol;
+  };
+
+  Symbolizer() : _entries() {}
+
+  static unsigned long slot(void *addr) {
+    // Mix the high bits in, since return addresses cluster.
+    auto u = reinterpret_cast<uintptr_t>(addr);
+    u ^= (u >> 15) ^ (u >> 31);
+    return u & (MAX_SYMBOLS - 1);
+  }
+
+  HL::SpinLock _lock;
+  Entry _entries[MAX_SYMBOLS];
+};
+
+#endif
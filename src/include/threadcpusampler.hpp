@@ -0,0 +1,239 @@
+#pragma once
+#ifndef THREADCPUSAMPLER_HPP
+#define THREADCPUSAMPLER_HPP
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <heaplayers.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.hpp"
+#include "interpreterrange.hpp"
+#include "nativestack.hpp"
+#include "printf.h"
+#include "samplefile.hpp"
+#include "stprintf.h"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+// Per-thread CPU sampling.
+//
+// Python only delivers signals to the main thread, so for every other
+// thread we arm a timer on that thread's own CPU-time clock
+// (CLOCK_THREAD_CPUTIME_ID, via pthread_getcpuclockid) that signals
+// exactly that thread (SIGEV_THREAD_ID). The handler runs without the
+// GIL; it records the thread id, whether the interrupted PC was in the
+// interpreter or in native code, the number of elapsed intervals, and
+// the native stack below the interpreter (leaf PC first), which the
+// Python side attributes (caller to leaf) to the line each thread is
+// on.
+
+class ThreadCPUSampler {
+ public:
+  enum { MAX_THREADS = 4096 };
+
+  static int CPUSignal() { return SIGRTMIN + 1; }
+
+  ThreadCPUSampler()
+      : _samplefile((char *)"/tmp/scalene-cpu-signal%d",
+                    (char *)"/tmp/scalene-cpu-lock%d",
+                    (char *)"/tmp/scalene-cpu-init%d"),
+        _enabled(false),
+        _intervalUsec(0) {
+    for (auto i = 0; i < MAX_THREADS; i++) {
+      _threads[i].inUse = false;
+      _threads[i].armed = false;
+    }
+    pthread_key_create(&_threadKey, threadExit);
+    instance() = this;
+  }
+
+  // Start sampling every registered thread (and all threads registered
+  // from now on) every intervalUsec microseconds of its CPU time.
+  // The calling thread (Python's main thread) is registered too.
+  void enable(uint64_t intervalUsec) {
+    InterpreterRange::initialize();
+    if (pthread_getspecific(_threadKey) == nullptr) {
+      registerCurrentThread();
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = handler;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(CPUSignal(), &sa, nullptr);
+    _lock.lock();
+    _intervalUsec = intervalUsec;
+    _enabled = true;
+    for (auto i = 0; i < MAX_THREADS; i++) {
+      if (_threads[i].inUse) {
+        arm(_threads[i]);
+      }
+    }
+    _lock.unlock();
+  }
+
+  void disable() {
+    _lock.lock();
+    _enabled = false;
+    for (auto i = 0; i < MAX_THREADS; i++) {
+      if (_threads[i].inUse) {
+        disarm(_threads[i]);
+      }
+    }
+    _lock.unlock();
+  }
+
+  // Called by each new thread, on that thread, before it runs any code.
+  void registerCurrentThread() {
+    NativeStack::registerCurrentThread();
+    _lock.lock();
+    for (auto i = 0; i < MAX_THREADS; i++) {
+      auto &t = _threads[i];
+      if (t.inUse) {
+        continue;
+      }
+      t.inUse = true;
+      t.armed = false;
+      t.tid = (pid_t)syscall(SYS_gettid);
+      if (pthread_getcpuclockid(pthread_self(), &t.clock) != 0) {
+        t.inUse = false;
+        break;
+      }
+      pthread_setspecific(_threadKey, (void *)(uintptr_t)(i + 1));
+      if (_enabled) {
+        arm(t);
+      }
+      break;
+    }
+    _lock.unlock();
+  }
+
+ private:
+  // Prevent copying and assignment.
+  ThreadCPUSampler(const ThreadCPUSampler &) = delete;
+  ThreadCPUSampler &operator=(const ThreadCPUSampler &) = delete;
+
+  struct ThreadEntry {
+    bool inUse;
+    bool armed;
+    pid_t tid;
+    clockid_t clock;
+    timer_t timer;
+  };
+
+  static ThreadCPUSampler *&instance() {
+    static ThreadCPUSampler *theInstance = nullptr;
+    return theInstance;
+  }
+
+  void arm(ThreadEntry &t) {
+    if (!t.armed) {
+      struct sigevent sev;
+      memset(&sev, 0, sizeof(sev));
+      sev.sigev_notify = SIGEV_THREAD_ID;
+      sev.sigev_signo = CPUSignal();
+      sev.sigev_notify_thread_id = t.tid;
+      if (timer_create(t.clock, &sev, &t.timer) != 0) {
+        return;
+      }
+      t.armed = true;
+    }
+    struct itimerspec its;
+    its.it_interval.tv_sec = _intervalUsec / 1000000;
+    its.it_interval.tv_nsec = (_intervalUsec % 1000000) * 1000;
+    its.it_value = its.it_interval;
+    timer_settime(t.timer, 0, &its, nullptr);
+  }
+
+  void disarm(ThreadEntry &t) {
+    if (t.armed) {
+      struct itimerspec its;
+      memset(&its, 0, sizeof(its));
+      timer_settime(t.timer, 0, &its, nullptr);
+    }
+  }
+
+  // pthread key destructor: runs when a registered thread exits.
+  static void threadExit(void *value) {
+    auto self = instance();
+    auto index = (uintptr_t)value - 1;
+    if ((self == nullptr) || (index >= MAX_THREADS)) {
+      return;
+    }
+    self->_lock.lock();
+    auto &t = self->_threads[index];
+    if (t.armed) {
+      timer_delete(t.timer);
+    }
+    t.armed = false;
+    t.inUse = false;
+    self->_lock.unlock();
+  }
+
+  // The signal handler: async-signal-safe, and does not need the GIL.
+  static void handler(int, siginfo_t *info, void *context) {
+    auto self = instance();
+    if (self == nullptr) {
+      return;
+    }
+    auto saved_errno = errno;
+    void *frames[NativeStack::MAX_FRAMES];
+    auto nframes = NativeStack::walk(context, frames, NativeStack::MAX_FRAMES);
+    auto pc = (nframes > 0) ? frames[0] : nullptr;
+    auto inPython = InterpreterRange::contains(pc);
+    // Only native code's own frames are reported: none at all for
+    // samples in the interpreter, and otherwise the native stack up to
+    // where the interpreter called into it.
+    if (inPython) {
+      nframes = 0;
+    }
+    for (auto i = 1; i < nframes; i++) {
+      if (InterpreterRange::contains(frames[i])) {
+        nframes = i;
+        break;
+      }
+    }
+    // Count any expirations that occurred while the signal was pending.
+    auto count = 1 + ((info->si_code == SI_TIMER) ? info->si_overrun : 0);
+    char buf[SampleFile::MAX_BUFSIZE];
+    auto len = stprintf::format(buf, SampleFile::MAX_BUFSIZE,
+                                STPRINTF_FORMAT("%lu,%d,%d,%d,"),
+                                (unsigned long)pthread_self(),
+                                inPython ? 1 : 0, count,
+                                getpid());
+    // The stack, as space-separated addresses.
+    for (auto i = 0; i < nframes; i++) {
+      if (i > 0) {
+        len += stprintf::format(buf + len, SampleFile::MAX_BUFSIZE - len,
+                                STPRINTF_FORMAT(" "));
+      }
+      len += stprintf::format(buf + len, SampleFile::MAX_BUFSIZE - len,
+                              STPRINTF_FORMAT("%p"), frames[i]);
+    }
+    stprintf::format(buf + len, SampleFile::MAX_BUFSIZE - len,
+                     STPRINTF_FORMAT("\n\n"));
+    self->_samplefile.writeToFile(buf, 0);
+    errno = saved_errno;
+  }
+
+  SampleFile _samplefile;
+  HL::SpinLock _lock;
+  pthread_key_t _threadKey;
+  bool _enabled;
+  uint64_t _intervalUsec;
+  ThreadEntry _threads[MAX_THREADS];
+};
+
+#endif  // __linux__
+
+#endif
@@ -0,0 +1,98 @@
+#pragma once
+#ifndef TIMESTAMP_HPP
+#define TIMESTAMP_HPP
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#include "common.hpp"
+
+// Cheap timestamps, in ns, on the same timeline as Python's
+// time.monotonic() (CLOCK_MONOTONIC on Linux, CLOCK_UPTIME_RAW on
+// macOS), so that samples can be lined up with CPU samples and with
+// external events.
+//
+// Where the CPU has an invariant TSC, reading it is several times
+// cheaper than asking the OS; each Timestamp (one per thread) converts
+// TSC ticks to ns with its own calibration against the OS clock,
+// re-anchoring every RecalibrationNs to bound any drift. Until the
+// first calibration (MinCalibrationNs after first use), and wherever
+// there is no usable TSC, it just reads the OS clock.
+
+class Timestamp {
+ public:
+  Timestamp() : _anchorTsc(0), _anchorNs(0), _nsPerTick(0), _maxTicks(0) {}
+
+  inline uint64_t nowNs() {
+#if defined(__x86_64__)
+    if (likely(hasInvariantTSC())) {
+      auto tsc = __rdtsc();
+      // (If this thread moved to a CPU whose TSC is slightly behind,
+      // the difference wraps around and we recalibrate.)
+      auto ticks = tsc - _anchorTsc;
+      if (likely(ticks < _maxTicks)) {
+        return _anchorNs + (uint64_t)((double)ticks * _nsPerTick);
+      }
+      return recalibrate(tsc);
+    }
+#endif
+    return clockNs();
+  }
+
+  static uint64_t clockNs() {
+#if defined(__APPLE__)
+    return clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+  }
+
+ private:
+  static constexpr uint64_t MinCalibrationNs = 1000000ULL;      // 1ms
+  static constexpr uint64_t RecalibrationNs = 1000000000ULL;    // 1s
+
+#if defined(__x86_64__)
+  static bool hasInvariantTSC() {
+    static const bool invariant = []() {
+      unsigned int eax, ebx, ecx, edx;
+      if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) ||
+          (eax < 0x80000007)) {
+        return false;
+      }
+      __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+      return (edx & (1 << 8)) != 0;
+    }();
+    return invariant;
+  }
+
+  uint64_t recalibrate(uint64_t tsc) {
+    auto ns = clockNs();
+    auto longEnough = (ns >= _anchorNs + MinCalibrationNs);
+    if ((_anchorNs != 0) && (_maxTicks == 0) && !longEnough) {
+      // Keep measuring from the first anchor.
+      return ns;
+    }
+    if ((_anchorNs != 0) && (tsc > _anchorTsc) && longEnough) {
+      _nsPerTick = (double)(ns - _anchorNs) / (double)(tsc - _anchorTsc);
+      _maxTicks = (uint64_t)(RecalibrationNs / _nsPerTick);
+    }
+    _anchorTsc = tsc;
+    _anchorNs = ns;
+    return ns;
+  }
+#endif
+
+  uint64_t _anchorTsc;
+  uint64_t _anchorNs;
+  double _nsPerTick;
+  uint64_t _maxTicks;  // 0 until calibrated, which forces the slow path
+};
+
+#endif
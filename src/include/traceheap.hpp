@@ -0,0 +1,52 @@
+#pragma once
+#ifndef TRACEHEAP_HPP
+#define TRACEHEAP_HPP
+
+#include "allocationtrace.hpp"
+#include "common.hpp"
+
+// Records every allocation and free through SuperHeap in the
+// allocation trace (see allocationtrace.hpp), when tracing is on.
+// Meant to be per-thread (e.g., under HL::ThreadSpecificHeap).
+//
+// Frees are recorded before the memory is released, so that another
+// thread cannot be handed (and record) the same address first.
+// Reallocations reach the heap as a malloc and a free, and are traced
+// that way.
+
+template <class SuperHeap>
+class TraceHeap : public SuperHeap {
+ public:
+  enum { Alignment = SuperHeap::Alignment };
+
+  TraceHeap() : _tracing(AllocationTrace::getInstance().enabled()) {}
+
+  ATTRIBUTE_ALWAYS_INLINE inline void *malloc(size_t sz) {
+    auto ptr = SuperHeap::malloc(sz);
+    if (unlikely(_tracing) && ptr) {
+      _writer.record(AllocationTrace::Malloc, ptr, sz, 0);
+    }
+    return ptr;
+  }
+
+  ATTRIBUTE_ALWAYS_INLINE inline void free(void *ptr) {
+    if (unlikely(_tracing) && ptr) {
+      _writer.record(AllocationTrace::Free, ptr, 0, 0);
+    }
+    SuperHeap::free(ptr);
+  }
+
+  void *memalign(size_t alignment, size_t sz) {
+    auto ptr = SuperHeap::memalign(alignment, sz);
+    if (unlikely(_tracing) && ptr) {
+      _writer.record(AllocationTrace::Memalign, ptr, sz, alignment);
+    }
+    return ptr;
+  }
+
+ private:
+  bool _tracing;
+  TraceWriter _writer;
+};
+
+#endif
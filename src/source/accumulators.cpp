@@ -0,0 +1,385 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <new>
+#include <vector>
+
+#include "runningstats.hpp"
+
+// RunningStats and Adaptive (see include/runningstats.hpp), as Python
+// types with the interfaces of scalene/runningstats.py and
+// scalene/adaptive.py, which use them when they are built.
+//
+// Both pickle (Scalene merges them across processes) and support + and
+// +=, which merge them.
+
+namespace {
+
+struct RunningStatsObject {
+  PyObject_HEAD RunningStats stats;
+};
+
+struct AdaptiveObject {
+  PyObject_HEAD Adaptive adaptive;
+};
+
+extern PyTypeObject RunningStatsType;
+extern PyTypeObject AdaptiveType;
+
+RunningStats& statsOf(PyObject* self) {
+  return reinterpret_cast<RunningStatsObject*>(self)->stats;
+}
+
+Adaptive& adaptiveOf(PyObject* self) {
+  return reinterpret_cast<AdaptiveObject*>(self)->adaptive;
+}
+
+// RunningStats
+
+PyObject* RunningStats_new(PyTypeObject* type, PyObject* args,
+                           PyObject* kwds) {
+  static const char* keywords[] = {"n", "m1", "m2", "m3", "m4", nullptr};
+  unsigned long long n = 0;
+  double m1 = 0, m2 = 0, m3 = 0, m4 = 0;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Kdddd",
+                                   const_cast<char**>(keywords), &n, &m1, &m2,
+                                   &m3, &m4)) {
+    return nullptr;
+  }
+  auto self = type->tp_alloc(type, 0);
+  if (self != nullptr) {
+    new (&statsOf(self)) RunningStats(n, m1, m2, m3, m4);
+  }
+  return self;
+}
+
+void RunningStats_dealloc(PyObject* self) {
+  statsOf(self).~RunningStats();
+  Py_TYPE(self)->tp_free(self);
+}
+
+PyObject* RunningStats_push(PyObject* self, PyObject* arg) {
+  auto x = PyFloat_AsDouble(arg);
+  if ((x == -1.0) && PyErr_Occurred()) {
+    return nullptr;
+  }
+  statsOf(self).push(x);
+  Py_RETURN_NONE;
+}
+
+PyObject* RunningStats_clear(PyObject* self, PyObject*) {
+  statsOf(self).clear();
+  Py_RETURN_NONE;
+}
+
+PyObject* RunningStats_size(PyObject* self, PyObject*) {
+  return PyLong_FromUnsignedLongLong(statsOf(self).size());
+}
+
+// The statistics, raising ZeroDivisionError where the Python version
+// would (rather than returning NaN or inf).
+PyObject* statistic(double denominator, double value) {
+  if (denominator == 0.0) {
+    PyErr_SetString(PyExc_ZeroDivisionError, "float division by zero");
+    return nullptr;
+  }
+  return PyFloat_FromDouble(value);
+}
+
+PyObject* RunningStats_mean(PyObject* self, PyObject*) {
+  return PyFloat_FromDouble(statsOf(self).mean());
+}
+
+PyObject* RunningStats_var(PyObject* self, PyObject*) {
+  auto& s = statsOf(self);
+  return statistic(s.size() - 1.0, s.var());
+}
+
+PyObject* RunningStats_std(PyObject* self, PyObject*) {
+  auto& s = statsOf(self);
+  return statistic(s.size() - 1.0, s.std());
+}
+
+PyObject* RunningStats_sem(PyObject* self, PyObject*) {
+  auto& s = statsOf(self);
+  return statistic((s.size() > 1) ? 1.0 : 0.0, s.sem());
+}
+
+PyObject* RunningStats_skewness(PyObject* self, PyObject*) {
+  auto& s = statsOf(self);
+  return statistic((s.size() < 2) ? 1.0 : s.m2(), s.skewness());
+}
+
+PyObject* RunningStats_kurtosis(PyObject* self, PyObject*) {
+  auto& s = statsOf(self);
+  return statistic(s.m2(), s.kurtosis());
+}
+
+PyObject* RunningStats_reduce(PyObject* self, PyObject*) {
+  auto& s = statsOf(self);
+  return Py_BuildValue("(O(Kdddd))", Py_TYPE(self),
+                       (unsigned long long)s.size(), s.m1(), s.m2(), s.m3(),
+                       s.m4());
+}
+
+PyObject* RunningStats_add(PyObject* a, PyObject* b) {
+  if (!PyObject_TypeCheck(a, &RunningStatsType) ||
+      !PyObject_TypeCheck(b, &RunningStatsType)) {
+    Py_RETURN_NOTIMPLEMENTED;
+  }
+  auto result = RunningStatsType.tp_alloc(&RunningStatsType, 0);
+  if (result != nullptr) {
+    new (&statsOf(result)) RunningStats(statsOf(a));
+    statsOf(result) += statsOf(b);
+  }
+  return result;
+}
+
+PyObject* RunningStats_iadd(PyObject* a, PyObject* b) {
+  if (!PyObject_TypeCheck(b, &RunningStatsType)) {
+    Py_RETURN_NOTIMPLEMENTED;
+  }
+  statsOf(a) += statsOf(b);
+  Py_INCREF(a);
+  return a;
+}
+
+PyObject* RunningStats_get_n(PyObject* self, void*) {
+  return PyLong_FromUnsignedLongLong(statsOf(self).size());
+}
+
+template <double (RunningStats::*Moment)() const>
+PyObject* RunningStats_get_moment(PyObject* self, void*) {
+  return PyFloat_FromDouble((statsOf(self).*Moment)());
+}
+
+PyMethodDef RunningStats_methods[] = {
+    {"push", RunningStats_push, METH_O, "Add a sample"},
+    {"clear", RunningStats_clear, METH_NOARGS, "Reset for new samples"},
+    {"size", RunningStats_size, METH_NOARGS, "The number of samples"},
+    {"mean", RunningStats_mean, METH_NOARGS,
+     "Arithmetic mean, a.k.a. average"},
+    {"var", RunningStats_var, METH_NOARGS, "Variance"},
+    {"std", RunningStats_std, METH_NOARGS, "Standard deviation"},
+    {"sem", RunningStats_sem, METH_NOARGS, "Standard error of the mean"},
+    {"skewness", RunningStats_skewness, METH_NOARGS,
+     "Skewness (0 for fewer than two samples)"},
+    {"kurtosis", RunningStats_kurtosis, METH_NOARGS, "Excess kurtosis"},
+    {"__reduce__", RunningStats_reduce, METH_NOARGS, nullptr},
+    {nullptr, nullptr, 0, nullptr}};
+
+PyGetSetDef RunningStats_getset[] = {
+    {"n", RunningStats_get_n, nullptr, nullptr, nullptr},
+    {"m1", RunningStats_get_moment<&RunningStats::m1>, nullptr, nullptr,
+     nullptr},
+    {"m2", RunningStats_get_moment<&RunningStats::m2>, nullptr, nullptr,
+     nullptr},
+    {"m3", RunningStats_get_moment<&RunningStats::m3>, nullptr, nullptr,
+     nullptr},
+    {"m4", RunningStats_get_moment<&RunningStats::m4>, nullptr, nullptr,
+     nullptr},
+    {nullptr, nullptr, nullptr, nullptr, nullptr}};
+
+PyNumberMethods RunningStats_number = {};
+
+PyTypeObject RunningStatsType = {PyVarObject_HEAD_INIT(nullptr, 0)};
+
+// Adaptive
+
+// Reads a sequence of floats. @return false on error.
+bool toDoubles(PyObject* obj, std::vector<double>& values) {
+  auto seq = PySequence_Fast(obj, "samples must be a sequence");
+  if (seq == nullptr) {
+    return false;
+  }
+  auto n = PySequence_Fast_GET_SIZE(seq);
+  values.resize(n);
+  for (Py_ssize_t i = 0; i < n; i++) {
+    values[i] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(seq, i));
+    if ((values[i] == -1.0) && PyErr_Occurred()) {
+      Py_DECREF(seq);
+      return false;
+    }
+  }
+  Py_DECREF(seq);
+  return true;
+}
+
+PyObject* Adaptive_new(PyTypeObject* type, PyObject* args, PyObject* kwds) {
+  static const char* keywords[] = {"size", "samples", "index", nullptr};
+  Py_ssize_t size;
+  PyObject* samplesObj = nullptr;
+  Py_ssize_t index = 0;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "n|On",
+                                   const_cast<char**>(keywords), &size,
+                                   &samplesObj, &index)) {
+    return nullptr;
+  }
+  if ((size < 0) || (index < 0)) {
+    PyErr_SetString(PyExc_ValueError, "size and index must not be negative");
+    return nullptr;
+  }
+  std::vector<double> samples;
+  if ((samplesObj != nullptr) && (samplesObj != Py_None)) {
+    if (!toDoubles(samplesObj, samples)) {
+      return nullptr;
+    }
+    samples.resize(size, 0.0);
+  }
+  auto self = type->tp_alloc(type, 0);
+  if (self != nullptr) {
+    new (&adaptiveOf(self)) Adaptive(size);
+    if (!samples.empty()) {
+      adaptiveOf(self).set(samples, index);
+    }
+  }
+  return self;
+}
+
+void Adaptive_dealloc(PyObject* self) {
+  adaptiveOf(self).~Adaptive();
+  Py_TYPE(self)->tp_free(self);
+}
+
+PyObject* Adaptive_add_sample(PyObject* self, PyObject* arg) {
+  auto value = PyFloat_AsDouble(arg);
+  if ((value == -1.0) && PyErr_Occurred()) {
+    return nullptr;
+  }
+  if (adaptiveOf(self).maxSamples() == 0) {
+    PyErr_SetString(PyExc_IndexError, "Adaptive has no room for samples");
+    return nullptr;
+  }
+  adaptiveOf(self).add(value);
+  Py_RETURN_NONE;
+}
+
+PyObject* Adaptive_get(PyObject* self, PyObject*) {
+  auto& samples = adaptiveOf(self).samples();
+  auto list = PyList_New(samples.size());
+  if (list == nullptr) {
+    return nullptr;
+  }
+  for (size_t i = 0; i < samples.size(); i++) {
+    auto value = PyFloat_FromDouble(samples[i]);
+    if (value == nullptr) {
+      Py_DECREF(list);
+      return nullptr;
+    }
+    PyList_SET_ITEM(list, i, value);
+  }
+  return list;
+}
+
+PyObject* Adaptive_len(PyObject* self, PyObject*) {
+  return PyLong_FromSize_t(adaptiveOf(self).len());
+}
+
+PyObject* Adaptive_reduce(PyObject* self, PyObject*) {
+  auto samples = Adaptive_get(self, nullptr);
+  if (samples == nullptr) {
+    return nullptr;
+  }
+  auto& a = adaptiveOf(self);
+  return Py_BuildValue("(O(nNn))", Py_TYPE(self), (Py_ssize_t)a.maxSamples(),
+                       samples, (Py_ssize_t)a.len());
+}
+
+PyObject* Adaptive_add(PyObject* a, PyObject* b) {
+  if (!PyObject_TypeCheck(a, &AdaptiveType) ||
+      !PyObject_TypeCheck(b, &AdaptiveType)) {
+    Py_RETURN_NOTIMPLEMENTED;
+  }
+  auto result = AdaptiveType.tp_alloc(&AdaptiveType, 0);
+  if (result != nullptr) {
+    new (&adaptiveOf(result)) Adaptive(adaptiveOf(a));
+    adaptiveOf(result) += adaptiveOf(b);
+  }
+  return result;
+}
+
+PyObject* Adaptive_iadd(PyObject* a, PyObject* b) {
+  if (!PyObject_TypeCheck(b, &AdaptiveType)) {
+    Py_RETURN_NOTIMPLEMENTED;
+  }
+  adaptiveOf(a) += adaptiveOf(b);
+  Py_INCREF(a);
+  return a;
+}
+
+PyObject* Adaptive_get_max_samples(PyObject* self, void*) {
+  return PyLong_FromSize_t(adaptiveOf(self).maxSamples());
+}
+
+PyObject* Adaptive_get_current_index(PyObject* self, void*) {
+  return PyLong_FromSize_t(adaptiveOf(self).len());
+}
+
+PyMethodDef Adaptive_methods[] = {
+    {"add", Adaptive_add_sample, METH_O, "Add a sample"},
+    {"get", Adaptive_get, METH_NOARGS, "The samples (as a list)"},
+    {"len", Adaptive_len, METH_NOARGS, "The number of samples"},
+    {"__reduce__", Adaptive_reduce, METH_NOARGS, nullptr},
+    {nullptr, nullptr, 0, nullptr}};
+
+PyGetSetDef Adaptive_getset[] = {
+    {"max_samples", Adaptive_get_max_samples, nullptr, nullptr, nullptr},
+    {"current_index", Adaptive_get_current_index, nullptr, nullptr, nullptr},
+    {"sample_array", (getter)Adaptive_get, nullptr, nullptr, nullptr},
+    {nullptr, nullptr, nullptr, nullptr, nullptr}};
+
+PyNumberMethods Adaptive_number = {};
+
+PyTypeObject AdaptiveType = {PyVarObject_HEAD_INIT(nullptr, 0)};
+
+struct PyModuleDef module = {PyModuleDef_HEAD_INIT, "accumulators", nullptr,
+                             -1, nullptr};
+
+}  // namespace
+
+PyMODINIT_FUNC PyInit_accumulators() {
+  RunningStats_number.nb_add = RunningStats_add;
+  RunningStats_number.nb_inplace_add = RunningStats_iadd;
+  RunningStatsType.tp_name = "accumulators.RunningStats";
+  RunningStatsType.tp_doc = "Incrementally compute statistics";
+  RunningStatsType.tp_basicsize = sizeof(RunningStatsObject);
+  RunningStatsType.tp_flags = Py_TPFLAGS_DEFAULT;
+  RunningStatsType.tp_new = RunningStats_new;
+  RunningStatsType.tp_dealloc = RunningStats_dealloc;
+  RunningStatsType.tp_methods = RunningStats_methods;
+  RunningStatsType.tp_getset = RunningStats_getset;
+  RunningStatsType.tp_as_number = &RunningStats_number;
+
+  Adaptive_number.nb_add = Adaptive_add;
+  Adaptive_number.nb_inplace_add = Adaptive_iadd;
+  AdaptiveType.tp_name = "accumulators.Adaptive";
+  AdaptiveType.tp_doc =
+      "Implements sampling to achieve the effect of a uniform random sample.";
+  AdaptiveType.tp_basicsize = sizeof(AdaptiveObject);
+  AdaptiveType.tp_flags = Py_TPFLAGS_DEFAULT;
+  AdaptiveType.tp_new = Adaptive_new;
+  AdaptiveType.tp_dealloc = Adaptive_dealloc;
+  AdaptiveType.tp_methods = Adaptive_methods;
+  AdaptiveType.tp_getset = Adaptive_getset;
+  AdaptiveType.tp_as_number = &Adaptive_number;
+
+  if ((PyType_Ready(&RunningStatsType) < 0) ||
+      (PyType_Ready(&AdaptiveType) < 0)) {
+    return nullptr;
+  }
+  auto m = PyModule_Create(&module);
+  if (m == nullptr) {
+    return nullptr;
+  }
+  Py_INCREF(&RunningStatsType);
+  Py_INCREF(&AdaptiveType);
+  if ((PyModule_AddObject(m, "RunningStats", (PyObject*)&RunningStatsType) <
+       0) ||
+      (PyModule_AddObject(m, "Adaptive", (PyObject*)&AdaptiveType) < 0)) {
+    Py_DECREF(&RunningStatsType);
+    Py_DECREF(&AdaptiveType);
+    Py_DECREF(m);
+    return nullptr;
+  }
+  return m;
+}
@@ -0,0 +1,198 @@
+// format-benchmark: compares stprintf::format (see include/stprintf.h)
+// with the snprintfs it replaces, on the records that the samplers
+// write, and checks that its output matches glibc's.
+//
+//   format-benchmark [--records N]
+//
+// For each record type, reports ns per record for stprintf::format,
+// mpaland's snprintf (vendor/printf, which the samplers used), and
+// glibc's snprintf. (Pointers are printed as mpaland prints them, so
+// the comparison with glibc leaves them out.)
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// glibc's snprintf, before printf.h renames snprintf to mpaland's.
+static int (*const glibcSnprintf)(char *, size_t, const char *,
+                                  ...) = snprintf;
+
+#include <random>
+#include <vector>
+
+#include "printf.h"
+#include "stprintf.h"
+#include "timestamp.hpp"
+
+extern "C" void _putchar(char ch) { ::write(1, (void *)&ch, 1); }
+
+namespace {
+
+constexpr int BufSize = 256;  // as SampleFile::MAX_BUFSIZE
+
+// The fields of a SampleHeap record.
+struct Record {
+  char action;
+  uint64_t triggered;
+  uint64_t count;
+  float pythonFraction;
+  int pid;
+  void *ptr;
+  uint64_t rss;
+  uint64_t minorFaults;
+  uint64_t majorFaults;
+  uint64_t interval;
+  uint32_t stackId;
+  uint64_t ns;
+  float arrayFraction;
+};
+
+std::vector<Record> makeRecords(size_t n) {
+  std::mt19937_64 rng(42);
+  std::vector<Record> records(n);
+  for (auto &r : records) {
+    r.action = "MFfLl"[rng() % 5];
+    r.triggered = rng() % 100000000;
+    r.count = rng() % (1ULL << (rng() % 40));
+    r.pythonFraction = (rng() % 1000001) / 1e6f;
+    r.pid = 1 + rng() % 4000000;
+    r.ptr = (void *)(uintptr_t)(rng() & 0x7fffffffffffULL);
+    r.rss = rng() % (1ULL << 36);
+    r.minorFaults = rng() % 10000000;
+    r.majorFaults = rng() % 1000;
+    r.interval = 1048571 + rng() % 1000;
+    r.stackId = rng() % 100000;
+    r.ns = 1700000000000000000ULL + rng() % 1000000000000ULL;
+    r.arrayFraction = (rng() % 1000001) / 1e6f;
+  }
+  return records;
+}
+
+// Times one way of writing every record (over several passes).
+template <class Write>
+double nsPerRecord(const std::vector<Record> &records, Write write) {
+  const int Passes = 5;
+  char buf[BufSize];
+  uint64_t checksum = 0;
+  auto start = Timestamp::clockNs();
+  for (int i = 0; i < Passes; i++) {
+    for (auto &r : records) {
+      checksum += write(buf, r);
+    }
+  }
+  auto elapsed = Timestamp::clockNs() - start;
+  if (checksum == 0) {
+    printf("(nothing written)\n");
+  }
+  return (double)elapsed / (Passes * records.size());
+}
+
+void report(const char *name, double format, double mpaland, double glibc) {
+  printf("%-10s %10.1f %10.1f %10.1f %8.2fx %8.2fx\n", name, format, mpaland,
+         glibc, mpaland / format, glibc / format);
+}
+
+// Checks stprintf::format's output against glibc's, field by field.
+uint64_t checkAgainstGlibc(const std::vector<Record> &records) {
+  uint64_t mismatches = 0;
+  std::mt19937_64 rng(7);
+  for (auto &r : records) {
+    char ours[BufSize], theirs[BufSize];
+    auto negative = -(int64_t)(r.count);
+    auto value = (double)r.count / (1 + rng() % 1000);
+    stprintf::format(ours, BufSize,
+                     STPRINTF_FORMAT("%c,%lu,%d,%u,%x,%f,%.3f,%.0f,%s,%%\n"),
+                     r.action, r.rss, r.pid, r.stackId, r.minorFaults,
+                     r.pythonFraction, value, -value, "str");
+    glibcSnprintf(theirs, BufSize, "%c,%lu,%d,%u,%lx,%f,%.3f,%.0f,%s,%%\n",
+                  r.action, (unsigned long)r.rss, r.pid, r.stackId,
+                  (unsigned long)r.minorFaults, r.pythonFraction, value,
+                  -value, "str");
+    stprintf::format(ours + strlen(ours), BufSize - strlen(ours),
+                     STPRINTF_FORMAT("%ld,%lld"), negative, INT64_MIN);
+    glibcSnprintf(theirs + strlen(theirs), BufSize - strlen(theirs),
+                  "%ld,%lld", (long)negative, (long long)INT64_MIN);
+    if (strcmp(ours, theirs) != 0) {
+      if (mismatches == 0) {
+        printf("first mismatch:\n  ours:  %s\n  glibc: %s\n", ours, theirs);
+      }
+      mismatches++;
+    }
+  }
+  return mismatches;
+}
+
+void usage() {
+  fprintf(stderr, "usage: format-benchmark [--records N]\n");
+  exit(1);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  size_t n = 1000000;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--records") && (i + 1 < argc)) {
+      n = std::max(1ULL, strtoull(argv[++i], nullptr, 10));
+    } else {
+      usage();
+    }
+  }
+  auto records = makeRecords(n);
+
+  printf("%-10s %10s %10s %10s %9s %9s\n", "record", "format", "mpaland",
+         "glibc", "vs mpaland", "vs glibc");
+  // A malloc sample (as SampleHeap::writeCount).
+  report(
+      "malloc",
+      nsPerRecord(records,
+                  [](char *buf, const Record &r) {
+                    return stprintf::format(
+                        buf, BufSize,
+                        STPRINTF_FORMAT(
+                            "%c,%lu,%lu,%f,%d,%p,%lu,%lu,%lu,%lu,%u,%lu,%f\n\n"),
+                        r.action, r.triggered, r.count, r.pythonFraction,
+                        r.pid, r.ptr, r.rss, r.minorFaults, r.majorFaults,
+                        r.interval, r.stackId, r.ns, r.arrayFraction);
+                  }),
+      nsPerRecord(records,
+                  [](char *buf, const Record &r) {
+                    return snprintf(
+                        buf, BufSize,
+                        "%c,%lu,%lu,%f,%d,%p,%lu,%lu,%lu,%lu,%u,%lu,%f\n\n",
+                        r.action, r.triggered, r.count, r.pythonFraction,
+                        r.pid, r.ptr, r.rss, r.minorFaults, r.majorFaults,
+                        r.interval, r.stackId, r.ns, r.arrayFraction);
+                  }),
+      nsPerRecord(records, [](char *buf, const Record &r) {
+        return glibcSnprintf(
+            buf, BufSize, "%c,%lu,%lu,%f,%d,%p,%lu,%lu,%lu,%lu,%u,%lu,%f\n\n",
+            r.action, r.triggered, r.count, r.pythonFraction, r.pid, r.ptr,
+            r.rss, r.minorFaults, r.majorFaults, r.interval, r.stackId, r.ns,
+            r.arrayFraction);
+      }));
+  // A lock wait (as LockWaitSampler).
+  report("lockwait",
+         nsPerRecord(records,
+                     [](char *buf, const Record &r) {
+                       return stprintf::format(
+                           buf, BufSize, STPRINTF_FORMAT("%lu,%lu,%p,%d\n\n"),
+                           r.ns, r.count, r.ptr, r.pid);
+                     }),
+         nsPerRecord(records,
+                     [](char *buf, const Record &r) {
+                       return snprintf(buf, BufSize, "%lu,%lu,%p,%d\n\n",
+                                       r.ns, r.count, r.ptr, r.pid);
+                     }),
+         nsPerRecord(records, [](char *buf, const Record &r) {
+           return glibcSnprintf(buf, BufSize, "%lu,%lu,%p,%d\n\n", r.ns,
+                                r.count, r.ptr, r.pid);
+         }));
+
+  auto mismatches = checkAgainstGlibc(records);
+  printf("%lu of %lu records differ from glibc's output\n",
+         (unsigned long)mismatches, (unsigned long)records.size());
+  return mismatches ? 1 : 0;
+}
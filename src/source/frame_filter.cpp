@@ -0,0 +1,337 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <frameobject.h>
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Finds, for every thread, the innermost frame that Scalene should
+// record (see Scalene.compute_frames_to_record), without going through
+// threading and sys._current_frames.
+//
+// set_should_trace(should_trace)
+//   should_trace(filename) -> bool decides which code to record. Its
+//   verdict is cached per code object, until the code object dies (or
+//   clear() is called, as when the verdicts change).
+//
+// frames_to_record(main_thread_ident, active) -> [(frame, ident, orig_frame)]
+//   For each thread in active (threading._active, so that threads that
+//   are still starting or that threading does not know are left out, as
+//   threading.enumerate() would), orig_frame is its current frame and
+//   frame is the innermost one to record (threads with none are left
+//   out too). The main thread comes first.
+
+namespace {
+
+struct Verdict {
+  bool trace;
+  PyObject* weakref;  // to the code object: clears this entry when it dies
+};
+
+PyObject* shouldTrace = nullptr;
+PyObject* forgetCallback = nullptr;  // (the weakrefs' callback)
+std::unordered_map<PyCodeObject*, Verdict> verdicts;
+std::unordered_map<PyObject*, PyCodeObject*> codeOfWeakref;
+
+PyFrameObject* threadFrame(PyThreadState* tstate) {
+#if PY_VERSION_HEX >= 0x03090000
+  return PyThreadState_GetFrame(tstate);
+#else
+  Py_XINCREF(tstate->frame);
+  return tstate->frame;
+#endif
+}
+
+PyFrameObject* frameBack(PyFrameObject* frame) {
+#if PY_VERSION_HEX >= 0x03090000
+  return PyFrame_GetBack(frame);
+#else
+  Py_XINCREF(frame->f_back);
+  return frame->f_back;
+#endif
+}
+
+PyCodeObject* frameCode(PyFrameObject* frame) {
+#if PY_VERSION_HEX >= 0x03090000
+  return PyFrame_GetCode(frame);
+#else
+  Py_INCREF(frame->f_code);
+  return frame->f_code;
+#endif
+}
+
+// Disables the garbage collector for the scope (restoring its state),
+// since a collection can run finalizers, that is, arbitrary Python.
+class NoCollection {
+ public:
+  NoCollection() {
+#if PY_VERSION_HEX >= 0x030A0000
+    _wasEnabled = PyGC_Disable();
+#else
+    _wasEnabled = 0;
+    auto gc = PyImport_ImportModule("gc");
+    if (gc != nullptr) {
+      auto enabled = PyObject_CallMethod(gc, "isenabled", nullptr);
+      if ((enabled != nullptr) && PyObject_IsTrue(enabled)) {
+        _wasEnabled = 1;
+        Py_XDECREF(PyObject_CallMethod(gc, "disable", nullptr));
+      }
+      Py_XDECREF(enabled);
+      Py_DECREF(gc);
+    }
+    PyErr_Clear();
+#endif
+  }
+
+  ~NoCollection() {
+    if (!_wasEnabled) {
+      return;
+    }
+#if PY_VERSION_HEX >= 0x030A0000
+    PyGC_Enable();
+#else
+    auto gc = PyImport_ImportModule("gc");
+    if (gc != nullptr) {
+      Py_XDECREF(PyObject_CallMethod(gc, "enable", nullptr));
+      Py_DECREF(gc);
+    }
+    PyErr_Clear();
+#endif
+  }
+
+ private:
+  int _wasEnabled;
+};
+
+PyInterpreterState* currentInterpreter() {
+#if PY_VERSION_HEX >= 0x03090000
+  return PyInterpreterState_Get();
+#else
+  return PyThreadState_Get()->interp;
+#endif
+}
+
+void forgetAll() {
+  for (auto& entry : verdicts) {
+    Py_XDECREF(entry.second.weakref);
+  }
+  verdicts.clear();
+  codeOfWeakref.clear();
+}
+
+// Called as each cached code object dies.
+PyObject* forget(PyObject*, PyObject* weakref) {
+  auto it = codeOfWeakref.find(weakref);
+  if (it != codeOfWeakref.end()) {
+    auto code = it->second;
+    codeOfWeakref.erase(it);
+    auto v = verdicts.find(code);
+    if ((v != verdicts.end()) && (v->second.weakref == weakref)) {
+      verdicts.erase(v);
+      Py_DECREF(weakref);
+    }
+  }
+  Py_RETURN_NONE;
+}
+
+// @return 1 if the code should be traced, 0 if not, -1 on error.
+int shouldTraceCode(PyCodeObject* code) {
+  auto it = verdicts.find(code);
+  if (it != verdicts.end()) {
+    return it->second.trace;
+  }
+  auto result =
+      PyObject_CallFunctionObjArgs(shouldTrace, code->co_filename, nullptr);
+  if (result == nullptr) {
+    return -1;
+  }
+  auto trace = PyObject_IsTrue(result);
+  Py_DECREF(result);
+  if (trace < 0) {
+    return -1;
+  }
+  auto weakref = PyWeakref_NewRef((PyObject*)code, forgetCallback);
+  if (weakref == nullptr) {
+    // Not cacheable (should not happen: code objects take weakrefs).
+    PyErr_Clear();
+    return trace;
+  }
+  verdicts[code] = {trace != 0, weakref};
+  codeOfWeakref[weakref] = code;
+  return trace;
+}
+
+bool hasFilename(PyCodeObject* code) {
+  return PyUnicode_Check(code->co_filename) &&
+         (PyUnicode_GET_LENGTH(code->co_filename) > 0);
+}
+
+// Sets *record to the innermost frame of this stack to record (a new
+// reference), or to nullptr if there is none. @return false on error.
+bool findFrameToRecord(PyFrameObject* frame, PyFrameObject** record) {
+  *record = nullptr;
+  Py_INCREF(frame);
+  auto code = frameCode(frame);
+  int trace;
+  if (hasFilename(code)) {
+    trace = shouldTraceCode(code);
+  } else {
+    // eval/compile leave co_filename empty: use the caller's.
+    auto back = frameBack(frame);
+    if (back == nullptr) {
+      trace = 0;
+    } else {
+      auto backCode = frameCode(back);
+      trace = shouldTraceCode(backCode);
+      Py_DECREF(backCode);
+      Py_DECREF(back);
+    }
+  }
+  Py_DECREF(code);
+  // Walk outward until reaching code we should trace (if any).
+  while (trace == 0) {
+    auto back = frameBack(frame);
+    Py_DECREF(frame);
+    frame = back;
+    if (frame == nullptr) {
+      return true;
+    }
+    code = frameCode(frame);
+    trace = shouldTraceCode(code);
+    Py_DECREF(code);
+  }
+  if (trace < 0) {
+    Py_DECREF(frame);
+    return false;
+  }
+  *record = frame;
+  return true;
+}
+
+// Each thread's ident and current frame (a new reference).
+using ThreadFrames = std::vector<std::pair<unsigned long, PyFrameObject*>>;
+
+// @return false on error.
+bool currentFrames(ThreadFrames& frames) {
+  // Only threads that hold the GIL can change the list of threads, so
+  // it stays stable as long as nothing here can release the GIL, which
+  // any call into Python could (should_trace, or a finalizer run by a
+  // collection, as getting a thread's frame may allocate one).
+  NoCollection noCollection;
+  for (auto tstate = PyInterpreterState_ThreadHead(currentInterpreter());
+       tstate != nullptr; tstate = PyThreadState_Next(tstate)) {
+    auto frame = threadFrame(tstate);
+    if (frame == nullptr) {
+      if (PyErr_Occurred()) {
+        return false;
+      }
+      continue;
+    }
+    frames.emplace_back(tstate->thread_id, frame);
+  }
+  return true;
+}
+
+void release(ThreadFrames& frames, size_t from) {
+  for (size_t i = from; i < frames.size(); i++) {
+    Py_DECREF(frames[i].second);
+  }
+}
+
+PyObject* frames_to_record(PyObject*, PyObject* args) {
+  unsigned long mainThread;
+  PyObject* active;
+  if (!PyArg_ParseTuple(args, "kO!", &mainThread, &PyDict_Type, &active)) {
+    return nullptr;
+  }
+  if (shouldTrace == nullptr) {
+    PyErr_SetString(PyExc_RuntimeError, "set_should_trace was not called");
+    return nullptr;
+  }
+  // First collect the frames, and only then decide which to record,
+  // since that calls into Python: by then, other threads may be gone.
+  ThreadFrames frames;
+  if (!currentFrames(frames)) {
+    release(frames, 0);
+    return nullptr;
+  }
+  auto result = PyList_New(0);
+  if (result == nullptr) {
+    release(frames, 0);
+    return nullptr;
+  }
+  for (size_t i = 0; i < frames.size(); i++) {
+    auto ident = frames[i].first;
+    auto orig = frames[i].second;
+    auto key = PyLong_FromUnsignedLong(ident);
+    auto known = (key == nullptr) ? -1 : PyDict_Contains(active, key);
+    Py_XDECREF(key);
+    PyFrameObject* frame = nullptr;
+    if ((known < 0) || ((known == 1) && !findFrameToRecord(orig, &frame))) {
+      release(frames, i);
+      Py_DECREF(result);
+      return nullptr;
+    }
+    if (frame != nullptr) {
+      auto entry = Py_BuildValue("(OkO)", frame, ident, orig);
+      Py_DECREF(frame);
+      if ((entry == nullptr) ||
+          ((ident == mainThread) ? PyList_Insert(result, 0, entry)
+                                 : PyList_Append(result, entry)) < 0) {
+        Py_XDECREF(entry);
+        release(frames, i);
+        Py_DECREF(result);
+        return nullptr;
+      }
+      Py_DECREF(entry);
+    }
+    Py_DECREF(orig);
+  }
+  return result;
+}
+
+PyObject* set_should_trace(PyObject*, PyObject* callable) {
+  if (!PyCallable_Check(callable)) {
+    PyErr_SetString(PyExc_TypeError, "should_trace must be callable");
+    return nullptr;
+  }
+  forgetAll();
+  Py_INCREF(callable);
+  Py_XSETREF(shouldTrace, callable);
+  Py_RETURN_NONE;
+}
+
+PyObject* clear(PyObject*, PyObject*) {
+  forgetAll();
+  Py_RETURN_NONE;
+}
+
+PyMethodDef forgetDef = {"_forget", forget, METH_O, nullptr};
+
+PyMethodDef methods[] = {
+    {"frames_to_record", frames_to_record, METH_VARARGS,
+     "For each thread in active, the innermost frame to record: a list of "
+     "(frame, ident, orig_frame), with the main thread first."},
+    {"set_should_trace", set_should_trace, METH_O,
+     "Sets the function that decides which code (by filename) to record."},
+    {"clear", clear, METH_NOARGS, "Forgets the cached verdicts."},
+    {nullptr, nullptr, 0, nullptr}};
+
+struct PyModuleDef module = {PyModuleDef_HEAD_INIT, "frame_filter", nullptr,
+                             -1, methods};
+
+}  // namespace
+
+PyMODINIT_FUNC PyInit_frame_filter() {
+  auto m = PyModule_Create(&module);
+  if (m == nullptr) {
+    return nullptr;
+  }
+  forgetCallback = PyCFunction_New(&forgetDef, nullptr);
+  if (forgetCallback == nullptr) {
+    Py_DECREF(m);
+    return nullptr;
+  }
+  return m;
+}
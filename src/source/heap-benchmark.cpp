@@ -0,0 +1,435 @@
+// heap-benchmark: measures the cost of the code that runs on every
+// allocation, layer by layer, under standard allocation patterns and
+// across thread counts, so that changes to the hot path can be judged.
+//
+//   heap-benchmark [--threads N] [--ops N] [--heap H] [--pattern P]
+//
+// Heaps (each adding to the one before):
+//   sysmalloc       HL::SysMallocHeap, as a baseline
+//   sampleheap      SampleHeap over it, one per thread
+//   threadspecific  HL::ThreadSpecificHeap of SampleHeaps (one shared)
+//   custom          libscalene's heap (CustomHeapType; as on Linux)
+//
+// Patterns (ops is the number of mallocs plus frees per thread):
+//   threadtest  allocate batches of 64-byte objects, then free them
+//   larson      replace random objects (16B-1KB) in a pool that another
+//               thread allocated
+//   prodcons    pass each object to the next thread, which frees it
+//   python      Python-like churn of small objects, mostly LIFO
+//
+// Thread counts double from 1 up to --threads (by default, the number
+// of CPUs). For each run, reports ns per operation in each thread,
+// scaling efficiency (throughput relative to that of one thread times
+// the number of threads), and how many malloc samples (signals) were
+// emitted per second.
+
+#include <heaplayers.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.hpp"
+#include "sampleheap.hpp"
+#include "timestamp.hpp"
+#include "traceheap.hpp"
+
+extern "C" void _putchar(char ch) { ::write(1, (void *)&ch, 1); }
+
+namespace {
+
+constexpr uint64_t MallocSamplingRate =
+    1048571ULL;  // as in libscalene.cpp
+
+typedef SampleHeap<MallocSamplingRate, HL::SysMallocHeap> SampleHeapType;
+
+// As in libscalene.cpp (where, on Linux, ScaleneBaseHeap is
+// HL::SysMallocHeap).
+class CustomHeapType
+    : public HL::ThreadSpecificHeap<
+          TraceHeap<SampleHeap<MallocSamplingRate, HL::SysMallocHeap>>> {
+ public:
+  void lock() {}
+  void unlock() {}
+};
+
+const int MaxThreads = 1024;
+
+// How each heap is reached from worker thread i.
+
+class SysMallocAccess {
+ public:
+  static const char *name() { return "sysmalloc"; }
+  static inline void *malloc(int, size_t sz) { return _heap.malloc(sz); }
+  static inline void free(int, void *ptr) { _heap.free(ptr); }
+
+ private:
+  static HL::SysMallocHeap _heap;
+};
+HL::SysMallocHeap SysMallocAccess::_heap;
+
+// (Worker i always uses the same SampleHeap, across runs.)
+class SampleHeapAccess {
+ public:
+  static const char *name() { return "sampleheap"; }
+  static inline void *malloc(int i, size_t sz) { return heap(i).malloc(sz); }
+  static inline void free(int i, void *ptr) { heap(i).free(ptr); }
+
+ private:
+  static SampleHeapType &heap(int i) {
+    if (unlikely(_heaps[i] == nullptr)) {
+      _heaps[i] = new SampleHeapType;
+    }
+    return *_heaps[i];
+  }
+  static SampleHeapType *_heaps[MaxThreads];
+};
+SampleHeapType *SampleHeapAccess::_heaps[MaxThreads];
+
+template <class Heap>
+class SharedAccess {
+ public:
+  static inline void *malloc(int, size_t sz) { return heap().malloc(sz); }
+  static inline void free(int, void *ptr) { heap().free(ptr); }
+
+ private:
+  static Heap &heap() {
+    alignas(Heap) static char buf[sizeof(Heap)];
+    static auto *h = new (buf) Heap;
+    return *h;
+  }
+};
+
+class ThreadSpecificAccess
+    : public SharedAccess<HL::ThreadSpecificHeap<SampleHeapType>> {
+ public:
+  static const char *name() { return "threadspecific"; }
+};
+
+class CustomAccess : public SharedAccess<CustomHeapType> {
+ public:
+  static const char *name() { return "custom"; }
+};
+
+// A small, fast generator (xorshift64*), one per thread.
+class Random {
+ public:
+  explicit Random(uint64_t seed) : _state(seed * 2654435761ULL + 1) {}
+  inline uint64_t next() {
+    _state ^= _state >> 12;
+    _state ^= _state << 25;
+    _state ^= _state >> 27;
+    return _state * 2685821657736338717ULL;
+  }
+
+ private:
+  uint64_t _state;
+};
+
+// Objects passed from one thread to the next (single producer, single
+// consumer).
+class Ring {
+ public:
+  Ring() : producerDone(false), _head(0), _tail(0) {}
+  bool push(void *ptr) {
+    auto tail = _tail.load(std::memory_order_relaxed);
+    if (tail - _head.load(std::memory_order_acquire) == Capacity) {
+      return false;
+    }
+    _slots[tail % Capacity] = ptr;
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+  void *pop() {
+    auto head = _head.load(std::memory_order_relaxed);
+    if (head == _tail.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    auto ptr = _slots[head % Capacity];
+    _head.store(head + 1, std::memory_order_release);
+    return ptr;
+  }
+
+  std::atomic<bool> producerDone;
+
+ private:
+  static constexpr uint64_t Capacity = 1024;
+  alignas(64) std::atomic<uint64_t> _head;
+  alignas(64) std::atomic<uint64_t> _tail;
+  void *_slots[Capacity];
+};
+
+template <class Access>
+class Patterns {
+ public:
+  static void threadtest(int i, int, uint64_t ops) {
+    const int Batch = 1000;
+    void *objects[Batch];
+    for (uint64_t n = 0; n < ops; n += 2 * Batch) {
+      for (int j = 0; j < Batch; j++) {
+        objects[j] = Access::malloc(i, 64);
+      }
+      for (int j = 0; j < Batch; j++) {
+        Access::free(i, objects[j]);
+      }
+    }
+  }
+
+  static const int LarsonPool = 1000;
+
+  // Done (by the main thread) before the workers start.
+  static void larsonSetup(int threads, std::vector<void *> &pool) {
+    Random rng(threads);
+    pool.resize(threads * LarsonPool);
+    for (int i = 0; i < threads; i++) {
+      for (int j = 0; j < LarsonPool; j++) {
+        // Allocated through the heap of the thread after worker i.
+        pool[i * LarsonPool + j] =
+            Access::malloc((i + 1) % threads, larsonSize(rng));
+      }
+    }
+  }
+
+  static void larson(int i, uint64_t ops, void **pool) {
+    Random rng(i + 1);
+    for (uint64_t n = 0; n < ops; n += 2) {
+      auto j = rng.next() % LarsonPool;
+      Access::free(i, pool[j]);
+      pool[j] = Access::malloc(i, larsonSize(rng));
+    }
+  }
+
+  // Done (by the main thread) after the workers finish: each worker's
+  // slice goes back through that worker's heap, as in larson.
+  static void larsonTeardown(int threads, std::vector<void *> &pool) {
+    for (int i = 0; i < threads; i++) {
+      for (int j = 0; j < LarsonPool; j++) {
+        Access::free(i, pool[i * LarsonPool + j]);
+      }
+    }
+    pool.clear();
+  }
+
+  static void prodcons(int i, int threads, uint64_t ops, Ring *rings) {
+    Random rng(i + 1);
+    auto &out = rings[(i + 1) % threads];
+    auto &in = rings[i];
+    for (uint64_t n = 0; n < ops; n += 2) {
+      auto ptr = Access::malloc(i, 32 + rng.next() % 224);
+      while (!out.push(ptr)) {
+        // Make room for whoever is waiting on us.
+        if (!freeOne(i, in)) {
+          std::this_thread::yield();
+        }
+      }
+      freeOne(i, in);
+    }
+    out.producerDone.store(true, std::memory_order_release);
+    // Keep consuming until our producer is done too.
+    while (!in.producerDone.load(std::memory_order_acquire)) {
+      if (!freeOne(i, in)) {
+        std::this_thread::yield();
+      }
+    }
+    while (freeOne(i, in)) {
+    }
+  }
+
+  static void python(int i, int, uint64_t ops) {
+    Random rng(i + 1);
+    std::vector<void *> live;
+    live.reserve(4096);
+    for (uint64_t n = 0; n < ops; n++) {
+      auto r = rng.next();
+      if (live.empty() || ((r % 100) < 52)) {
+        live.push_back(Access::malloc(i, pythonSize(r >> 8)));
+        continue;
+      }
+      if ((r >> 8) % 5 != 0) {
+        // Most objects die young, in reverse order of allocation.
+        Access::free(i, live.back());
+        live.pop_back();
+      } else {
+        auto j = (r >> 16) % live.size();
+        Access::free(i, live[j]);
+        live[j] = live.back();
+        live.pop_back();
+      }
+    }
+    for (auto ptr : live) {
+      Access::free(i, ptr);
+    }
+  }
+
+ private:
+  static inline size_t larsonSize(Random &rng) {
+    return 16 + rng.next() % 1009;
+  }
+
+  static inline bool freeOne(int i, Ring &ring) {
+    auto ptr = ring.pop();
+    if (ptr) {
+      Access::free(i, ptr);
+    }
+    return ptr != nullptr;
+  }
+
+  // Mostly small objects (ints, tuples, frames), some medium ones, and
+  // an occasional large buffer (a list growing, a string).
+  static inline size_t pythonSize(uint64_t r) {
+    auto kind = r % 16;
+    r >>= 4;
+    if (kind < 10) {
+      return 32 + 8 * (r % 5);
+    } else if (kind < 14) {
+      return 64 + 16 * (r % 12);
+    } else if (kind < 15) {
+      return 512;
+    }
+    return 2048 + r % 2048;
+  }
+};
+
+std::atomic<uint64_t> mallocSignals(0);
+
+void countSignal(int) {
+  mallocSignals.fetch_add(1, std::memory_order_relaxed);
+}
+
+struct Run {
+  uint64_t elapsedNs;
+  uint64_t signals;
+};
+
+template <class Access>
+Run run(const std::string &pattern, int threads, uint64_t ops) {
+  typedef Patterns<Access> P;
+  std::vector<void *> pool;
+  std::vector<Ring> rings(threads);
+  if (pattern == "larson") {
+    P::larsonSetup(threads, pool);
+  }
+  std::atomic<bool> go(false);
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; i++) {
+    workers.emplace_back([&, i]() {
+      while (!go.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+      if (pattern == "threadtest") {
+        P::threadtest(i, threads, ops);
+      } else if (pattern == "larson") {
+        P::larson(i, ops, &pool[i * P::LarsonPool]);
+      } else if (pattern == "prodcons") {
+        P::prodcons(i, threads, ops, rings.data());
+      } else {
+        P::python(i, threads, ops);
+      }
+    });
+  }
+  auto signals = mallocSignals.load();
+  auto start = Timestamp::clockNs();
+  go.store(true, std::memory_order_release);
+  for (auto &w : workers) {
+    w.join();
+  }
+  Run r{Timestamp::clockNs() - start, mallocSignals.load() - signals};
+  if (pattern == "larson") {
+    P::larsonTeardown(threads, pool);
+  }
+  return r;
+}
+
+template <class Access>
+void benchmark(const std::string &pattern, int maxThreads, uint64_t ops) {
+  double singleThroughput = 0;
+  // Double the threads each time, ending with exactly maxThreads.
+  for (int threads = 1;; threads = std::min(threads * 2, maxThreads)) {
+    auto r = run<Access>(pattern, threads, ops);
+    auto throughput = (double)threads * ops / r.elapsedNs;
+    if (threads == 1) {
+      singleThroughput = throughput;
+    }
+    printf("%-15s %-11s %7d %8.1f %10.2f %10.1f\n", Access::name(),
+           pattern.c_str(), threads, (double)r.elapsedNs / ops,
+           throughput / (threads * singleThroughput),
+           r.signals * 1e9 / r.elapsedNs);
+    if (threads >= maxThreads) {
+      break;
+    }
+  }
+}
+
+void usage() {
+  fprintf(stderr,
+          "usage: heap-benchmark [--threads N] [--ops N] "
+          "[--heap sysmalloc|sampleheap|threadspecific|custom] "
+          "[--pattern threadtest|larson|prodcons|python]\n");
+  exit(1);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+  uint64_t ops = 2000000;
+  std::vector<std::string> heaps = {"sysmalloc", "sampleheap",
+                                    "threadspecific", "custom"};
+  std::vector<std::string> patterns = {"threadtest", "larson", "prodcons",
+                                       "python"};
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--threads") && (i + 1 < argc)) {
+      maxThreads = std::min(MaxThreads, std::max(1, atoi(argv[++i])));
+    } else if (!strcmp(argv[i], "--ops") && (i + 1 < argc)) {
+      ops = std::max(2ULL, strtoull(argv[++i], nullptr, 10));
+    } else if (!strcmp(argv[i], "--heap") && (i + 1 < argc)) {
+      heaps = {argv[++i]};
+    } else if (!strcmp(argv[i], "--pattern") && (i + 1 < argc)) {
+      patterns = {argv[++i]};
+    } else {
+      usage();
+    }
+  }
+
+  // SampleHeap signals each malloc sample (as for the Python side).
+  signal(SampleHeapType::MallocSignal, countSignal);
+
+  printf("%-15s %-11s %7s %8s %10s %10s\n", "heap", "pattern", "threads",
+         "ns/op", "efficiency", "samples/s");
+  for (auto &heap : heaps) {
+    for (auto &pattern : patterns) {
+      if ((pattern != "threadtest") && (pattern != "larson") &&
+          (pattern != "prodcons") && (pattern != "python")) {
+        usage();
+      }
+      if (heap == "sysmalloc") {
+        benchmark<SysMallocAccess>(pattern, maxThreads, ops);
+      } else if (heap == "sampleheap") {
+        benchmark<SampleHeapAccess>(pattern, maxThreads, ops);
+      } else if (heap == "threadspecific") {
+        benchmark<ThreadSpecificAccess>(pattern, maxThreads, ops);
+      } else if (heap == "custom") {
+        benchmark<CustomAccess>(pattern, maxThreads, ops);
+      } else {
+        usage();
+      }
+    }
+  }
+
+  // Remove the files that SampleHeap (and its helpers) created.
+  for (auto name :
+       {"malloc-signal", "malloc-lock", "malloc-init", "control", "stacks"}) {
+    char path[256];
+    snprintf(path, sizeof(path), "/tmp/scalene-%s%d", name, getpid());
+    unlink(path);
+  }
+  return 0;
+}
@@ -1,8 +1,10 @@
 #define SCALENE_DISABLE_SIGNALS 0  // for debugging only
 
+#include <dlfcn.h>
 #include <execinfo.h>
 #include <heaplayers.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -13,10 +15,19 @@
 #endif
 
 #include "common.hpp"
+#include "gilwaitsampler.hpp"
 #include "heapredirect.h"
+#include "liveobjects.hpp"
+#include "lockwaitsampler.hpp"
 #include "memcpysampler.hpp"
+#include "mmaptracker.hpp"
+#include "numpyallocator.hpp"
+#include "pythonallocator.hpp"
 #include "sampleheap.hpp"
 #include "stprintf.h"
+#include "symbolizer.hpp"
+#include "threadcpusampler.hpp"
+#include "traceheap.hpp"
 #include "tprintf.h"
 
 #if defined(__APPLE__)
@@ -82,8 +93,9 @@ constexpr uint64_t MallocSamplingRate =
   1048571ULL;  // a prime number near a megabyte
 constexpr uint64_t MemcpySamplingRate = 2097169ULL; // another prime, near 2MB
 
-class CustomHeapType : public HL::ThreadSpecificHeap<
-                           SampleHeap<MallocSamplingRate, ScaleneBaseHeap>> {
+class CustomHeapType
+    : public HL::ThreadSpecificHeap<
+          TraceHeap<SampleHeap<MallocSamplingRate, ScaleneBaseHeap>>> {
  public:
   void lock() {}
   void unlock() {}
@@ -91,11 +103,261 @@ class CustomHeapType : public HL::ThreadSpecificHeap<
 
 HEAP_REDIRECT(CustomHeapType, 8 * 1024 * 1024);
 
+// When tracing allocations (see allocationtrace.hpp), give each forked
+// child its own trace file.
+static int registerTraceForkHandler = pthread_atfork(
+    nullptr, nullptr, []() { AllocationTrace::getInstance().afterFork(); });
+
+// Likewise for the stack table (see stacktable.hpp), whose file is
+// removed on exit.
+static int registerStackTableForkHandler = pthread_atfork(
+    nullptr, nullptr, []() { StackTable::afterFork(); });
+
+__attribute__((destructor)) static void removeStackTable() {
+  StackTable::removeFile();
+}
+
+// And for the control block (see controlblock.hpp).
+static int registerControlBlockForkHandler = pthread_atfork(
+    nullptr, nullptr, []() { ControlBlock::afterFork(); });
+
 auto &getSampler() {
   static MemcpySampler<MemcpySamplingRate> msamp;
   return msamp;
 }
 
+// Wraps Python's allocators, so that SampleHeap can tell which bytes
+// Python allocated (see pythonallocator.hpp). Called from Python, with
+// the GIL held (via ctypes.PyDLL).
+extern "C" ATTRIBUTE_EXPORT int scalene_install_python_allocator() {
+  return PythonAllocator::install();
+}
+
+// The NumPy memory handler that tags array data (see
+// numpyallocator.hpp), for Python to install.
+extern "C" ATTRIBUTE_EXPORT void *scalene_numpy_handler() {
+  return NumpyAllocator::handler();
+}
+
+#if defined(__linux__)
+auto &getThreadCPUSampler() {
+  static ThreadCPUSampler tsamp;
+  return tsamp;
+}
+
+// Exported so the Python side can control per-thread CPU sampling (via
+// ctypes).
+extern "C" ATTRIBUTE_EXPORT void scalene_enable_thread_cpu_sampling(
+    unsigned long interval_usec) {
+  getThreadCPUSampler().enable(interval_usec);
+}
+
+extern "C" ATTRIBUTE_EXPORT void scalene_disable_thread_cpu_sampling() {
+  getThreadCPUSampler().disable();
+}
+
+// Describes a code address as "function (shared object)".
+extern "C" ATTRIBUTE_EXPORT int scalene_symbolize(void *addr, char *buf,
+                                                  size_t len) {
+  return Symbolizer::getInstance().describe(addr, buf, len);
+}
+
+// Reports the sampled allocations still alive, by allocation site (see
+// LiveObjects::report).
+extern "C" ATTRIBUTE_EXPORT size_t scalene_live_allocation_sites(char *buf,
+                                                                 size_t len) {
+  return LiveObjects::getInstance().report(buf, len);
+}
+
+// Interpose on thread creation so that every new thread registers
+// itself (and gets its own CPU timer) before running any code.
+namespace {
+struct ThreadStart {
+  void *(*fn)(void *);
+  void *arg;
+};
+
+void *threadStartTrampoline(void *p) {
+  auto start = *reinterpret_cast<ThreadStart *>(p);
+  ::free(p);
+  getThreadCPUSampler().registerCurrentThread();
+  return start.fn(start.arg);
+}
+}  // namespace
+
+extern "C" ATTRIBUTE_EXPORT int pthread_create(pthread_t *thread,
+                                               const pthread_attr_t *attr,
+                                               void *(*fn)(void *),
+                                               void *arg) {
+  using pthread_create_t = int (*)(pthread_t *, const pthread_attr_t *,
+                                   void *(*)(void *), void *);
+  static auto real_pthread_create =
+      reinterpret_cast<pthread_create_t>(dlsym(RTLD_NEXT, "pthread_create"));
+  auto start = reinterpret_cast<ThreadStart *>(::malloc(sizeof(ThreadStart)));
+  if (start == nullptr) {
+    return real_pthread_create(thread, attr, fn, arg);
+  }
+  start->fn = fn;
+  start->arg = arg;
+  auto result = real_pthread_create(thread, attr, threadStartTrampoline, start);
+  if (result != 0) {
+    ::free(start);
+  }
+  return result;
+}
+
+constexpr uint64_t GILWaitSamplingRateNs = 1000000ULL;  // 1ms
+
+using GILWaitSamplerType = GILWaitSampler<GILWaitSamplingRateNs>;
+
+auto &getGILWaitSampler() {
+  static GILWaitSamplerType gsamp;
+  return gsamp;
+}
+
+extern "C" ATTRIBUTE_EXPORT void scalene_enable_gil_wait_sampling() {
+  getGILWaitSampler().enable();
+}
+
+extern "C" ATTRIBUTE_EXPORT void scalene_disable_gil_wait_sampling() {
+  getGILWaitSampler().disable();
+}
+
+constexpr uint64_t LockWaitSamplingRateNs =
+    1000003ULL;  // a prime number near a millisecond
+
+using LockWaitSamplerType = LockWaitSampler<LockWaitSamplingRateNs>;
+
+auto &getLockWaitSampler() {
+  static LockWaitSamplerType lsamp;
+  return lsamp;
+}
+
+extern "C" ATTRIBUTE_EXPORT void scalene_enable_lock_wait_sampling() {
+  getLockWaitSampler().enable();
+}
+
+extern "C" ATTRIBUTE_EXPORT void scalene_disable_lock_wait_sampling() {
+  getLockWaitSampler().disable();
+}
+
+// Interpose on pthread locks and condition variables: calls from the
+// interpreter (the GIL) go to the GIL wait sampler, and all others to
+// the lock wait sampler. These run before anything else is
+// initialized, so the real functions are looked up without a (guarded)
+// function-local static.
+namespace {
+template <typename Fn>
+inline Fn resolveNext(Fn &fn, const char *name) {
+  if (unlikely(fn == nullptr)) {
+    fn = reinterpret_cast<Fn>(dlsym(RTLD_NEXT, name));
+  }
+  return fn;
+}
+
+inline bool lockSamplingEnabled() {
+  return GILWaitSamplerType::isEnabled() || LockWaitSamplerType::isEnabled();
+}
+}  // namespace
+
+extern "C" ATTRIBUTE_EXPORT int pthread_mutex_lock(pthread_mutex_t *mutex) {
+  static int (*real_pthread_mutex_lock)(pthread_mutex_t *) = nullptr;
+  auto real = resolveNext(real_pthread_mutex_lock, "pthread_mutex_lock");
+  if (likely(!lockSamplingEnabled())) {
+    return real(mutex);
+  }
+  auto caller = __builtin_return_address(0);
+  if (InterpreterRange::contains(caller)) {
+    if (GILWaitSamplerType::isEnabled()) {
+      return getGILWaitSampler().mutexLock(real, mutex, caller);
+    }
+  } else if (LockWaitSamplerType::isEnabled()) {
+    return getLockWaitSampler().lock(pthread_mutex_trylock, real, mutex,
+                                     caller);
+  }
+  return real(mutex);
+}
+
+extern "C" ATTRIBUTE_EXPORT int pthread_cond_timedwait(
+    pthread_cond_t *cond, pthread_mutex_t *mutex,
+    const struct timespec *abstime) {
+  static int (*real_pthread_cond_timedwait)(
+      pthread_cond_t *, pthread_mutex_t *, const struct timespec *) = nullptr;
+  auto real =
+      resolveNext(real_pthread_cond_timedwait, "pthread_cond_timedwait");
+  if (likely(!GILWaitSamplerType::isEnabled())) {
+    return real(cond, mutex, abstime);
+  }
+  return getGILWaitSampler().condTimedWait(real, cond, mutex, abstime,
+                                           __builtin_return_address(0));
+}
+
+extern "C" ATTRIBUTE_EXPORT int pthread_rwlock_rdlock(pthread_rwlock_t *rw) {
+  static int (*real_pthread_rwlock_rdlock)(pthread_rwlock_t *) = nullptr;
+  auto real = resolveNext(real_pthread_rwlock_rdlock, "pthread_rwlock_rdlock");
+  if (likely(!LockWaitSamplerType::isEnabled())) {
+    return real(rw);
+  }
+  return getLockWaitSampler().lock(pthread_rwlock_tryrdlock, real, rw,
+                                   __builtin_return_address(0));
+}
+
+extern "C" ATTRIBUTE_EXPORT int pthread_rwlock_wrlock(pthread_rwlock_t *rw) {
+  static int (*real_pthread_rwlock_wrlock)(pthread_rwlock_t *) = nullptr;
+  auto real = resolveNext(real_pthread_rwlock_wrlock, "pthread_rwlock_wrlock");
+  if (likely(!LockWaitSamplerType::isEnabled())) {
+    return real(rw);
+  }
+  return getLockWaitSampler().lock(pthread_rwlock_trywrlock, real, rw,
+                                   __builtin_return_address(0));
+}
+
+// Anonymous memory mapped directly (bypassing malloc) is fed through
+// its own accounting heap's samplers.
+auto &getMmapTracker() {
+  static MmapTracker<SampleHeap<MallocSamplingRate, ScaleneBaseHeap>> tracker;
+  return tracker;
+}
+
+extern "C" ATTRIBUTE_EXPORT void *mmap(void *addr, size_t len, int prot,
+                                       int flags, int fd, off_t offset) {
+  static void *(*real_mmap)(void *, size_t, int, int, int, off_t) = nullptr;
+  auto real = resolveNext(real_mmap, "mmap");
+  return getMmapTracker().mmap(real, addr, len, prot, flags, fd, offset);
+}
+
+// Code built with _FILE_OFFSET_BITS=64 (like CPython and its extension
+// modules) calls mmap64 instead.
+extern "C" ATTRIBUTE_EXPORT void *mmap64(void *addr, size_t len, int prot,
+                                         int flags, int fd, off64_t offset) {
+  static void *(*real_mmap64)(void *, size_t, int, int, int, off64_t) =
+      nullptr;
+  auto real = resolveNext(real_mmap64, "mmap64");
+  return getMmapTracker().mmap(real, addr, len, prot, flags, fd, offset);
+}
+
+extern "C" ATTRIBUTE_EXPORT int munmap(void *addr, size_t len) {
+  static int (*real_munmap)(void *, size_t) = nullptr;
+  auto real = resolveNext(real_munmap, "munmap");
+  return getMmapTracker().munmap(real, addr, len);
+}
+
+extern "C" ATTRIBUTE_EXPORT void *mremap(void *oldAddr, size_t oldLen,
+                                         size_t newLen, int flags, ...) {
+  static void *(*real_mremap)(void *, size_t, size_t, int, ...) = nullptr;
+  auto real = resolveNext(real_mremap, "mremap");
+  void *newAddr = nullptr;
+  if (flags & MREMAP_FIXED) {
+    va_list ap;
+    va_start(ap, flags);
+    newAddr = va_arg(ap, void *);
+    va_end(ap);
+  }
+  return getMmapTracker().mremap(real, oldAddr, oldLen, newLen, flags,
+                                 newAddr);
+}
+#endif
+
 #if defined(__APPLE__)
 #define LOCAL_PREFIX(x) xx##x
 #else
@@ -0,0 +1,148 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <string>
+#include <vector>
+
+#include "pprofwriter.hpp"
+
+// Writes a gzip'd pprof profile (see include/pprofwriter.hpp).
+//
+// write(path, sample_types, period, time_nanos, duration_nanos, samples)
+//
+//   sample_types: list of (type, unit) pairs
+//   period: (type, unit, period)
+//   samples: any iterable of (frames, values), where frames is a list of
+//     (function, filename, line) tuples, leaf first, and values is a list
+//     of ints, one per sample type.
+//
+// Samples are consumed and written one at a time, so callers can pass a
+// generator rather than materializing every sample.
+
+static bool parse_frame(PyObject* obj, PprofWriter::Frame& frame) {
+  const char* function;
+  const char* filename;
+  long long line;
+  if (!PyArg_ParseTuple(obj, "ssL", &function, &filename, &line)) {
+    return false;
+  }
+  frame.function = function;
+  frame.filename = filename;
+  frame.line = line;
+  return true;
+}
+
+static bool write_sample(PprofWriter& writer, PyObject* sample,
+                         std::vector<PprofWriter::Frame>& frames,
+                         std::vector<int64_t>& values) {
+  PyObject* frames_obj;
+  PyObject* values_obj;
+  if (!PyArg_ParseTuple(sample, "OO", &frames_obj, &values_obj)) {
+    return false;
+  }
+  PyObject* frames_seq =
+      PySequence_Fast(frames_obj, "frames must be a sequence");
+  if (frames_seq == nullptr) {
+    return false;
+  }
+  auto nframes = PySequence_Fast_GET_SIZE(frames_seq);
+  frames.resize(nframes);
+  for (Py_ssize_t i = 0; i < nframes; i++) {
+    if (!parse_frame(PySequence_Fast_GET_ITEM(frames_seq, i), frames[i])) {
+      Py_DECREF(frames_seq);
+      return false;
+    }
+  }
+  Py_DECREF(frames_seq);
+  PyObject* values_seq =
+      PySequence_Fast(values_obj, "values must be a sequence");
+  if (values_seq == nullptr) {
+    return false;
+  }
+  auto nvalues = PySequence_Fast_GET_SIZE(values_seq);
+  values.resize(nvalues);
+  for (Py_ssize_t i = 0; i < nvalues; i++) {
+    values[i] = PyLong_AsLongLong(PySequence_Fast_GET_ITEM(values_seq, i));
+    if (PyErr_Occurred()) {
+      Py_DECREF(values_seq);
+      return false;
+    }
+  }
+  Py_DECREF(values_seq);
+  writer.addSample(frames, values);
+  return true;
+}
+
+static PyObject* pprof_write(PyObject* self, PyObject* args) {
+  const char* path;
+  PyObject* sample_types;
+  const char* period_type;
+  const char* period_unit;
+  long long period;
+  long long time_nanos;
+  long long duration_nanos;
+  PyObject* samples;
+  if (!PyArg_ParseTuple(args, "sO(ssL)LLO", &path, &sample_types,
+                        &period_type, &period_unit, &period, &time_nanos,
+                        &duration_nanos, &samples)) {
+    return NULL;
+  }
+  PprofWriter writer;
+  if (!writer.open(path)) {
+    return PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+  }
+  PyObject* types_seq =
+      PySequence_Fast(sample_types, "sample_types must be a sequence");
+  if (types_seq == nullptr) {
+    return NULL;
+  }
+  for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(types_seq); i++) {
+    const char* type;
+    const char* unit;
+    if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(types_seq, i), "ss", &type,
+                          &unit)) {
+      Py_DECREF(types_seq);
+      return NULL;
+    }
+    writer.addSampleType(type, unit);
+  }
+  Py_DECREF(types_seq);
+  writer.setPeriod(period_type, period_unit, period);
+  writer.setTime(time_nanos, duration_nanos);
+
+  PyObject* iter = PyObject_GetIter(samples);
+  if (iter == nullptr) {
+    return NULL;
+  }
+  // Reused across samples to avoid reallocating.
+  std::vector<PprofWriter::Frame> frames;
+  std::vector<int64_t> values;
+  PyObject* sample;
+  while ((sample = PyIter_Next(iter)) != nullptr) {
+    auto ok = write_sample(writer, sample, frames, values);
+    Py_DECREF(sample);
+    if (!ok) {
+      Py_DECREF(iter);
+      return NULL;
+    }
+  }
+  Py_DECREF(iter);
+  if (PyErr_Occurred()) {
+    return NULL;
+  }
+  if (!writer.close()) {
+    return PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+  }
+  Py_RETURN_NONE;
+}
+
+static PyMethodDef PprofExportMethods[] = {
+    {"write", pprof_write, METH_VARARGS, "writes a gzip'd pprof profile"},
+    {NULL, NULL, 0, NULL}};
+
+static struct PyModuleDef pprofexportmodule = {
+    PyModuleDef_HEAD_INIT, "pprof_export", NULL, -1, PprofExportMethods};
+
+PyMODINIT_FUNC PyInit_pprof_export(void) {
+  return PyModule_Create(&pprofexportmodule);
+}
@@ -0,0 +1,243 @@
+// sampler-eval: measures how well each Sampler policy (see
+// include/sampler.hpp) estimates the bytes allocated per site, and what
+// it costs, at several sampling rates.
+//
+//   sampler-eval [--trials N] [--rates R1,R2,...] [TRACE...]
+//
+// Each allocation stream (two synthetic ones, plus any allocation
+// traces given; see --trace-allocations) is fed through a fresh sampler
+// per trial, starting at a random phase. Every sample credits its
+// weight to the site of the allocation that triggered it, as
+// SampleHeap does. For each stream, policy and rate, reports:
+//
+//   samples  mean samples per trial
+//   ns/call  mean time per sample() call
+//   bias     |mean estimate - true bytes| / true bytes
+//   cv       standard deviation of the estimate / true bytes
+//   total    bias of the estimate of all bytes
+//
+// (bias and cv are per site, averaged over sites weighted by bytes.)
+// Traces carry no call sites, so there each power-of-two size class
+// stands in for a site.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "allocationtracereader.hpp"
+#include "common.hpp"
+#include "sampler.hpp"
+#include "timestamp.hpp"
+
+extern "C" void _putchar(char ch) { ::write(1, (void *)&ch, 1); }
+
+namespace {
+
+constexpr uint64_t MallocSamplingRate =
+    1048571ULL;  // as in libscalene.cpp
+
+struct Allocation {
+  uint32_t site;
+  uint32_t size;
+};
+
+struct Stream {
+  std::string name;
+  std::vector<Allocation> allocations;
+  std::vector<double> siteBytes;  // the truth
+  double totalBytes;
+
+  void add(uint32_t site, uint64_t size) {
+    if (site >= siteBytes.size()) {
+      siteBytes.resize(site + 1, 0);
+    }
+    // (Sizes beyond 4GB are clamped; they are sampled every time anyway.)
+    size = std::min<uint64_t>(size, UINT32_MAX);
+    allocations.push_back({site, (uint32_t)size});
+    siteBytes[site] += size;
+    totalBytes += size;
+  }
+};
+
+// Sites with log-uniformly distributed typical sizes (16B-64KB) and
+// Zipf-distributed popularity.
+Stream mixedStream() {
+  Stream s{"mixed", {}, {}, 0};
+  const int Sites = 64;
+  const int Allocations = 4000000;
+  std::mt19937_64 rng(42);
+  std::vector<double> sizes, weights;
+  std::uniform_real_distribution<double> unit(0, 1);
+  for (int i = 0; i < Sites; i++) {
+    sizes.push_back(16 * pow(4096, unit(rng)));
+    weights.push_back(1.0 / (i + 1));
+  }
+  std::discrete_distribution<int> site(weights.begin(), weights.end());
+  std::uniform_real_distribution<double> jitter(0.5, 1.5);
+  for (int i = 0; i < Allocations; i++) {
+    auto j = site(rng);
+    s.add(j, (uint64_t)(sizes[j] * jitter(rng)));
+  }
+  return s;
+}
+
+// A loop allocating the same sequence of sizes over and over, each from
+// its own site: the worst case for a fixed sampling interval, which can
+// fall into step with the loop.
+Stream periodicStream() {
+  Stream s{"periodic", {}, {}, 0};
+  const uint64_t Sizes[] = {32, 32, 64, 4096, 32, 256, 131072};
+  const int Iterations = 30000;
+  for (int i = 0; i < Iterations; i++) {
+    for (uint32_t j = 0; j < sizeof(Sizes) / sizeof(Sizes[0]); j++) {
+      s.add(j, Sizes[j]);
+    }
+  }
+  return s;
+}
+
+bool traceStream(const char *filename, Stream &s) {
+  std::vector<AllocationTraceReader::Event> events;
+  uint64_t truncatedChunks;
+  if (!AllocationTraceReader::read(filename, events, truncatedChunks)) {
+    return false;
+  }
+  auto name = strrchr(filename, '/');
+  s.name = name ? name + 1 : filename;
+  s.totalBytes = 0;
+  for (auto &e : events) {
+    if (e.op != AllocationTrace::Free) {
+      // The size class: the position of the highest bit set.
+      s.add(e.size ? 64 - __builtin_clzll(e.size) : 0, e.size);
+    }
+  }
+  return true;
+}
+
+struct Evaluation {
+  double samples;
+  double nsPerCall;
+  double bias;
+  double cv;
+  double totalBias;
+};
+
+template <class Intervals>
+Evaluation evaluate(const Stream &stream, uint64_t rate, int trials) {
+  auto sites = stream.siteBytes.size();
+  std::vector<double> sum(sites, 0), sumSquares(sites, 0);
+  std::vector<double> estimate(sites);
+  double samples = 0, elapsedNs = 0, totalSum = 0;
+  for (int t = 0; t < trials; t++) {
+    auto seed = 1234567890UL + rate + t * 7919UL;
+    Sampler<MallocSamplingRate, Intervals> sampler(seed);
+    sampler.setRate(rate);
+    // Finish the first interval (at the default rate), then start the
+    // stream at a random point in the next.
+    while (!sampler.sample(4096)) {
+    }
+    std::mt19937_64 rng(seed);
+    sampler.sample(std::uniform_int_distribution<uint64_t>(0, rate - 1)(rng));
+
+    std::fill(estimate.begin(), estimate.end(), 0);
+    auto start = Timestamp::clockNs();
+    for (auto &a : stream.allocations) {
+      auto weight = sampler.sample(a.size);
+      if (unlikely(weight)) {
+        estimate[a.site] += weight;
+        samples++;
+      }
+    }
+    elapsedNs += Timestamp::clockNs() - start;
+    for (size_t i = 0; i < sites; i++) {
+      sum[i] += estimate[i];
+      sumSquares[i] += estimate[i] * estimate[i];
+      totalSum += estimate[i];
+    }
+  }
+  Evaluation e{samples / trials,
+               elapsedNs / trials / stream.allocations.size(), 0, 0, 0};
+  for (size_t i = 0; i < sites; i++) {
+    auto truth = stream.siteBytes[i];
+    if (truth == 0) {
+      continue;
+    }
+    auto mean = sum[i] / trials;
+    auto variance = std::max(0.0, sumSquares[i] / trials - mean * mean);
+    auto share = truth / stream.totalBytes;
+    e.bias += share * fabs(mean - truth) / truth;
+    e.cv += share * sqrt(variance) / truth;
+  }
+  e.totalBias =
+      fabs(totalSum / trials - stream.totalBytes) / stream.totalBytes;
+  return e;
+}
+
+void report(const Stream &stream, const char *policy, uint64_t rate,
+            const Evaluation &e) {
+  printf("%-12s %-14s %9lu %10.0f %8.2f %7.4f %7.4f %7.4f\n",
+         stream.name.c_str(), policy, (unsigned long)rate, e.samples,
+         e.nsPerCall, e.bias, e.cv, e.totalBias);
+}
+
+void usage() {
+  fprintf(stderr,
+          "usage: sampler-eval [--trials N] [--rates R1,R2,...] [TRACE...]\n");
+  exit(1);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  int trials = 20;
+  std::vector<uint64_t> rates = {MallocSamplingRate / 4, MallocSamplingRate,
+                                 MallocSamplingRate * 4};
+  std::vector<Stream> streams = {mixedStream(), periodicStream()};
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--trials") && (i + 1 < argc)) {
+      trials = std::max(2, atoi(argv[++i]));
+    } else if (!strcmp(argv[i], "--rates") && (i + 1 < argc)) {
+      rates.clear();
+      for (auto p = argv[++i]; *p;) {
+        char *end;
+        auto rate = strtoull(p, &end, 10);
+        if ((end == p) || (rate == 0)) {
+          usage();
+        }
+        rates.push_back(rate);
+        p = (*end == ',') ? end + 1 : end;
+      }
+    } else if (argv[i][0] != '-') {
+      Stream s{"", {}, {}, 0};
+      if (!traceStream(argv[i], s)) {
+        return 1;
+      }
+      streams.push_back(s);
+    } else {
+      usage();
+    }
+  }
+
+  printf("%-12s %-14s %9s %10s %8s %7s %7s %7s\n", "stream", "policy", "rate",
+         "samples", "ns/call", "bias", "cv", "total");
+  for (auto &stream : streams) {
+    for (auto rate : rates) {
+      report(stream, "deterministic", rate,
+             evaluate<DeterministicIntervals>(stream, rate, trials));
+      report(stream, "geometric", rate,
+             evaluate<GeometricIntervals<std::mt19937_64>>(stream, rate,
+                                                           trials));
+      report(stream, "lowdiscrepancy", rate,
+             evaluate<GeometricIntervals<LowDiscrepancy>>(stream, rate,
+                                                          trials));
+    }
+  }
+  return 0;
+}
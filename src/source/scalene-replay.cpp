@@ -0,0 +1,268 @@
+// scalene-replay: re-executes an allocation trace (recorded with
+// SCALENE_TRACE; see include/allocationtrace.hpp) against a choice of
+// allocator, so that allocators and sampling settings can be compared
+// offline on a real workload.
+//
+//   scalene-replay [--heap glibc|sampleheap|repoman] [--repeat N] TRACE
+//
+// The events of all threads are merged into one time-ordered stream
+// and replayed on a single thread. Reports the time per operation, the
+// peak bytes live (as requested), and the peak growth in RSS.
+
+#include <heaplayers.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "allocationtrace.hpp"
+#include "allocationtracereader.hpp"
+#include "common.hpp"
+#include "processmemory.hpp"
+#include "tprintf.h"  // (needed by repo.hpp)
+#include "repoman.hpp"
+#include "reposource.hpp"
+#include "sampleheap.hpp"
+#include "timestamp.hpp"
+
+extern "C" void _putchar(char ch) { ::write(1, (void *)&ch, 1); }
+
+namespace {
+
+constexpr uint64_t MallocSamplingRate =
+    1048571ULL;  // as in libscalene.cpp
+
+// An event ready to replay: pointers are replaced by dense ids (slots).
+struct Operation {
+  AllocationTrace::Op op;
+  uint32_t id;
+  uint64_t size;
+  uint64_t alignment;
+};
+
+struct Trace {
+  std::vector<Operation> operations;
+  uint32_t ids;
+  uint64_t peakBytes;          // live, as requested
+  uint64_t unmatchedFrees;     // of objects allocated before tracing began
+  uint64_t truncatedChunks;
+};
+
+bool readTrace(const char *filename, Trace &trace) {
+  std::vector<AllocationTraceReader::Event> events;
+  if (!AllocationTraceReader::read(filename, events, trace.truncatedChunks)) {
+    return false;
+  }
+  std::unordered_map<uint64_t, std::pair<uint32_t, uint64_t>> live;
+  std::vector<uint32_t> freeIds;
+  uint64_t liveBytes = 0;
+  trace.ids = 0;
+  trace.peakBytes = 0;
+  trace.unmatchedFrees = 0;
+  trace.operations.reserve(events.size());
+  for (auto &e : events) {
+    auto it = live.find(e.ptr);
+    if (e.op == AllocationTrace::Free) {
+      if (it == live.end()) {
+        trace.unmatchedFrees++;
+        continue;
+      }
+      trace.operations.push_back({e.op, it->second.first, 0, 0});
+      liveBytes -= it->second.second;
+      freeIds.push_back(it->second.first);
+      live.erase(it);
+      continue;
+    }
+    if (it != live.end()) {
+      // The free was lost (e.g., in a truncated chunk): free it here.
+      trace.operations.push_back(
+          {AllocationTrace::Free, it->second.first, 0, 0});
+      liveBytes -= it->second.second;
+      freeIds.push_back(it->second.first);
+      live.erase(it);
+    }
+    uint32_t id;
+    if (freeIds.empty()) {
+      id = trace.ids++;
+    } else {
+      id = freeIds.back();
+      freeIds.pop_back();
+    }
+    live[e.ptr] = {id, e.size};
+    liveBytes += e.size;
+    trace.peakBytes = std::max(trace.peakBytes, liveBytes);
+    trace.operations.push_back({e.op, id, e.size, e.alignment});
+  }
+  return true;
+}
+
+struct Result {
+  uint64_t elapsedNs;
+  uint64_t peakRssGrowth;
+};
+
+template <class Heap>
+Result replay(Heap &heap, const Trace &trace) {
+  std::vector<void *> slots(trace.ids, nullptr);
+  auto &pm = ProcessMemory::getInstance();
+  auto baseRss = pm.get().rssBytes;
+  uint64_t peakRss = baseRss;
+  auto start = Timestamp::clockNs();
+  size_t n = 0;
+  for (auto &op : trace.operations) {
+    switch (op.op) {
+      case AllocationTrace::Malloc:
+        slots[op.id] = heap.malloc(op.size);
+        break;
+      case AllocationTrace::Memalign:
+        slots[op.id] = heap.memalign(op.alignment, op.size);
+        break;
+      case AllocationTrace::Free:
+        heap.free(slots[op.id]);
+        slots[op.id] = nullptr;
+        break;
+    }
+    if (unlikely((++n & 4095) == 0)) {
+      // (ProcessMemory itself re-reads RSS at most every 10ms.)
+      peakRss = std::max(peakRss, pm.get().rssBytes);
+    }
+  }
+  auto elapsed = Timestamp::clockNs() - start;
+  for (auto ptr : slots) {
+    if (ptr) {
+      heap.free(ptr);
+    }
+  }
+  return {elapsed, peakRss - baseRss};
+}
+
+class GlibcHeap {
+ public:
+  void *malloc(size_t sz) { return ::malloc(sz); }
+  void free(void *ptr) { ::free(ptr); }
+  void *memalign(size_t alignment, size_t sz) {
+    return ::memalign(alignment, sz);
+  }
+};
+
+// RepoMan has no memalign: over-allocate and align within the object.
+// (The original pointer is what gets freed, so keep it in a header.)
+class RepoManHeap {
+ public:
+  void *malloc(size_t sz) { return _heap.malloc(sz); }
+  void free(void *ptr) {
+    if (unlikely(isAligned(ptr))) {
+      ptr = reinterpret_cast<void **>(ptr)[-1];
+    }
+    _heap.free(ptr);
+  }
+  void *memalign(size_t alignment, size_t sz) {
+    auto base = reinterpret_cast<char *>(
+        _heap.malloc(sz + alignment + 2 * sizeof(void *)));
+    if (base == nullptr) {
+      return nullptr;
+    }
+    auto ptr = reinterpret_cast<void **>(
+        ((uintptr_t)base + 2 * sizeof(void *) + alignment - 1) &
+        ~(uintptr_t)(alignment - 1));
+    ptr[-1] = base;
+    ptr[-2] = reinterpret_cast<void *>(AlignedMagic ^ (uintptr_t)ptr);
+    return ptr;
+  }
+
+ private:
+  static constexpr uintptr_t AlignedMagic = 0x5ca1e5ca1e5ca1eULL;
+  static bool isAligned(void *ptr) {
+    return ptr && (reinterpret_cast<uintptr_t *>(ptr)[-2] ==
+                   (AlignedMagic ^ (uintptr_t)ptr));
+  }
+  RepoMan<4096, RepoSource> _heap;
+};
+
+void usage() {
+  fprintf(stderr,
+          "usage: scalene-replay [--heap glibc|sampleheap|repoman] "
+          "[--repeat N] TRACE\n");
+  exit(1);
+}
+
+void report(const char *heapName, const Trace &trace, const Result &r) {
+  auto ops = trace.operations.size();
+  printf("%s: %lu ops in %.3f ms (%.1f ns/op); peak live %.1f MB, "
+         "peak RSS growth %.1f MB\n",
+         heapName, (unsigned long)ops, r.elapsedNs / 1e6,
+         ops ? (double)r.elapsedNs / ops : 0.0, trace.peakBytes / 1048576.0,
+         r.peakRssGrowth / 1048576.0);
+}
+
+template <class Heap>
+void run(const char *heapName, Heap &heap, const Trace &trace, int repeat) {
+  for (int i = 0; i < repeat; i++) {
+    report(heapName, trace, replay(heap, trace));
+  }
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  std::string heapName = "glibc";
+  int repeat = 1;
+  const char *filename = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--heap") && (i + 1 < argc)) {
+      heapName = argv[++i];
+    } else if (!strcmp(argv[i], "--repeat") && (i + 1 < argc)) {
+      repeat = std::max(1, atoi(argv[++i]));
+    } else if ((argv[i][0] != '-') && !filename) {
+      filename = argv[i];
+    } else {
+      usage();
+    }
+  }
+  if (!filename) {
+    usage();
+  }
+
+  Trace trace;
+  if (!readTrace(filename, trace)) {
+    return 1;
+  }
+  if (trace.unmatchedFrees || trace.truncatedChunks) {
+    fprintf(stderr,
+            "scalene-replay: skipped %lu frees of untraced objects; "
+            "%lu chunks truncated\n",
+            (unsigned long)trace.unmatchedFrees,
+            (unsigned long)trace.truncatedChunks);
+  }
+
+  if (heapName == "glibc") {
+    GlibcHeap heap;
+    run(heapName.c_str(), heap, trace, repeat);
+  } else if (heapName == "sampleheap") {
+    {
+      // As in libscalene, but over the system allocator.
+      auto *heap = new SampleHeap<MallocSamplingRate, HL::SysMallocHeap>;
+      run(heapName.c_str(), *heap, trace, repeat);
+      delete heap;
+    }
+    // Remove the files that SampleHeap (and its helpers) created.
+    for (auto name : {"malloc-lock", "control", "stacks"}) {
+      char path[256];
+      snprintf(path, sizeof(path), "/tmp/scalene-%s%d", name, getpid());
+      unlink(path);
+    }
+  } else if (heapName == "repoman") {
+    auto *heap = new RepoManHeap;
+    run(heapName.c_str(), *heap, trace, repeat);
+  } else {
+    usage();
+  }
+  return 0;
+}
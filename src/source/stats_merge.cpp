@@ -0,0 +1,367 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Merges the statistics files that child processes leave (see
+// scalene/scalene_statsfile.py for the format), adding up the counters
+// of rows with the same key.
+//
+// merge(paths) -> (merged, extras)
+//   merged: the merged tables, in the same format (with no extras)
+//   extras: each file's extras, in order
+//
+// Files are mapped and folded in one at a time, so the memory used is
+// that of the distinct rows (and strings), however many files there
+// are. The GIL is released while merging.
+
+namespace {
+
+constexpr char Magic[8] = {'S', 'C', 'L', 'S', 'T', 'A', 'T', 'S'};
+constexpr uint16_t Version = 1;
+
+enum Kind : uint16_t { Line = 0, Bytecode = 1, Label = 2 };
+
+#pragma pack(push, 1)
+struct Header {
+  char magic[8];
+  uint16_t version;
+  uint16_t ntables;
+  uint32_t nstrings;
+  uint64_t stringsSize;
+  uint64_t extrasSize;
+};
+
+struct TableHeader {
+  uint16_t kind;
+  uint16_t ncounters;
+  uint32_t reserved;
+  uint64_t nrows;
+};
+#pragma pack(pop)
+
+inline uint64_t pad(uint64_t n) { return (n + 7) & ~7ULL; }
+
+struct Key {
+  uint32_t file;
+  uint32_t line;
+  int64_t subkey;
+  bool operator==(const Key& k) const {
+    return (file == k.file) && (line == k.line) && (subkey == k.subkey);
+  }
+};
+
+struct KeyHash {
+  // (splitmix64's finalizer, over the fields)
+  size_t operator()(const Key& k) const {
+    uint64_t h = ((uint64_t)k.file << 32) ^ k.line;
+    h ^= (uint64_t)k.subkey * 0x9e3779b97f4a7c15ULL;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+  }
+};
+
+struct Table {
+  uint16_t kind;
+  uint16_t ncounters;
+  std::unordered_map<Key, size_t, KeyHash> rows;  // -> index in keys
+  std::vector<Key> keys;
+  std::vector<double> counters;  // ncounters per row
+
+  // NaN marks a missing entry: it adds as zero, unless both are missing.
+  void add(const Key& key, const double* values) {
+    auto it = rows.emplace(key, keys.size());
+    if (it.second) {
+      keys.push_back(key);
+      counters.insert(counters.end(), values, values + ncounters);
+      return;
+    }
+    auto row = &counters[it.first->second * ncounters];
+    for (int i = 0; i < ncounters; i++) {
+      if (std::isnan(row[i])) {
+        row[i] = values[i];
+      } else if (!std::isnan(values[i])) {
+        row[i] += values[i];
+      }
+    }
+  }
+};
+
+class Merger {
+ public:
+  // @return an error message, or an empty string on success.
+  std::string add(const std::string& path) {
+    auto fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+      return path + ": " + strerror(errno);
+    }
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(Header))) {
+      close(fd);
+      return path + ": not a Scalene stats file";
+    }
+    auto base = reinterpret_cast<const char*>(
+        mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+    close(fd);
+    if (base == MAP_FAILED) {
+      return path + ": " + strerror(errno);
+    }
+    auto error = addMapped(base, st.st_size);
+    munmap((void*)base, st.st_size);
+    return error.empty() ? error : path + ": " + error;
+  }
+
+  // The merged tables, in the file format.
+  std::string encode() const {
+    std::string out;
+    Header header;
+    memcpy(header.magic, Magic, sizeof(Magic));
+    header.version = Version;
+    header.ntables = _tables.size();
+    header.nstrings = _strings.size();
+    header.stringsSize = 0;
+    header.extrasSize = 0;
+    for (auto& s : _strings) {
+      header.stringsSize += sizeof(uint32_t) + s.size();
+    }
+    header.stringsSize = pad(header.stringsSize);
+    append(out, &header, sizeof(header));
+    auto start = out.size();
+    for (auto& s : _strings) {
+      uint32_t length = s.size();
+      append(out, &length, sizeof(length));
+      out += s;
+    }
+    out.resize(start + header.stringsSize, '\0');
+    for (auto& t : _tables) {
+      TableHeader th{t.kind, t.ncounters, 0, t.keys.size()};
+      append(out, &th, sizeof(th));
+      std::vector<uint32_t> u32(t.keys.size());
+      for (size_t i = 0; i < t.keys.size(); i++) {
+        u32[i] = t.keys[i].file;
+      }
+      appendColumn(out, u32.data(), u32.size() * sizeof(uint32_t));
+      for (size_t i = 0; i < t.keys.size(); i++) {
+        u32[i] = t.keys[i].line;
+      }
+      appendColumn(out, u32.data(), u32.size() * sizeof(uint32_t));
+      if (t.kind != Line) {
+        std::vector<int64_t> subkeys(t.keys.size());
+        for (size_t i = 0; i < t.keys.size(); i++) {
+          subkeys[i] = t.keys[i].subkey;
+        }
+        appendColumn(out, subkeys.data(), subkeys.size() * sizeof(int64_t));
+      }
+      std::vector<double> column(t.keys.size());
+      for (int c = 0; c < t.ncounters; c++) {
+        for (size_t i = 0; i < t.keys.size(); i++) {
+          column[i] = t.counters[i * t.ncounters + c];
+        }
+        appendColumn(out, column.data(), column.size() * sizeof(double));
+      }
+    }
+    return out;
+  }
+
+  std::vector<std::string> extras;
+
+ private:
+  std::string addMapped(const char* base, size_t size) {
+    Header header;
+    memcpy(&header, base, sizeof(header));
+    if ((memcmp(header.magic, Magic, sizeof(Magic)) != 0) ||
+        (header.version != Version)) {
+      return "not a Scalene stats file (or an unsupported version)";
+    }
+    if (_tables.empty()) {
+      _tables.resize(header.ntables);
+    } else if (_tables.size() != header.ntables) {
+      return "tables differ from the other files'";
+    }
+    auto p = base + sizeof(header);
+    auto end = base + size;
+    // Map this file's strings to ours.
+    std::vector<uint32_t> strings(header.nstrings);
+    if (header.stringsSize > (uint64_t)(end - p)) {
+      return "truncated";
+    }
+    auto stringsEnd = p + header.stringsSize;
+    for (auto& id : strings) {
+      uint32_t length;
+      if ((size_t)(stringsEnd - p) < sizeof(length)) {
+        return "truncated";
+      }
+      memcpy(&length, p, sizeof(length));
+      p += sizeof(length);
+      if ((size_t)(stringsEnd - p) < length) {
+        return "truncated";
+      }
+      id = intern(std::string(p, length));
+      p += length;
+    }
+    p = stringsEnd;
+
+    std::vector<double> values;
+    for (auto& t : _tables) {
+      TableHeader th;
+      if ((size_t)(end - p) < sizeof(th)) {
+        return "truncated";
+      }
+      memcpy(&th, p, sizeof(th));
+      p += sizeof(th);
+      if (t.keys.empty() && t.rows.empty() && (t.ncounters == 0)) {
+        t.kind = th.kind;
+        t.ncounters = th.ncounters;
+      } else if ((t.kind != th.kind) || (t.ncounters != th.ncounters)) {
+        return "tables differ from the other files'";
+      }
+      auto n = th.nrows;
+      if (n > size) {
+        return "truncated";
+      }
+      auto keysSize = 2 * pad(n * sizeof(uint32_t)) +
+                      ((th.kind != Line) ? pad(n * sizeof(int64_t)) : 0);
+      auto countersSize = th.ncounters * pad(n * sizeof(double));
+      if ((uint64_t)(end - p) < keysSize + countersSize) {
+        return "truncated";
+      }
+      auto files = p;
+      auto lines = files + pad(n * sizeof(uint32_t));
+      auto subkeys = lines + pad(n * sizeof(uint32_t));
+      auto counters = files + keysSize;
+      p = counters + countersSize;
+      values.resize(th.ncounters);
+      for (uint64_t i = 0; i < n; i++) {
+        Key key;
+        uint32_t file;
+        memcpy(&file, files + i * sizeof(uint32_t), sizeof(file));
+        memcpy(&key.line, lines + i * sizeof(uint32_t), sizeof(key.line));
+        key.subkey = 0;
+        if (th.kind != Line) {
+          memcpy(&key.subkey, subkeys + i * sizeof(int64_t),
+                 sizeof(key.subkey));
+        }
+        if ((file >= strings.size()) ||
+            ((th.kind == Label) && ((uint64_t)key.subkey >= strings.size()))) {
+          return "bad string index";
+        }
+        key.file = strings[file];
+        if (th.kind == Label) {
+          key.subkey = strings[key.subkey];
+        }
+        for (int c = 0; c < th.ncounters; c++) {
+          memcpy(&values[c], counters + c * pad(n * sizeof(double)) +
+                                 i * sizeof(double),
+                 sizeof(double));
+        }
+        t.add(key, values.data());
+      }
+    }
+    if ((uint64_t)(end - p) < header.extrasSize) {
+      return "truncated";
+    }
+    extras.emplace_back(p, header.extrasSize);
+    return "";
+  }
+
+  uint32_t intern(const std::string& s) {
+    auto it = _stringIds.emplace(s, _strings.size());
+    if (it.second) {
+      _strings.push_back(s);
+    }
+    return it.first->second;
+  }
+
+  static void append(std::string& out, const void* data, size_t size) {
+    out.append(reinterpret_cast<const char*>(data), size);
+  }
+
+  static void appendColumn(std::string& out, const void* data, size_t size) {
+    append(out, data, size);
+    out.resize(out.size() + pad(size) - size, '\0');
+  }
+
+  std::vector<Table> _tables;
+  std::vector<std::string> _strings;
+  std::unordered_map<std::string, uint32_t> _stringIds;
+};
+
+PyObject* merge(PyObject*, PyObject* args) {
+  PyObject* pathsObj;
+  if (!PyArg_ParseTuple(args, "O", &pathsObj)) {
+    return nullptr;
+  }
+  auto seq = PySequence_Fast(pathsObj, "paths must be a sequence");
+  if (seq == nullptr) {
+    return nullptr;
+  }
+  std::vector<std::string> paths;
+  for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+    auto path = PyUnicode_AsUTF8(PySequence_Fast_GET_ITEM(seq, i));
+    if (path == nullptr) {
+      Py_DECREF(seq);
+      return nullptr;
+    }
+    paths.push_back(path);
+  }
+  Py_DECREF(seq);
+
+  Merger merger;
+  std::string error;
+  std::string merged;
+  Py_BEGIN_ALLOW_THREADS;
+  for (auto& path : paths) {
+    error = merger.add(path);
+    if (!error.empty()) {
+      break;
+    }
+  }
+  if (error.empty()) {
+    merged = merger.encode();
+  }
+  Py_END_ALLOW_THREADS;
+  if (!error.empty()) {
+    PyErr_SetString(PyExc_ValueError, error.c_str());
+    return nullptr;
+  }
+
+  auto extras = PyList_New(merger.extras.size());
+  if (extras == nullptr) {
+    return nullptr;
+  }
+  for (size_t i = 0; i < merger.extras.size(); i++) {
+    auto e = PyBytes_FromStringAndSize(merger.extras[i].data(),
+                                       merger.extras[i].size());
+    if (e == nullptr) {
+      Py_DECREF(extras);
+      return nullptr;
+    }
+    PyList_SET_ITEM(extras, i, e);
+  }
+  auto result = Py_BuildValue("(y#N)", merged.data(),
+                              (Py_ssize_t)merged.size(), extras);
+  return result;
+}
+
+PyMethodDef methods[] = {
+    {"merge", merge, METH_VARARGS,
+     "Merges statistics files: returns the merged tables (in the same "
+     "format) and each file's extras."},
+    {nullptr, nullptr, 0, nullptr}};
+
+struct PyModuleDef module = {PyModuleDef_HEAD_INIT, "stats_merge", nullptr,
+                             -1, methods};
+
+}  // namespace
+
+PyMODINIT_FUNC PyInit_stats_merge() { return PyModule_Create(&module); }
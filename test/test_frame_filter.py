@@ -0,0 +1,73 @@
+import os
+import subprocess
+import sys
+import textwrap
+import threading
+
+import pytest
+
+frame_filter = pytest.importorskip("frame_filter")
+
+# Threads come and go while should_trace releases the GIL (which used to
+# leave frames_to_record reading freed thread states).
+CHURN = textwrap.dedent(
+    """
+    import threading
+    import time
+
+    import frame_filter
+
+    def should_trace(filename):
+        time.sleep(0.0005)  # (releases the GIL)
+        return False
+
+    def work():
+        time.sleep(0.001)
+
+    frame_filter.set_should_trace(should_trace)
+    stop = False
+
+    def churn():
+        while not stop:
+            t = threading.Thread(target=work)
+            t.start()
+            t.join()
+
+    churners = [threading.Thread(target=churn) for _ in range(8)]
+    for t in churners:
+        t.start()
+    main = threading.main_thread().ident
+    for _ in range(300):
+        frame_filter.frames_to_record(main, threading._active)
+        frame_filter.clear()
+    stop = True
+    for t in churners:
+        t.join()
+    print("ok")
+    """
+)
+
+
+def test_frames_to_record_with_thread_churn():
+    env = dict(os.environ)
+    env["PYTHONMALLOC"] = "debug"
+    env["PYTHONPATH"] = os.pathsep.join(p for p in sys.path if p)
+    result = subprocess.run(
+        [sys.executable, "-c", CHURN],
+        env=env,
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+        timeout=300,
+    )
+    assert result.returncode == 0, result.stderr.decode()
+    assert result.stdout.decode().strip() == "ok"
+
+
+def test_frames_to_record_skips_unknown_threads():
+    frame_filter.set_should_trace(lambda filename: True)
+    main = threading.main_thread().ident
+    frames = frame_filter.frames_to_record(main, {})
+    assert frames == []
+    frames = frame_filter.frames_to_record(main, {main: None})
+    assert [ident for (_, ident, _) in frames] == [main]
+
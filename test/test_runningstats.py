@@ -0,0 +1,102 @@
+import importlib.util
+import math
+import pickle
+import random
+import sys
+
+import pytest
+
+from scalene.runningstats import RunningStats
+
+
+def python_runningstats():
+    """The pure-Python RunningStats, even if the native one is built."""
+    saved = sys.modules.get("accumulators")
+    sys.modules["accumulators"] = None  # type: ignore
+    try:
+        spec = importlib.util.find_spec("scalene.runningstats")
+        module = importlib.util.module_from_spec(spec)
+        spec.loader.exec_module(module)
+    finally:
+        if saved is None:
+            del sys.modules["accumulators"]
+        else:
+            sys.modules["accumulators"] = saved
+    return module.RunningStats
+
+
+def implementations():
+    impls = [python_runningstats()]
+    try:
+        from accumulators import RunningStats as NativeRunningStats
+
+        impls.append(NativeRunningStats)
+    except ImportError:
+        pass
+    return impls
+
+
+def statistics(s):
+    return [s.size(), s.mean(), s.var(), s.skewness(), s.kurtosis()]
+
+
+def assert_close(a, b):
+    for (x, y) in zip(statistics(a), statistics(b)):
+        assert x == pytest.approx(y, rel=1e-9, abs=1e-9)
+
+
+def samples(n, seed):
+    rng = random.Random(seed)
+    return [rng.expovariate(1.0) for _ in range(n)]
+
+
+@pytest.mark.parametrize("cls", implementations())
+def test_merge_matches_one_accumulator(cls):
+    xs = samples(1000, 1)
+    whole = cls()
+    for x in xs:
+        whole.push(x)
+    # Merge uneven parts, including an empty one.
+    merged = cls()
+    for (start, end) in [(0, 0), (0, 7), (7, 300), (300, 1000)]:
+        part = cls()
+        for x in xs[start:end]:
+            part.push(x)
+        merged += part
+    assert_close(merged, whole)
+    assert_close(cls() + whole, whole)
+
+
+@pytest.mark.parametrize("cls", implementations())
+def test_skewness_with_few_samples(cls):
+    s = cls()
+    assert s.skewness() == 0.0
+    s.push(3.0)
+    assert s.skewness() == 0.0
+    s.push(5.0)
+    assert math.isfinite(s.skewness())
+
+
+def test_pickle():
+    # (Whichever implementation is in use.)
+    s = RunningStats()
+    for x in samples(100, 2):
+        s.push(x)
+    assert_close(pickle.loads(pickle.dumps(s)), s)
+
+
+def test_native_matches_python():
+    impls = implementations()
+    if len(impls) < 2:
+        pytest.skip("accumulators is not built")
+    (py, native) = impls
+    xs = samples(500, 3)
+    a = py()
+    b = native()
+    for x in xs:
+        a.push(x)
+        b.push(x)
+    assert_close(a, b)
+    assert (a.m1, a.m2, a.m3, a.m4) == pytest.approx(
+        (b.m1, b.m2, b.m3, b.m4), rel=1e-12
+    )
@@ -0,0 +1,83 @@
+import pytest
+
+from scalene.scalene_snapshot import decode_snapshot, encode_snapshot
+from scalene.scalene_statistics import ScaleneStatistics
+
+
+@pytest.fixture(name="stats")
+def statistics() -> ScaleneStatistics:
+    stats = ScaleneStatistics()
+    stats.total_cpu_samples = 12.5
+    stats.current_footprint = 3.0
+    stats.max_footprint = 8.0
+    stats.max_rss = 9.5
+    stats.page_faults = (100, 2)
+    stats.cpu_samples_python["a.py"][1] = 1.5
+    stats.cpu_samples_c["a.py"][1] = 0.5
+    stats.memory_malloc_samples["a.py"][2][4] = 2.0
+    stats.memory_malloc_samples["a.py"][2][8] = 1.0
+    stats.memory_python_samples["a.py"][2][4] = 0.5
+    stats.memory_free_samples["a.py"][3][0] = 1.25
+    stats.gil_wait_samples["a.py"][1] = 0.25
+    stats.lock_wait_samples["a.py"][5]["pthread_mutex_lock (libc)"] = 0.75
+    # Files with only memcpy or GPU samples.
+    stats.memcpy_samples["b.py"][7] = 3
+    stats.gpu_samples["c.py"][9] = 0.125
+    return stats
+
+
+def test_round_trip(stats):
+    snapshot = decode_snapshot(encode_snapshot(stats, 10.0, 12.5))
+    assert snapshot["window_start"] == 10.0
+    assert snapshot["window_end"] == 12.5
+    assert snapshot["elapsed_time"] == 2.5
+    assert snapshot["total_cpu_samples"] == 12.5
+    assert snapshot["max_footprint"] == 8.0
+    assert snapshot["page_faults"] == (100, 2)
+    lines = snapshot["lines"]
+    assert set(lines) == {
+        ("a.py", 1),
+        ("a.py", 2),
+        ("a.py", 3),
+        ("a.py", 5),
+        ("b.py", 7),
+        ("c.py", 9),
+    }
+    assert lines[("a.py", 1)]["cpu_python"] == 1.5
+    assert lines[("a.py", 1)]["cpu_c"] == 0.5
+    assert lines[("a.py", 1)]["gil_wait"] == 0.25
+    assert lines[("a.py", 2)]["malloc_mb"] == 3.0
+    assert lines[("a.py", 2)]["python_mb"] == 0.5
+    assert lines[("a.py", 3)]["free_mb"] == 1.25
+    assert lines[("a.py", 5)]["lock_wait"] == 0.75
+    assert lines[("b.py", 7)]["memcpy"] == 3
+    assert lines[("c.py", 9)]["gpu"] == 0.125
+    assert lines[("c.py", 9)]["cpu_python"] == 0
+
+
+def entries(stats):
+    """Which files and lines each per-line map has entries for."""
+    return {
+        name: {f: set(lines) for (f, lines) in getattr(stats, name).items()}
+        for name in (
+            "cpu_samples_python",
+            "gpu_samples",
+            "memory_malloc_samples",
+            "memory_python_samples",
+            "memcpy_samples",
+            "lock_wait_samples",
+        )
+    }
+
+
+def test_encoding_leaves_statistics_alone(stats):
+    before = entries(stats)
+    encode_snapshot(stats, 0.0, 1.0)
+    assert entries(stats) == before
+
+
+def test_rejects_other_data(stats):
+    data = bytearray(encode_snapshot(stats, 0.0, 1.0))
+    data[0:8] = b"NOTSNAPS"
+    with pytest.raises(ValueError):
+        decode_snapshot(bytes(data))
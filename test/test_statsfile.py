@@ -0,0 +1,131 @@
+import math
+import struct
+import sys
+
+import pytest
+
+from scalene import scalene_statsfile as sf
+
+NAN = float("nan")
+
+
+def tables(seed):
+    """A table of each kind, with rows that differ somewhat by seed."""
+    line = {
+        ("a.py", 1, 0): [1.0 + seed, NAN, 3.0],
+        ("a.py", 2 + seed, 0): [NAN, 2.0, seed],
+        ("café.py", 7, 0): [0.5, 0.25, NAN],
+        ("bad\udcff.py", 9, 0): [seed, seed, seed],
+    }
+    bytecode = {
+        ("a.py", 1, 4): [seed + 1.0],
+        ("a.py", 1, 10 + seed): [2.0],
+    }
+    label = {
+        ("b.py", 3, "gpu"): [1.0, NAN],
+        ("b.py", 3, f"label{seed}"): [NAN, 4.0],
+    }
+    return [
+        (sf.LINE, 3, line),
+        (sf.BYTECODE, 1, bytecode),
+        (sf.LABEL, 2, label),
+    ]
+
+
+def normalize(ts):
+    """NaN-free, comparable tables (NaN becomes None)."""
+    return [
+        (
+            kind,
+            n,
+            {
+                key: [None if math.isnan(v) else v for v in values]
+                for (key, values) in rows.items()
+            },
+        )
+        for (kind, n, rows) in ts
+    ]
+
+
+def expected_merge(all_tables):
+    merged = normalize(all_tables[0])
+    for ts in all_tables[1:]:
+        for ((_, _, dest), (_, _, rows)) in zip(merged, normalize(ts)):
+            for (key, values) in rows.items():
+                row = dest.setdefault(key, [None] * len(values))
+                for (i, v) in enumerate(values):
+                    if v is not None:
+                        row[i] = v if row[i] is None else row[i] + v
+    return merged
+
+
+def test_round_trip():
+    ts = tables(0)
+    data = b"".join(sf.encode(ts, b"extra stuff"))
+    (decoded, extras) = sf.decode(data)
+    assert normalize(decoded) == normalize(ts)
+    assert extras == b"extra stuff"
+
+
+def test_round_trip_through_file(tmp_path):
+    path = str(tmp_path / "stats")
+    ts = tables(1)
+    sf.write(path, ts, b"")
+    (decoded, extras) = sf.read(path)
+    assert normalize(decoded) == normalize(ts)
+    assert extras == b""
+
+
+def test_rejects_bad_magic():
+    data = bytearray(b"".join(sf.encode(tables(0))))
+    data[0:8] = b"NOTSTATS"
+    with pytest.raises(ValueError):
+        sf.decode(bytes(data))
+
+
+def test_rejects_other_versions():
+    data = bytearray(b"".join(sf.encode(tables(0))))
+    struct.pack_into("=H", data, 8, sf.VERSION + 1)
+    with pytest.raises(ValueError):
+        sf.decode(bytes(data))
+
+
+def write_files(tmp_path, n):
+    paths = []
+    for i in range(n):
+        path = str(tmp_path / f"stats{i}")
+        sf.write(path, tables(i), f"extras{i}".encode())
+        paths.append(path)
+    return paths
+
+
+def python_merge(paths, monkeypatch):
+    # (None in sys.modules makes the import fail.)
+    monkeypatch.setitem(sys.modules, "stats_merge", None)
+    return sf.merge(paths)
+
+
+def test_python_merge(tmp_path, monkeypatch):
+    paths = write_files(tmp_path, 3)
+    (merged, extras) = python_merge(paths, monkeypatch)
+    assert normalize(merged) == expected_merge([tables(i) for i in range(3)])
+    assert extras == [b"extras0", b"extras1", b"extras2"]
+
+
+def test_native_merge_matches_python(tmp_path, monkeypatch):
+    pytest.importorskip("stats_merge")
+    paths = write_files(tmp_path, 4)
+    (native, native_extras) = sf.merge(paths)
+    (python, python_extras) = python_merge(paths, monkeypatch)
+    assert normalize(native) == normalize(python)
+    assert native_extras == python_extras
+
+
+def test_native_merge_rejects_other_versions(tmp_path):
+    pytest.importorskip("stats_merge")
+    (path,) = write_files(tmp_path, 1)
+    with open(path, "r+b") as f:
+        f.seek(8)
+        f.write(struct.pack("=H", sf.VERSION + 1))
+    with pytest.raises(ValueError):
+        sf.merge([path])